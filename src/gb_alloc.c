@@ -0,0 +1,255 @@
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "gb_alloc.h"
+
+// chunks hold at least this many bytes, or 4 blocks, whichever is larger.
+#define GB_SLAB_CHUNK_SIZE (64 * 1024)
+
+// glyph images start with a header which records their size class.
+#define GB_IMAGE_HEADER_SIZE 16
+#define GB_IMAGE_HEAP_CLASS UINT32_MAX
+
+#define GB_ARENA_MIN_BLOCK_SIZE (16 * 1024)
+#define GB_ALIGN_16(n) (((n) + 15) & ~(size_t)15)
+
+static void _GB_CountHeapAlloc(struct GB_Allocator *allocator)
+{
+    __atomic_add_fetch(&allocator->num_heap_allocs, 1, __ATOMIC_RELAXED);
+}
+
+//
+// slab pool
+//
+
+static void _GB_SlabPoolInit(struct GB_SlabPool *pool, uint32_t block_size)
+{
+    memset(pool, 0, sizeof(struct GB_SlabPool));
+    pool->block_size = block_size < sizeof(void*) ? sizeof(void*) : block_size;
+    pool->blocks_per_chunk = GB_SLAB_CHUNK_SIZE / pool->block_size;
+    if (pool->blocks_per_chunk < 4)
+        pool->blocks_per_chunk = 4;
+}
+
+static void _GB_SlabPoolDestroy(struct GB_SlabPool *pool)
+{
+    uint32_t i;
+    for (i = 0; i < pool->num_chunks; i++)
+        free(pool->chunk[i]);
+    free(pool->chunk);
+}
+
+static void *_GB_SlabPoolAlloc(struct GB_Allocator *allocator, struct GB_SlabPool *pool)
+{
+    if (!pool->free_list) {
+        if (pool->num_chunks == pool->chunk_capacity) {
+            uint32_t capacity = pool->chunk_capacity ? pool->chunk_capacity * 2 : 8;
+            void **chunk = (void**)realloc(pool->chunk, sizeof(void*) * capacity);
+            if (!chunk)
+                return NULL;
+            _GB_CountHeapAlloc(allocator);
+            pool->chunk = chunk;
+            pool->chunk_capacity = capacity;
+        }
+        uint8_t *chunk = (uint8_t*)malloc((size_t)pool->block_size * pool->blocks_per_chunk);
+        if (!chunk)
+            return NULL;
+        _GB_CountHeapAlloc(allocator);
+        pool->chunk[pool->num_chunks++] = chunk;
+
+        // thread the new blocks onto the free list, first block on top.
+        uint32_t i;
+        for (i = pool->blocks_per_chunk; i > 0; i--) {
+            void *block = chunk + (size_t)(i - 1) * pool->block_size;
+            *(void**)block = pool->free_list;
+            pool->free_list = block;
+        }
+    }
+
+    void *block = pool->free_list;
+    pool->free_list = *(void**)block;
+    allocator->num_pool_allocs++;
+    return block;
+}
+
+static void _GB_SlabPoolFree(struct GB_SlabPool *pool, void *block)
+{
+    *(void**)block = pool->free_list;
+    pool->free_list = block;
+}
+
+//
+// arena
+//
+
+static void _GB_ArenaDestroy(struct GB_Arena *arena)
+{
+    struct GB_ArenaBlock *block = arena->block;
+    while (block) {
+        struct GB_ArenaBlock *next = block->next;
+        free(block);
+        block = next;
+    }
+    arena->block = NULL;
+    arena->capacity = 0;
+}
+
+static struct GB_ArenaBlock *_GB_ArenaAddBlock(struct GB_Allocator *allocator, struct GB_Arena *arena, size_t size)
+{
+    struct GB_ArenaBlock *block = (struct GB_ArenaBlock*)malloc(GB_ALIGN_16(sizeof(struct GB_ArenaBlock)) + size);
+    if (!block)
+        return NULL;
+    _GB_CountHeapAlloc(allocator);
+    block->next = arena->block;
+    block->size = size;
+    block->used = 0;
+    arena->block = block;
+    arena->capacity += size;
+    return block;
+}
+
+static void *_GB_ArenaAlloc(struct GB_Allocator *allocator, struct GB_Arena *arena, size_t size)
+{
+    size = GB_ALIGN_16(size);
+    struct GB_ArenaBlock *block = arena->block;
+    if (!block || block->size - block->used < size) {
+        // grow geometrically, so a large text only costs a handful of blocks the first time.
+        size_t block_size = arena->capacity > GB_ARENA_MIN_BLOCK_SIZE ? arena->capacity : GB_ARENA_MIN_BLOCK_SIZE;
+        if (block_size < size)
+            block_size = size;
+        block = _GB_ArenaAddBlock(allocator, arena, block_size);
+        if (!block)
+            return NULL;
+    }
+    void *ptr = (uint8_t*)block + GB_ALIGN_16(sizeof(struct GB_ArenaBlock)) + block->used;
+    block->used += size;
+    return ptr;
+}
+
+static void _GB_ArenaReset(struct GB_Allocator *allocator, struct GB_Arena *arena)
+{
+    // more than one block means the arena has grown, merge them so the next use fits in a single block.
+    if (arena->block && arena->block->next) {
+        size_t capacity = arena->capacity;
+        _GB_ArenaDestroy(arena);
+        _GB_ArenaAddBlock(allocator, arena, capacity);
+    } else if (arena->block) {
+        arena->block->used = 0;
+    }
+}
+
+//
+// allocator
+//
+
+GB_ERROR GB_AllocatorMake(uint32_t glyph_size, struct GB_Allocator **allocator_out)
+{
+    if (!allocator_out)
+        return GB_ERROR_INVAL;
+
+    struct GB_Allocator *allocator = (struct GB_Allocator*)malloc(sizeof(struct GB_Allocator));
+    if (!allocator)
+        return GB_ERROR_NOMEM;
+    memset(allocator, 0, sizeof(struct GB_Allocator));
+    pthread_mutex_init(&allocator->mutex, NULL);
+    _GB_SlabPoolInit(&allocator->glyph_pool, glyph_size);
+    uint32_t i;
+    for (i = 0; i < GB_NUM_IMAGE_CLASSES; i++)
+        _GB_SlabPoolInit(allocator->image_pool + i, 1 << (GB_IMAGE_MIN_CLASS_SHIFT + i));
+
+    *allocator_out = allocator;
+    return GB_ERROR_NONE;
+}
+
+void GB_AllocatorDestroy(struct GB_Allocator *allocator)
+{
+    assert(allocator);
+    _GB_ArenaDestroy(&allocator->scratch);
+    uint32_t i;
+    for (i = 0; i < GB_NUM_IMAGE_CLASSES; i++)
+        _GB_SlabPoolDestroy(allocator->image_pool + i);
+    _GB_SlabPoolDestroy(&allocator->glyph_pool);
+    pthread_mutex_destroy(&allocator->mutex);
+    free(allocator);
+}
+
+void *GB_AllocatorMalloc(struct GB_Allocator *allocator, size_t size)
+{
+    void *ptr = malloc(size);
+    if (ptr)
+        _GB_CountHeapAlloc(allocator);
+    return ptr;
+}
+
+void GB_AllocatorFree(struct GB_Allocator *allocator, void *ptr)
+{
+    free(ptr);
+}
+
+void *GB_AllocatorAllocGlyph(struct GB_Allocator *allocator)
+{
+    pthread_mutex_lock(&allocator->mutex);
+    void *glyph = _GB_SlabPoolAlloc(allocator, &allocator->glyph_pool);
+    pthread_mutex_unlock(&allocator->mutex);
+    return glyph;
+}
+
+void GB_AllocatorFreeGlyph(struct GB_Allocator *allocator, void *glyph)
+{
+    pthread_mutex_lock(&allocator->mutex);
+    _GB_SlabPoolFree(&allocator->glyph_pool, glyph);
+    pthread_mutex_unlock(&allocator->mutex);
+}
+
+uint8_t *GB_AllocatorAllocImage(struct GB_Allocator *allocator, size_t size)
+{
+    if (size == 0)
+        return NULL;
+
+    // smallest class which fits the image & its header
+    const size_t total = size + GB_IMAGE_HEADER_SIZE;
+    uint32_t image_class = 0;
+    while (image_class < GB_NUM_IMAGE_CLASSES && ((size_t)1 << (GB_IMAGE_MIN_CLASS_SHIFT + image_class)) < total)
+        image_class++;
+
+    uint8_t *block;
+    if (image_class < GB_NUM_IMAGE_CLASSES) {
+        pthread_mutex_lock(&allocator->mutex);
+        block = (uint8_t*)_GB_SlabPoolAlloc(allocator, allocator->image_pool + image_class);
+        pthread_mutex_unlock(&allocator->mutex);
+    } else {
+        image_class = GB_IMAGE_HEAP_CLASS;
+        block = (uint8_t*)GB_AllocatorMalloc(allocator, total);
+    }
+    if (!block)
+        return NULL;
+    *(uint32_t*)block = image_class;
+    return block + GB_IMAGE_HEADER_SIZE;
+}
+
+void GB_AllocatorFreeImage(struct GB_Allocator *allocator, uint8_t *image)
+{
+    if (!image)
+        return;
+
+    uint8_t *block = image - GB_IMAGE_HEADER_SIZE;
+    const uint32_t image_class = *(uint32_t*)block;
+    if (image_class == GB_IMAGE_HEAP_CLASS) {
+        free(block);
+    } else {
+        assert(image_class < GB_NUM_IMAGE_CLASSES);
+        pthread_mutex_lock(&allocator->mutex);
+        _GB_SlabPoolFree(allocator->image_pool + image_class, block);
+        pthread_mutex_unlock(&allocator->mutex);
+    }
+}
+
+void *GB_AllocatorAllocScratch(struct GB_Allocator *allocator, size_t size)
+{
+    return _GB_ArenaAlloc(allocator, &allocator->scratch, size);
+}
+
+void GB_AllocatorResetScratch(struct GB_Allocator *allocator)
+{
+    _GB_ArenaReset(allocator, &allocator->scratch);
+}
@@ -0,0 +1,79 @@
+#ifndef GB_ALLOC_H
+#define GB_ALLOC_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+#include "gb_error.h"
+
+// fixed size blocks carved out of larger chunks, freed blocks are kept on a free list and reused.
+// chunks are only returned to the heap when the pool is destroyed.
+struct GB_SlabPool {
+    uint32_t block_size;
+    uint32_t blocks_per_chunk;
+    void *free_list;  // each free block starts with a ptr to the next one
+    void **chunk;
+    uint32_t num_chunks;
+    uint32_t chunk_capacity;
+};
+
+// a block of scratch memory, the rest of the block follows this header.
+struct GB_ArenaBlock {
+    struct GB_ArenaBlock *next;
+    size_t size;
+    size_t used;
+};
+
+// bump allocator for temporary memory, everything is freed at once by GB_ArenaReset.
+struct GB_Arena {
+    struct GB_ArenaBlock *block;  // current block first
+    size_t capacity;  // sum of all block sizes
+};
+
+// glyph images are pooled in power of two size classes, from 64 bytes up to 16k.
+// larger images come straight from the heap.
+#define GB_IMAGE_MIN_CLASS_SHIFT 6
+#define GB_NUM_IMAGE_CLASSES 9
+
+// owned by the context, holds the memory for glyphs, glyph images & the scratch memory used while making a text.
+// glyphs are made on worker threads too, so the pools are guarded by a mutex.
+// The scratch arena is only used by the thread calling GB_TextMake & GB_ContextPoll.
+struct GB_Allocator {
+    pthread_mutex_t mutex;  // guards the pools
+    struct GB_SlabPool glyph_pool;
+    struct GB_SlabPool image_pool[GB_NUM_IMAGE_CLASSES];
+    struct GB_Arena scratch;
+    uint64_t num_heap_allocs;  // malloc & realloc calls made by this allocator, updated atomically
+    uint64_t num_pool_allocs;  // blocks handed out by the pools, guarded by mutex
+};
+
+GB_ERROR GB_AllocatorMake(uint32_t glyph_size, struct GB_Allocator **allocator_out);
+void GB_AllocatorDestroy(struct GB_Allocator *allocator);
+
+// heap memory which is counted in num_heap_allocs, must be freed with GB_AllocatorFree.
+void *GB_AllocatorMalloc(struct GB_Allocator *allocator, size_t size);
+void GB_AllocatorFree(struct GB_Allocator *allocator, void *ptr);
+
+// a block of glyph_size bytes, see GB_AllocatorMake.
+void *GB_AllocatorAllocGlyph(struct GB_Allocator *allocator);
+void GB_AllocatorFreeGlyph(struct GB_Allocator *allocator, void *glyph);
+
+// glyph image of size bytes, NULL if size is 0.
+uint8_t *GB_AllocatorAllocImage(struct GB_Allocator *allocator, size_t size);
+void GB_AllocatorFreeImage(struct GB_Allocator *allocator, uint8_t *image);
+
+// scratch memory, valid until the next GB_AllocatorResetScratch. 16 byte aligned.
+void *GB_AllocatorAllocScratch(struct GB_Allocator *allocator, size_t size);
+
+// frees all scratch memory. Once the arena has grown to fit the largest text, this never touches the heap.
+void GB_AllocatorResetScratch(struct GB_Allocator *allocator);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // GB_ALLOC_H
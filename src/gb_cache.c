@@ -4,130 +4,409 @@
 #include "gb_glyph.h"
 #include "gb_font.h"
 #include "gb_cache.h"
+#include "gb_packer.h"
 #include "gb_texture.h"
+#include "gb_alloc.h"
 
-static GB_ERROR _GB_SheetInit(struct GB_Cache *cache, enum GB_TextureFormat texture_format, struct GB_Sheet *sheet)
+static GB_ERROR _GB_SheetMake(struct GB_Cache *cache, struct GB_Sheet **sheet_out)
 {
-    uint8_t *image = NULL;
+    struct GB_Sheet *sheet = (struct GB_Sheet*)malloc(sizeof(struct GB_Sheet));
+    if (!sheet)
+        return GB_ERROR_NOMEM;
 
     const uint32_t texture_size = cache->texture_size;
+    const enum GB_TextureFormat texture_format = cache->texture_format;
+    const uint32_t pixel_size = texture_format == GB_TEXTURE_FORMAT_ALPHA ? 1 : 4;
+    sheet->shadow = (uint8_t*)malloc(texture_size * texture_size * pixel_size);
+    if (!sheet->shadow) {
+        free(sheet);
+        return GB_ERROR_NOMEM;
+    }
 #ifndef NDEBUG
     // in debug fill image with 128.
-    uint32_t pixel_size = texture_format == GB_TEXTURE_FORMAT_ALPHA ? 1 : 4;
-    image = (uint8_t*)malloc(texture_size * texture_size * pixel_size);
-    memset(image, 0x80, texture_size * texture_size * pixel_size);
+    memset(sheet->shadow, 0x80, texture_size * texture_size * pixel_size);
+#else
+    memset(sheet->shadow, 0, texture_size * texture_size * pixel_size);
 #endif
 
-    GB_TextureInit(texture_format, cache->texture_size, image, &sheet->gl_tex_obj);
+    GB_TextureInit(texture_format, texture_size, sheet->shadow, &sheet->gl_tex_obj);
     sheet->texture_format = texture_format;
+    sheet->num_dirty_rects = 0;
+    sheet->level = NULL;
     sheet->num_levels = 0;
+    sheet->level_capacity = 0;
+    sheet->glyph = NULL;
+    sheet->num_glyphs = 0;
+    sheet->glyph_capacity = 0;
+    sheet->rect = NULL;
+    sheet->num_rects = 0;
+    sheet->rect_capacity = 0;
+    sheet->free_rect = NULL;
+    sheet->num_free_rects = 0;
+    sheet->free_rect_capacity = 0;
+    cache->packer->clear(cache, sheet);
+
+    *sheet_out = sheet;
+    return GB_ERROR_NONE;
+}
 
-#ifndef NDEBUG
-    free(image);
-#endif
+static void _GB_SheetDestroy(struct GB_Sheet *sheet)
+{
+    GB_TextureDestroy(sheet->gl_tex_obj);
+    free(sheet->shadow);
+    free(sheet->level);
+    free(sheet->glyph);
+    free(sheet->rect);
+    free(sheet->free_rect);
+    free(sheet);
+}
 
-    return GB_ERROR_NONE;
+static uint32_t _GB_CacheSheetBytes(struct GB_Cache *cache)
+{
+    uint32_t pixel_size = cache->texture_format == GB_TEXTURE_FORMAT_ALPHA ? 1 : 4;
+    return cache->texture_size * cache->texture_size * pixel_size;
 }
 
-static int _GB_SheetAddNewLevel(struct GB_Cache *cache, struct GB_Sheet *sheet, uint32_t height)
+// make room for one more glyph in the sheet glyph array.
+// returns 0 if out of memory, the glyph is then treated as if it did not fit.
+static int _GB_SheetReserveGlyph(struct GB_Sheet *sheet)
 {
-    struct GB_SheetLevel *prev_level = (sheet->num_levels == 0) ? NULL : &sheet->level[sheet->num_levels - 1];
-    uint32_t baseline = prev_level ? prev_level->baseline + prev_level->height : 0;
-    if (sheet->num_levels < GB_MAX_LEVELS_PER_SHEET && (baseline + height) <= cache->texture_size) {
-        struct GB_SheetLevel *level = &sheet->level[sheet->num_levels++];
-        memset(level, 0, sizeof(struct GB_SheetLevel));
-        level->baseline = baseline;
-        level->height = height;
-        level->num_glyphs = 0;
+    if (sheet->num_glyphs < sheet->glyph_capacity)
         return 1;
-    } else {
+
+    const uint32_t new_capacity = sheet->glyph_capacity ? sheet->glyph_capacity * 2 : 64;
+    struct GB_Glyph **glyph = (struct GB_Glyph**)realloc(sheet->glyph, sizeof(struct GB_Glyph*) * new_capacity);
+    if (!glyph)
         return 0;
+    sheet->glyph = glyph;
+    sheet->glyph_capacity = new_capacity;
+    return 1;
+}
+
+// room must already be reserved, see _GB_SheetReserveGlyph.
+static void _GB_SheetAddGlyph(struct GB_Sheet *sheet, struct GB_Glyph *glyph)
+{
+    assert(sheet->num_glyphs < sheet->glyph_capacity);
+    glyph->sheet_slot = sheet->num_glyphs;
+    sheet->glyph[sheet->num_glyphs++] = glyph;
+}
+
+// remove glyph from the sheet glyph array, by swapping with the last one.
+static void _GB_SheetRemoveGlyph(struct GB_Sheet *sheet, struct GB_Glyph *glyph)
+{
+    assert(glyph->sheet_slot < sheet->num_glyphs && sheet->glyph[glyph->sheet_slot] == glyph);
+    struct GB_Glyph *last = sheet->glyph[--sheet->num_glyphs];
+    sheet->glyph[glyph->sheet_slot] = last;
+    last->sheet_slot = glyph->sheet_slot;
+}
+
+static uint32_t _GB_RectArea(const struct GB_SheetRect *rect)
+{
+    return rect->size[0] * rect->size[1];
+}
+
+static void _GB_RectUnion(const struct GB_SheetRect *a, const struct GB_SheetRect *b, struct GB_SheetRect *out)
+{
+    uint32_t x0 = a->origin[0] < b->origin[0] ? a->origin[0] : b->origin[0];
+    uint32_t y0 = a->origin[1] < b->origin[1] ? a->origin[1] : b->origin[1];
+    uint32_t x1 = a->origin[0] + a->size[0] > b->origin[0] + b->size[0] ? a->origin[0] + a->size[0] : b->origin[0] + b->size[0];
+    uint32_t y1 = a->origin[1] + a->size[1] > b->origin[1] + b->size[1] ? a->origin[1] + a->size[1] : b->origin[1] + b->size[1];
+    out->origin[0] = x0;
+    out->origin[1] = y0;
+    out->size[0] = x1 - x0;
+    out->size[1] = y1 - y0;
+}
+
+// grows the dirty region of sheet to cover the given rect.
+// neighboring rects are merged, trading a few redundant pixels for fewer uploads.
+static void _GB_SheetAddDirtyRect(struct GB_Sheet *sheet, const uint32_t origin[2], const uint32_t size[2])
+{
+    if (size[0] == 0 || size[1] == 0)
+        return;
+
+    struct GB_SheetRect rect = {{origin[0], origin[1]}, {size[0], size[1]}};
+    struct GB_SheetRect merged;
+
+    // merge into an existing rect, if the union is not much larger than the two rects on their own.
+    uint32_t i;
+    for (i = 0; i < sheet->num_dirty_rects; i++) {
+        struct GB_SheetRect *dirty = sheet->dirty_rect + i;
+        _GB_RectUnion(dirty, &rect, &merged);
+        if (_GB_RectArea(&merged) <= 2 * (_GB_RectArea(dirty) + _GB_RectArea(&rect))) {
+            *dirty = merged;
+            return;
+        }
     }
+
+    if (sheet->num_dirty_rects < GB_MAX_DIRTY_RECTS_PER_SHEET) {
+        sheet->dirty_rect[sheet->num_dirty_rects++] = rect;
+        return;
+    }
+
+    // out of rects, merge into the one which grows the least.
+    uint32_t best_i = 0;
+    uint32_t best_growth = UINT32_MAX;
+    for (i = 0; i < sheet->num_dirty_rects; i++) {
+        _GB_RectUnion(sheet->dirty_rect + i, &rect, &merged);
+        uint32_t growth = _GB_RectArea(&merged) - _GB_RectArea(sheet->dirty_rect + i);
+        if (growth < best_growth) {
+            best_growth = growth;
+            best_i = i;
+        }
+    }
+    _GB_RectUnion(sheet->dirty_rect + best_i, &rect, sheet->dirty_rect + best_i);
 }
 
-static void _GB_SheetSubloadGlyph(struct GB_Sheet *sheet, struct GB_Glyph *glyph)
+// copy pixels into the sheet shadow at origin, src_stride is the distance between rows of src in bytes.
+static void _GB_SheetWritePixels(struct GB_Cache *cache, struct GB_Sheet *sheet, const uint32_t origin[2],
+                                 const uint32_t size[2], const uint8_t *src, uint32_t src_stride)
 {
     assert(sheet);
-    GB_TextureSubLoad(sheet->gl_tex_obj, sheet->texture_format, glyph->origin, glyph->size, glyph->image);
+    const uint32_t pixel_size = sheet->texture_format == GB_TEXTURE_FORMAT_ALPHA ? 1 : 4;
+    const uint32_t stride = cache->texture_size * pixel_size;
+    const uint32_t row_bytes = size[0] * pixel_size;
+    uint8_t *dst = sheet->shadow + origin[1] * stride + origin[0] * pixel_size;
+    uint32_t y;
+    for (y = 0; y < size[1]; y++) {
+        memcpy(dst + y * stride, src + y * src_stride, row_bytes);
+    }
+    _GB_SheetAddDirtyRect(sheet, origin, size);
 }
 
-static int _GB_SheetLevelInsertGlyph(struct GB_Cache *cache, struct GB_SheetLevel *level,
-                                     struct GB_Glyph *glyph)
+static void _GB_SheetWriteGlyph(struct GB_Cache *cache, struct GB_Sheet *sheet, struct GB_Glyph *glyph)
 {
-    struct GB_Glyph *prev_glyph = level->num_glyphs == 0 ? NULL : level->glyph[level->num_glyphs - 1];
-
-    if (level->num_glyphs < GB_MAX_GLYPHS_PER_LEVEL) {
-        if (prev_glyph) {
-            if (prev_glyph->origin[0] + prev_glyph->size[0] + glyph->size[0] <= cache->texture_size) {
+    const uint32_t pixel_size = sheet->texture_format == GB_TEXTURE_FORMAT_ALPHA ? 1 : 4;
+    if (glyph->image) {
+        _GB_SheetWritePixels(cache, sheet, glyph->origin, glyph->size, glyph->image, glyph->size[0] * pixel_size);
+
+        // the sheet shadow is now the only copy of the glyph pixels.
+        if (cache->option_flags & GB_CONTEXT_OPTION_RELEASE_GLYPH_IMAGES) {
+            GB_AllocatorFreeImage(glyph->allocator, glyph->image);
+            glyph->image = NULL;
+        }
+    } else if (glyph->outline) {
+        // rasterize straight into the shadow, which is then the only copy of the glyph pixels.
+        const uint32_t stride = cache->texture_size * pixel_size;
+        uint8_t *dst = sheet->shadow + glyph->origin[1] * stride + glyph->origin[0] * pixel_size;
+        GB_GlyphRenderOutline(glyph, sheet->texture_format, dst, stride);
+        _GB_SheetAddDirtyRect(sheet, glyph->origin, glyph->size);
+    }
+}
 
-                // update glyph origin
-                glyph->origin[0] = prev_glyph->origin[0] + prev_glyph->size[0];
-                glyph->origin[1] = level->baseline;
+// glyph is leaving sheet without being copied anywhere else, so its pixels must be copied out of the shadow.
+static GB_ERROR _GB_SheetRecoverGlyphImage(struct GB_Cache *cache, struct GB_Sheet *sheet, struct GB_Glyph *glyph)
+{
+    if (glyph->image || glyph->size[0] == 0 || glyph->size[1] == 0)
+        return GB_ERROR_NONE;
+
+    const uint32_t pixel_size = sheet->texture_format == GB_TEXTURE_FORMAT_ALPHA ? 1 : 4;
+    const uint32_t stride = cache->texture_size * pixel_size;
+    const uint32_t row_bytes = glyph->size[0] * pixel_size;
+    glyph->image = GB_AllocatorAllocImage(glyph->allocator, row_bytes * glyph->size[1]);
+    if (!glyph->image)
+        return GB_ERROR_NOMEM;
+
+    const uint8_t *src = sheet->shadow + glyph->origin[1] * stride + glyph->origin[0] * pixel_size;
+    uint32_t y;
+    for (y = 0; y < glyph->size[1]; y++) {
+        memcpy(glyph->image + y * row_bytes, src + y * stride, row_bytes);
+    }
+    return GB_ERROR_NONE;
+}
 
-                // add glyph to sheet
-                level->glyph[level->num_glyphs++] = glyph;
-                return 1;
+// upload each dirty rect of the shadow with a single GB_TextureSubLoad.
+static GB_ERROR _GB_SheetFlush(struct GB_Cache *cache, struct GB_Sheet *sheet)
+{
+    const uint32_t pixel_size = sheet->texture_format == GB_TEXTURE_FORMAT_ALPHA ? 1 : 4;
+    const uint32_t stride = cache->texture_size * pixel_size;
+    uint32_t i;
+    for (i = 0; i < sheet->num_dirty_rects; i++) {
+        struct GB_SheetRect *rect = sheet->dirty_rect + i;
+        uint8_t *src = sheet->shadow + rect->origin[1] * stride + rect->origin[0] * pixel_size;
+        if (rect->size[0] != cache->texture_size) {
+            // rows are not contiguous in the shadow, gather them into the upload buffer.
+            const uint32_t row_bytes = rect->size[0] * pixel_size;
+            const uint32_t bytes = row_bytes * rect->size[1];
+            if (bytes > cache->upload_buffer_size) {
+                uint8_t *upload_buffer = (uint8_t*)realloc(cache->upload_buffer, bytes);
+                if (!upload_buffer)
+                    return GB_ERROR_NOMEM;
+                cache->upload_buffer = upload_buffer;
+                cache->upload_buffer_size = bytes;
             }
-        } else {
-            if (glyph->size[0] <= cache->texture_size) {
-                glyph->origin[0] = 0;
-                glyph->origin[1] = level->baseline;
-
-                // add glyph to sheet
-                level->glyph[level->num_glyphs++] = glyph;
-                return 1;
+            uint32_t y;
+            for (y = 0; y < rect->size[1]; y++) {
+                memcpy(cache->upload_buffer + y * row_bytes, src + y * stride, row_bytes);
             }
+            src = cache->upload_buffer;
         }
+        GB_TextureSubLoad(sheet->gl_tex_obj, sheet->texture_format, rect->origin, rect->size, src);
     }
+    sheet->num_dirty_rects = 0;
+    return GB_ERROR_NONE;
+}
 
-    // no free space
-    return 0;
+// releases the glyphs held by the compactor, and the back sheet if it has not been swapped in.
+static void _GB_CacheCompactorClear(struct GB_Cache *cache)
+{
+    struct GB_CacheCompactor *c = &cache->compactor;
+    uint32_t i;
+    for (i = 0; i < c->num_glyphs; i++) {
+        GB_GlyphRelease(c->glyph[i]);
+    }
+    free(c->glyph);
+    free(c->back_origin);
+    if (c->back_sheet)
+        _GB_SheetDestroy(c->back_sheet);
+
+    c->src_sheet = NULL;
+    c->back_sheet = NULL;
+    c->glyph = NULL;
+    c->back_origin = NULL;
+    c->num_glyphs = 0;
+    c->next_glyph = 0;
 }
 
-static int _GB_SheetInsertGlyph(struct GB_Cache *cache, struct GB_Sheet *sheet, struct GB_Glyph *glyph)
+// returns 0 if out of memory, the space is then lost until the sheet is compacted.
+static int _GB_SheetAddFreeRect(struct GB_Sheet *sheet, uint32_t x, uint32_t y, uint32_t w, uint32_t h)
 {
-    int i = 0;
-    for (i = 0; i < sheet->num_levels; i++) {
-        if (glyph->size[1] <= sheet->level[i].height) {
-            if (_GB_SheetLevelInsertGlyph(cache, &sheet->level[i], glyph)) {
-                glyph->gl_tex_obj = sheet->gl_tex_obj;
-                _GB_SheetSubloadGlyph(sheet, glyph);
+    if (w == 0 || h == 0)
+        return 1;
+
+    // merge with a neighboring free rect, if they share a full edge.
+    uint32_t i;
+    for (i = 0; i < sheet->num_free_rects; i++) {
+        struct GB_SheetRect *rect = sheet->free_rect + i;
+        if (rect->origin[1] == y && rect->size[1] == h) {
+            if (rect->origin[0] + rect->size[0] == x) {
+                rect->size[0] += w;
+                return 1;
+            } else if (x + w == rect->origin[0]) {
+                rect->origin[0] = x;
+                rect->size[0] += w;
+                return 1;
+            }
+        } else if (rect->origin[0] == x && rect->size[0] == w) {
+            if (rect->origin[1] + rect->size[1] == y) {
+                rect->size[1] += h;
+                return 1;
+            } else if (y + h == rect->origin[1]) {
+                rect->origin[1] = y;
+                rect->size[1] += h;
                 return 1;
             }
         }
     }
 
-    // add a new level.
-    if (_GB_SheetAddNewLevel(cache, sheet, glyph->size[1])) {
-        if (_GB_SheetLevelInsertGlyph(cache, &sheet->level[i], glyph)) {
-            glyph->gl_tex_obj = sheet->gl_tex_obj;
-            _GB_SheetSubloadGlyph(sheet, glyph);
-            return 1;
-        } else {
-            // glyph is wider then the texture?!?
-            glyph->gl_tex_obj = 0;
+    // grow free rect array if necessary
+    if (sheet->num_free_rects == sheet->free_rect_capacity) {
+        const uint32_t new_capacity = sheet->free_rect_capacity ? sheet->free_rect_capacity * 2 : 16;
+        struct GB_SheetRect *free_rect = (struct GB_SheetRect*)realloc(sheet->free_rect, sizeof(struct GB_SheetRect) * new_capacity);
+        if (!free_rect)
             return 0;
+        sheet->free_rect = free_rect;
+        sheet->free_rect_capacity = new_capacity;
+    }
+
+    struct GB_SheetRect *rect = sheet->free_rect + sheet->num_free_rects++;
+    rect->origin[0] = x;
+    rect->origin[1] = y;
+    rect->size[0] = w;
+    rect->size[1] = h;
+    return 1;
+}
+
+// place glyph into the space left behind by evicted glyphs.
+// best area fit, the leftover space is split along the shorter axis & returned to the free list.
+static int _GB_SheetFreeRectInsert(struct GB_Cache *cache, struct GB_Sheet *sheet, struct GB_Glyph *glyph)
+{
+    const uint32_t w = glyph->size[0];
+    const uint32_t h = glyph->size[1];
+    uint32_t best_area = UINT32_MAX;
+    uint32_t best_i = 0;
+
+    uint32_t i;
+    for (i = 0; i < sheet->num_free_rects; i++) {
+        const struct GB_SheetRect *rect = sheet->free_rect + i;
+        if (w <= rect->size[0] && h <= rect->size[1]) {
+            const uint32_t area = rect->size[0] * rect->size[1] - w * h;
+            if (area < best_area) {
+                best_area = area;
+                best_i = i;
+                if (area == 0)
+                    break;
+            }
         }
+    }
+
+    if (best_area == UINT32_MAX)
+        return 0;
+
+    // remove rect from free list, by swapping with the last one.
+    struct GB_SheetRect rect = sheet->free_rect[best_i];
+    sheet->free_rect[best_i] = sheet->free_rect[--sheet->num_free_rects];
+
+    glyph->origin[0] = rect.origin[0];
+    glyph->origin[1] = rect.origin[1];
+
+    const uint32_t dx = rect.size[0] - w;
+    const uint32_t dy = rect.size[1] - h;
+    int ok;
+    if (dx > dy) {
+        ok = _GB_SheetAddFreeRect(sheet, rect.origin[0] + w, rect.origin[1], dx, rect.size[1]);
+        ok &= _GB_SheetAddFreeRect(sheet, rect.origin[0], rect.origin[1] + h, w, dy);
+    } else {
+        ok = _GB_SheetAddFreeRect(sheet, rect.origin[0] + w, rect.origin[1], dx, h);
+        ok &= _GB_SheetAddFreeRect(sheet, rect.origin[0], rect.origin[1] + h, rect.size[0], dy);
+    }
+    if (!ok)
+        cache->needs_compaction = 1;
+    return 1;
+}
+
+static void _GB_SheetBindGlyph(struct GB_Cache *cache, struct GB_Sheet *sheet, struct GB_Glyph *glyph)
+{
+    glyph->gl_tex_obj = sheet->gl_tex_obj;
+    glyph->sheet = sheet;
+    _GB_SheetAddGlyph(sheet, glyph);
+    _GB_SheetWriteGlyph(cache, sheet, glyph);
+}
+
+static int _GB_SheetInsertGlyph(struct GB_Cache *cache, struct GB_Sheet *sheet, struct GB_Glyph *glyph)
+{
+    if (_GB_SheetReserveGlyph(sheet) &&
+        (_GB_SheetFreeRectInsert(cache, sheet, glyph) || cache->packer->insert(cache, sheet, glyph))) {
+        _GB_SheetBindGlyph(cache, sheet, glyph);
+        return 1;
     } else {
-        glyph->gl_tex_obj = 0;
         // out of room
+        glyph->gl_tex_obj = 0;
+        glyph->sheet = NULL;
         return 0;
     }
 }
 
-GB_ERROR GB_CacheMake(uint32_t texture_size, uint32_t num_sheets, enum GB_TextureFormat texture_format,
-                      struct GB_Cache **cache_out)
+GB_ERROR GB_CacheMake(uint32_t texture_size, uint32_t max_texture_bytes, enum GB_TextureFormat texture_format,
+                      enum GB_PackerType packer_type, uint32_t option_flags, struct GB_Cache **cache_out)
 {
     struct GB_Cache *cache = (struct GB_Cache*)malloc(sizeof(struct GB_Cache));
+    if (!cache)
+        return GB_ERROR_NOMEM;
     memset(cache, 0, sizeof(struct GB_Cache));
 
-    cache->num_sheets = num_sheets;
+    // sheets are created on demand, see _GB_CacheAddSheet
+    cache->sheet = NULL;
+    cache->num_sheets = 0;
+    cache->sheet_capacity = 0;
     cache->texture_size = texture_size;
-    cache->glyph_hash = NULL;
-
-    uint32_t i;
-    for (i = 0; i < num_sheets; i++)
-        _GB_SheetInit(cache, texture_format, &cache->sheet[i]);
+    cache->texture_format = texture_format;
+    cache->max_texture_bytes = max_texture_bytes;
+    cache->option_flags = option_flags;
+    cache->packer = GB_PackerGet(packer_type);
+    if (GB_GlyphTableInit(&cache->glyph_table) != GB_ERROR_NONE) {
+        free(cache);
+        return GB_ERROR_NOMEM;
+    }
 
     *cache_out = cache;
     return GB_ERROR_NONE;
@@ -136,38 +415,144 @@ GB_ERROR GB_CacheMake(uint32_t texture_size, uint32_t num_sheets, enum GB_Textur
 GB_ERROR GB_CacheDestroy(struct GB_Cache *cache)
 {
     if (cache) {
+        _GB_CacheCompactorClear(cache);
+
         // release all glyphs
-        struct GB_Glyph *glyph, *tmp;
-        HASH_ITER(cache_hh, cache->glyph_hash, glyph, tmp) {
-            HASH_DELETE(cache_hh, cache->glyph_hash, glyph);
-            GB_GlyphRelease(glyph);
+        uint32_t j;
+        for (j = 0; j < cache->glyph_table.capacity; j++) {
+            if (cache->glyph_table.key[j] != GB_GLYPH_TABLE_EMPTY_KEY) {
+                GB_FontRemoveGlyph(cache->glyph_table.glyph[j]);
+                GB_GlyphRelease(cache->glyph_table.glyph[j]);
+            }
         }
+        GB_GlyphTableDestroy(&cache->glyph_table);
 
-        // destroy all textures
+        // destroy all sheets & their textures
         int i;
         for (i = 0; i < cache->num_sheets; i++)
-            GB_TextureDestroy(cache->sheet[i].gl_tex_obj);
+            _GB_SheetDestroy(cache->sheet[i]);
+        free(cache->sheet);
+        free(cache->upload_buffer);
 
         free(cache);
     }
     return GB_ERROR_NONE;
 }
 
+// adds a new empty sheet to the end of the sheet array.
+// returns 0 if another sheet would exceed the max_texture_bytes budget.
+static int _GB_CacheAddSheet(struct GB_Cache *cache)
+{
+    const uint32_t sheet_bytes = _GB_CacheSheetBytes(cache);
+    if ((uint64_t)(cache->num_sheets + 1) * sheet_bytes > cache->max_texture_bytes)
+        return 0;
+
+    // grow sheet array if necessary
+    if (cache->num_sheets == cache->sheet_capacity) {
+        const uint32_t new_capacity = cache->sheet_capacity ? cache->sheet_capacity * 2 : 4;
+        struct GB_Sheet **sheet = (struct GB_Sheet**)realloc(cache->sheet, sizeof(struct GB_Sheet*) * new_capacity);
+        if (!sheet)
+            return 0;
+        cache->sheet = sheet;
+        cache->sheet_capacity = new_capacity;
+    }
+
+    struct GB_Sheet *sheet = NULL;
+    if (_GB_SheetMake(cache, &sheet) != GB_ERROR_NONE)
+        return 0;
+
+    cache->sheet[cache->num_sheets++] = sheet;
+    return 1;
+}
+
 static int _GB_CacheInsertGlyph(struct GB_Cache *cache, struct GB_Glyph *glyph)
 {
     int i;
     for (i = 0; i < cache->num_sheets; i++) {
-        struct GB_Sheet *sheet = cache->sheet + i;
+        struct GB_Sheet *sheet = cache->sheet[i];
+        // the sheet being compacted is about to be replaced, use its replacement instead.
+        if (sheet == cache->compactor.src_sheet)
+            sheet = cache->compactor.back_sheet;
         if (_GB_SheetInsertGlyph(cache, sheet, glyph)) {
             return 1;
         }
     }
+
+    // glyph can never fit, don't bother growing.
+    if (glyph->size[0] > cache->texture_size || glyph->size[1] > cache->texture_size) {
+        glyph->gl_tex_obj = 0;
+        glyph->sheet = NULL;
+        return 0;
+    }
+
+    // all sheets are full, add another sheet and try again.
+    if (_GB_CacheAddSheet(cache)) {
+        return _GB_SheetInsertGlyph(cache, cache->sheet[cache->num_sheets - 1], glyph);
+    }
+
+    glyph->gl_tex_obj = 0;
+    glyph->sheet = NULL;
     return 0;
 }
 
-static int _GB_CacheAddSheet(struct GB_Cache *cache)
+// glyphs used during the current frame are never evicted.
+// frame 0 means GB_ContextBeginFrame has never been called, so every unused glyph is fair game.
+static int _GB_CacheCanEvictGlyph(struct GB_Context *gb, struct GB_Glyph *glyph)
+{
+    return glyph->num_users == 0 && (gb->frame == 0 || glyph->frame != gb->frame);
+}
+
+// removes an unused glyph from the cache, its space is returned to the sheet free list.
+static void _GB_CacheRemoveGlyph(struct GB_Cache *cache, struct GB_Glyph *glyph)
+{
+    struct GB_Sheet *sheet = glyph->sheet;
+    if (sheet) {
+        if (!_GB_SheetAddFreeRect(sheet, glyph->origin[0], glyph->origin[1], glyph->size[0], glyph->size[1]))
+            cache->needs_compaction = 1;
+        _GB_SheetRemoveGlyph(sheet, glyph);
+    }
+
+    // the glyph may outlive this call, if it is retained by the compactor.
+    glyph->gl_tex_obj = 0;
+    glyph->sheet = NULL;
+
+    GB_CacheLRURemove(cache, glyph);
+    GB_FontRemoveGlyph(glyph);
+    GB_GlyphTableRemove(&cache->glyph_table, glyph->key);
+    GB_GlyphRelease(glyph);
+}
+
+// evicts the least recently used glyph, which has not been used during the current frame.
+// sheet_out is set to the sheet that now has some extra free space, or NULL.
+// returns 0 if there is nothing left to evict.
+static int _GB_CacheEvictGlyph(struct GB_Context *gb, struct GB_Cache *cache, struct GB_Sheet **sheet_out)
+{
+    // the tail of the lru list is the least recently used glyph
+    struct GB_Glyph *glyph = cache->lru_list ? cache->lru_list->prev : NULL;
+    if (!glyph || !_GB_CacheCanEvictGlyph(gb, glyph))
+        return 0;
+
+    *sheet_out = glyph->sheet;
+    _GB_CacheRemoveGlyph(cache, glyph);
+    return 1;
+}
+
+// evict glyphs one at a time, until glyph fits into the space they leave behind.
+// gives up after GB_CACHE_MAX_EVICTIONS_PER_INSERT evictions, the caller then asks for a compaction pass.
+static int _GB_CacheEvictAndInsertGlyph(struct GB_Context *gb, struct GB_Cache *cache, struct GB_Glyph *glyph)
 {
-    // TODO:
+    if (glyph->size[0] > cache->texture_size || glyph->size[1] > cache->texture_size)
+        return 0;
+
+    struct GB_Sheet *sheet = NULL;
+    uint32_t num_evictions = 0;
+    while (num_evictions++ < GB_CACHE_MAX_EVICTIONS_PER_INSERT && _GB_CacheEvictGlyph(gb, cache, &sheet)) {
+        if (sheet && sheet != cache->compactor.src_sheet && _GB_SheetReserveGlyph(sheet) &&
+            _GB_SheetFreeRectInsert(cache, sheet, glyph)) {
+            _GB_SheetBindGlyph(cache, sheet, glyph);
+            return 1;
+        }
+    }
     return 0;
 }
 
@@ -177,61 +562,210 @@ static int glyph_cmp(const void *a, const void *b)
     return (*(struct GB_Glyph**)b)->size[1] - (*(struct GB_Glyph**)a)->size[1];
 }
 
-GB_ERROR GB_CacheCompact(struct GB_Context *gb, struct GB_Cache *cache)
+// gives glyphs which are using the fallback texture another chance to get into a sheet.
+static void _GB_CacheInsertFallbackGlyphs(struct GB_Cache *cache)
 {
-    uint32_t num_glyph_ptrs;
-    struct GB_Glyph **glyph_ptrs = GB_ContextHashValues(gb, &num_glyph_ptrs);
-
-    // The goal of all this retaining & releasing is to make sure we dispose of all
-    // glyphs that are in the cache but aren't in the context.
-    // i.e. clear out all the unused glyphs.
+    uint32_t i;
+    for (i = 0; i < cache->glyph_table.capacity; i++) {
+        if (cache->glyph_table.key[i] == GB_GLYPH_TABLE_EMPTY_KEY)
+            continue;
+        struct GB_Glyph *glyph = cache->glyph_table.glyph[i];
+        if (!glyph->sheet && !glyph->pending && glyph->size[0] <= cache->texture_size && glyph->size[1] <= cache->texture_size)
+            _GB_CacheInsertGlyph(cache, glyph);
+    }
+}
 
-    // retain all glyphs in the context
-    int i;
-    for (i = 0; i < num_glyph_ptrs; i++) {
-        GB_GlyphRetain(glyph_ptrs[i]);
+// prepare to rebuild cache->sheet[sheet_index]
+static GB_ERROR _GB_CacheCompactorBeginSheet(struct GB_Context *gb, struct GB_Cache *cache)
+{
+    struct GB_CacheCompactor *c = &cache->compactor;
+    struct GB_Sheet *src_sheet = cache->sheet[c->sheet_index];
+
+    // discard unused glyphs, instead of copying them.
+    struct GB_Glyph *glyph, *tmp;
+    DL_FOREACH_SAFE(cache->lru_list, glyph, tmp) {
+        if (glyph->sheet == src_sheet && _GB_CacheCanEvictGlyph(gb, glyph))
+            _GB_CacheRemoveGlyph(cache, glyph);
     }
 
-    // release all glyphs in the cache
-    struct GB_Glyph *glyph;
-    for (glyph = cache->glyph_hash; glyph != NULL; glyph = glyph->cache_hh.next) {
-        GB_GlyphRelease(glyph);
+    // retain the remaining glyphs, so they can't be freed out from under us by an eviction.
+    c->glyph = (struct GB_Glyph**)malloc(sizeof(struct GB_Glyph*) * (src_sheet->num_glyphs + 1));
+    if (!c->glyph)
+        return GB_ERROR_NOMEM;
+    uint32_t i;
+    for (i = 0; i < src_sheet->num_glyphs; i++) {
+        glyph = src_sheet->glyph[i];
+        GB_GlyphRetain(glyph);
+        c->glyph[c->num_glyphs++] = glyph;
     }
-    HASH_CLEAR(cache_hh, cache->glyph_hash);
+    qsort(c->glyph, c->num_glyphs, sizeof(struct GB_Glyph*), glyph_cmp);
 
-    // Clear all sheets
-    for (i = 0; i < cache->num_sheets; i++) {
-        struct GB_Sheet *sheet = &cache->sheet[i];
-        sheet->num_levels = 0;
+    c->back_origin = (uint32_t*)malloc(sizeof(uint32_t) * 2 * (c->num_glyphs + 1));
+    if (!c->back_origin)
+        return GB_ERROR_NOMEM;
+
+    GB_ERROR error = _GB_SheetMake(cache, &c->back_sheet);
+    if (error != GB_ERROR_NONE)
+        return error;
+
+    c->src_sheet = src_sheet;
+    c->next_glyph = 0;
+    return GB_ERROR_NONE;
+}
+
+// copies the next glyph into the back sheet, returns the number of bytes uploaded.
+static uint32_t _GB_CacheCompactorCopyGlyph(struct GB_Cache *cache)
+{
+    struct GB_CacheCompactor *c = &cache->compactor;
+    struct GB_Glyph *glyph = c->glyph[c->next_glyph];
+    uint32_t *back_origin = c->back_origin + c->next_glyph * 2;
+    c->next_glyph++;
+
+    back_origin[0] = UINT32_MAX;
+    back_origin[1] = UINT32_MAX;
+
+    // glyph was evicted after the pass started
+    if (glyph->sheet != c->src_sheet)
+        return 0;
+
+    // the packer writes glyph->origin, which must stay valid until the sheets are swapped.
+    uint32_t origin[2] = {glyph->origin[0], glyph->origin[1]};
+    uint32_t bytes = 0;
+    if (cache->packer->insert(cache, c->back_sheet, glyph)) {
+        back_origin[0] = glyph->origin[0];
+        back_origin[1] = glyph->origin[1];
+
+        // copy pixels from the source sheet shadow
+        const uint32_t pixel_size = cache->texture_format == GB_TEXTURE_FORMAT_ALPHA ? 1 : 4;
+        const uint32_t stride = cache->texture_size * pixel_size;
+        const uint8_t *src = c->src_sheet->shadow + origin[1] * stride + origin[0] * pixel_size;
+        _GB_SheetWritePixels(cache, c->back_sheet, glyph->origin, glyph->size, src, stride);
+        bytes = glyph->size[0] * glyph->size[1] * pixel_size;
     }
+    glyph->origin[0] = origin[0];
+    glyph->origin[1] = origin[1];
+    return bytes;
+}
 
-    // sort glyphs in decreasing height
-    qsort(glyph_ptrs, num_glyph_ptrs, sizeof(struct GB_Glyph*), glyph_cmp);
+// every glyph has been copied, replace the source sheet with the back sheet.
+static GB_ERROR _GB_CacheCompactorSwapSheets(struct GB_Context *gb, struct GB_Cache *cache)
+{
+    struct GB_CacheCompactor *c = &cache->compactor;
+    struct GB_Sheet *src_sheet = c->src_sheet;
+    struct GB_Sheet *back_sheet = c->back_sheet;
+    GB_ERROR error = GB_ERROR_NONE;
 
-    // decreasing height find-first heuristic.
-    for (i = 0; i < num_glyph_ptrs; i++) {
-        struct GB_Glyph *glyph = glyph_ptrs[i];
-        if (!_GB_CacheInsertGlyph(cache, glyph)) {
-            return GB_ERROR_NOMEM;
+    uint32_t i;
+    for (i = 0; i < c->num_glyphs; i++) {
+        struct GB_Glyph *glyph = c->glyph[i];
+        if (glyph->sheet != src_sheet)
+            continue;
+
+        const uint32_t *back_origin = c->back_origin + i * 2;
+        if (back_origin[0] != UINT32_MAX && _GB_SheetReserveGlyph(back_sheet)) {
+            glyph->origin[0] = back_origin[0];
+            glyph->origin[1] = back_origin[1];
+            glyph->gl_tex_obj = back_sheet->gl_tex_obj;
+            glyph->sheet = back_sheet;
+            _GB_SheetAddGlyph(back_sheet, glyph);
+        } else {
+            // did not fit or out of memory, it is placed again by _GB_CacheInsertFallbackGlyphs
+            GB_ERROR recover_error = _GB_SheetRecoverGlyphImage(cache, src_sheet, glyph);
+            if (recover_error != GB_ERROR_NONE)
+                error = recover_error;
+            glyph->gl_tex_obj = 0;
+            glyph->sheet = NULL;
         }
-        GB_CacheHashAdd(cache, glyph);
     }
 
-    // release all glyphs in the context, restoring their proper retain counts.
-    for (i = 0; i < num_glyph_ptrs; i++) {
-        GB_GlyphRelease(glyph_ptrs[i]);
+    cache->sheet[c->sheet_index] = back_sheet;
+    c->back_sheet = NULL;
+    _GB_SheetDestroy(src_sheet);
+    _GB_CacheCompactorClear(cache);
+
+    _GB_CacheInsertFallbackGlyphs(cache);
+
+    // point existing texts at the new glyph locations.
+    GB_ContextUpdateTextQuads(gb);
+
+    return error;
+}
+
+GB_ERROR GB_CacheCompactStep(struct GB_Context *gb, struct GB_Cache *cache, uint32_t max_bytes, int *done_out)
+{
+    struct GB_CacheCompactor *c = &cache->compactor;
+    if (!c->active) {
+        if (!cache->needs_compaction || cache->num_sheets == 0) {
+            *done_out = 1;
+            return GB_ERROR_NONE;
+        }
+        c->active = 1;
+        c->sheet_index = 0;
     }
 
-    free(glyph_ptrs);
+    // always make some progress, even if max_bytes is smaller than the next glyph.
+    uint32_t bytes = 0;
+    do {
+        if (!c->src_sheet) {
+            GB_ERROR error = _GB_CacheCompactorBeginSheet(gb, cache);
+            if (error != GB_ERROR_NONE) {
+                _GB_CacheCompactorClear(cache);
+                c->active = 0;
+                return error;
+            }
+        }
+
+        if (c->next_glyph < c->num_glyphs) {
+            bytes += _GB_CacheCompactorCopyGlyph(cache);
+        } else {
+            GB_ERROR error = _GB_CacheCompactorSwapSheets(gb, cache);
+            c->sheet_index++;
+            if (c->sheet_index >= cache->num_sheets) {
+                c->active = 0;
+                cache->needs_compaction = 0;
+            }
+            if (error != GB_ERROR_NONE)
+                return error;
+        }
+    } while (c->active && bytes < max_bytes);
 
+    *done_out = !c->active;
+
+    if (!(cache->option_flags & GB_CONTEXT_OPTION_DEFER_UPLOADS))
+        return GB_CacheFlush(cache);
     return GB_ERROR_NONE;
 }
 
+GB_ERROR GB_CacheCompact(struct GB_Context *gb, struct GB_Cache *cache)
+{
+    // dispose of all glyphs that are in the cache but aren't used by any text.
+    struct GB_Glyph *glyph, *tmp;
+    DL_FOREACH_SAFE(cache->lru_list, glyph, tmp) {
+        _GB_CacheRemoveGlyph(cache, glyph);
+    }
+
+    // finish any incremental pass in progress, new glyphs may already live in its back sheet.
+    // with no pass in progress, this would start the full pass below & run it twice.
+    int done = 0;
+    GB_ERROR error;
+    if (cache->compactor.active) {
+        error = GB_CacheCompactStep(gb, cache, UINT32_MAX, &done);
+        if (error != GB_ERROR_NONE)
+            return error;
+    }
+
+    // rebuild every sheet in a single pass.
+    // glyph pixels are copied from the sheet shadows, so they do not need their own images.
+    cache->needs_compaction = 1;
+    error = GB_CacheCompactStep(gb, cache, UINT32_MAX, &done);
+    assert(error != GB_ERROR_NONE || done);
+    return error;
+}
+
 GB_ERROR GB_CacheInsert(struct GB_Context *gb, struct GB_Cache *cache,
                         struct GB_Glyph **glyph_ptrs, int num_glyph_ptrs)
 {
     int i;
-    int cache_full = 0;
 
     // sort glyphs in decreasing height
     qsort(glyph_ptrs, num_glyph_ptrs, sizeof(struct GB_Glyph*), glyph_cmp);
@@ -239,57 +773,70 @@ GB_ERROR GB_CacheInsert(struct GB_Context *gb, struct GB_Cache *cache,
     // decreasing height find-first heuristic.
     for (i = 0; i < num_glyph_ptrs; i++) {
         struct GB_Glyph *glyph = glyph_ptrs[i];
-        // make sure duplicates don't end up in the hash
-        if (!GB_CacheHashFind(cache, glyph->index, glyph->font_index)) {
-            if (!_GB_CacheInsertGlyph(cache, glyph)) {
-
-                if (!cache_full) {
-                    // compact and try again.
-                    GB_ERROR error = GB_CacheCompact(gb, cache);
-                    if (error == GB_ERROR_NONE) {
-                        if (!_GB_CacheInsertGlyph(cache, glyph)) {
-                            // Add another sheet and try again.
-                            if (_GB_CacheAddSheet(cache)) {
-                                if (!_GB_CacheInsertGlyph(cache, glyph)) {
-                                    // glyph must be too big to fit in a single sheet.
-                                    assert(0);
-                                    return GB_ERROR_NOMEM;
-                                }
-                            } else {
-                                // failed to add sheet, no room
-                                cache_full = 1;
-                            }
-                        }
-                    } else {
-                        return error;
-                    }
-                }
-            }
-            // add new glyph to both hashes
-            GB_CacheHashAdd(cache, glyph);
-            GB_ContextHashAdd(gb, glyph);
-            GB_GlyphRelease(glyph);
+        assert(GB_CacheHashFind(cache, glyph->index, glyph->font_index) == glyph);
+        if (glyph->pending)
+            continue;
+
+        // _GB_CacheInsertGlyph will add sheets until the max_texture_bytes budget is reached.
+        // after that, make room by evicting unused glyphs.
+        if (!_GB_CacheInsertGlyph(cache, glyph) && !_GB_CacheEvictAndInsertGlyph(gb, cache, glyph)) {
+            // no room, glyph will use the fallback texture until GB_CacheCompactStep finds room for it.
+            if (glyph->size[0] <= cache->texture_size && glyph->size[1] <= cache->texture_size)
+                cache->needs_compaction = 1;
         }
     }
 
+    if (!(cache->option_flags & GB_CONTEXT_OPTION_DEFER_UPLOADS))
+        return GB_CacheFlush(cache);
     return GB_ERROR_NONE;
 }
 
-void GB_CacheHashAdd(struct GB_Cache *cache, struct GB_Glyph *glyph)
+GB_ERROR GB_CacheFlush(struct GB_Cache *cache)
+{
+    int i;
+    for (i = 0; i < cache->num_sheets; i++) {
+        GB_ERROR error = _GB_SheetFlush(cache, cache->sheet[i]);
+        if (error != GB_ERROR_NONE)
+            return error;
+    }
+
+    // glyphs placed into the sheet being rebuilt are already in use.
+    if (cache->compactor.back_sheet)
+        return _GB_SheetFlush(cache, cache->compactor.back_sheet);
+    return GB_ERROR_NONE;
+}
+
+GB_ERROR GB_CacheHashAdd(struct GB_Cache *cache, struct GB_Glyph *glyph)
 {
 #ifndef NDEBUG
     if (GB_CacheHashFind(cache, glyph->index, glyph->font_index)) {
         printf("GB_CacheHashAdd() WARNING glyph index = %d, font_index = %d is already in cache!\n", glyph->index, glyph->font_index);
     }
 #endif
-    HASH_ADD(cache_hh, cache->glyph_hash, key, sizeof(uint64_t), glyph);
-    GB_GlyphRetain(glyph);
+    GB_ERROR error = GB_GlyphTableAdd(&cache->glyph_table, glyph);
+    if (error == GB_ERROR_NONE)
+        GB_GlyphRetain(glyph);
+    return error;
 }
 
 struct GB_Glyph *GB_CacheHashFind(struct GB_Cache *cache, uint32_t glyph_index, uint32_t font_index)
 {
-    struct GB_Glyph *glyph = NULL;
     uint64_t key = ((uint64_t)font_index << 32) | glyph_index;
-    HASH_FIND(cache_hh, cache->glyph_hash, &key, sizeof(uint64_t), glyph);
-    return glyph;
+    return GB_GlyphTableFind(&cache->glyph_table, key);
+}
+
+void GB_CacheLRUAdd(struct GB_Cache *cache, struct GB_Glyph *glyph)
+{
+    assert(glyph->prev == NULL);
+    DL_PREPEND(cache->lru_list, glyph);
+}
+
+void GB_CacheLRURemove(struct GB_Cache *cache, struct GB_Glyph *glyph)
+{
+    // NOTE: glyphs in a DL list always have a non-NULL prev ptr.
+    if (glyph->prev) {
+        DL_DELETE(cache->lru_list, glyph);
+        glyph->prev = NULL;
+        glyph->next = NULL;
+    }
 }
@@ -7,41 +7,117 @@ extern "C" {
 
 #include <stdint.h>
 #include "gb_error.h"
+#include "gb_glyph_table.h"
 
-#define GB_MAX_GLYPHS_PER_LEVEL 128
+// used by the shelf packer
 struct GB_SheetLevel {
-    struct GB_Glyph *glyph[GB_MAX_GLYPHS_PER_LEVEL];
     uint32_t baseline;
     uint32_t height;
-    uint32_t num_glyphs;
+    uint32_t width;  // next glyph is placed at this x position
+};
+
+// used by the skyline and maxrects packers
+struct GB_SheetRect {
+    uint32_t origin[2];
+    uint32_t size[2];
 };
 
-#define GB_MAX_LEVELS_PER_SHEET 64
+#define GB_MAX_DIRTY_RECTS_PER_SHEET 8
+
+// a glyph which does not fit after this many evictions uses the fallback texture & waits for GB_CacheCompactStep.
+// freed space only merges along full edges, so mixed glyph sizes could otherwise empty the whole lru list.
+#define GB_CACHE_MAX_EVICTIONS_PER_INSERT 4
+
+// fields read while searching for room come first, texture & upload state is at the end.
 struct GB_Sheet {
+    struct GB_SheetRect *free_rect;  // space released by evicted glyphs, reused before asking the packer
+    uint32_t num_free_rects;
+    uint32_t free_rect_capacity;
+    struct GB_SheetLevel *level;  // shelf packer state
+    uint32_t num_levels;
+    uint32_t level_capacity;
+    struct GB_SheetRect *rect;  // skyline segments or maxrects free rects
+    uint32_t num_rects;
+    uint32_t rect_capacity;
+    struct GB_Glyph **glyph;  // every glyph placed in this sheet, packed. see GB_Glyph sheet_slot
+    uint32_t num_glyphs;
+    uint32_t glyph_capacity;
+
     uint32_t gl_tex_obj;
     enum GB_TextureFormat texture_format;
-    struct GB_SheetLevel level[GB_MAX_LEVELS_PER_SHEET];
-    uint32_t num_levels;
+    uint8_t *shadow;  // cpu copy of the texture, glyphs are written here and uploaded by GB_CacheFlush
+    uint32_t num_dirty_rects;
+    struct GB_SheetRect dirty_rect[GB_MAX_DIRTY_RECTS_PER_SHEET];  // regions of shadow not yet uploaded
+};
+
+// state of an incremental compaction pass, see GB_CacheCompactStep.
+// one sheet is rebuilt at a time, glyphs are copied into back_sheet while the original sheet stays intact,
+// so every glyph remains valid until the two are swapped.
+struct GB_CacheCompactor {
+    uint32_t active;  // 1 if a compaction pass is in progress
+    uint32_t sheet_index;  // index of the sheet being rebuilt
+    struct GB_Sheet *src_sheet;  // sheet being rebuilt, no new glyphs are placed into it.
+    struct GB_Sheet *back_sheet;  // replaces src_sheet once every glyph has been copied.
+    struct GB_Glyph **glyph;  // retained glyphs from src_sheet, in decreasing height.
+    uint32_t *back_origin;  // origin of each glyph within back_sheet, two per glyph. UINT32_MAX if it did not fit.
+    uint32_t num_glyphs;
+    uint32_t next_glyph;
 };
 
-#define GB_MAX_SHEETS_PER_CACHE 10
 struct GB_Cache {
-    struct GB_Sheet sheet[GB_MAX_SHEETS_PER_CACHE];
+    struct GB_Sheet **sheet;  // sheets are created on demand, as glyphs are inserted.
     uint32_t num_sheets;
+    uint32_t sheet_capacity;
     uint32_t texture_size;
-    struct GB_Glyph *glyph_hash;  // retains all glyphs in GB_Sheet structs.
+    enum GB_TextureFormat texture_format;
+    uint32_t max_texture_bytes;  // sheets are added until their textures would exceed this budget.
+    uint32_t option_flags;  // GB_CONTEXT_OPTION_FLAGS
+    const struct GB_Packer *packer;  // decides where glyphs are placed within each sheet
+    struct GB_GlyphTable glyph_table;  // retains every glyph in the cache, including all glyphs used by a GB_Text.
+    struct GB_Glyph *lru_list;  // glyphs not used by any GB_Text, most recently used first.
+    uint32_t needs_compaction;  // set when a glyph did not fit or freed space was lost, cleared at the end of a compaction pass.
+    struct GB_CacheCompactor compactor;
+    uint8_t *upload_buffer;  // dirty rects narrower than a sheet are gathered here before upload
+    uint32_t upload_buffer_size;
 };
 
-GB_ERROR GB_CacheMake(uint32_t texture_size, uint32_t num_sheets, enum GB_TextureFormat texture_format,
-                      struct GB_Cache **cache_out);
+GB_ERROR GB_CacheMake(uint32_t texture_size, uint32_t max_texture_bytes, enum GB_TextureFormat texture_format,
+                      enum GB_PackerType packer_type, uint32_t option_flags, struct GB_Cache **cache_out);
 GB_ERROR GB_CacheDestroy(struct GB_Cache *cache);
+
+// packs new glyphs into the cache sheets, they must already have been added with GB_CacheHashAdd.
+// pending glyphs are skipped, they are inserted again once they have been rasterized.
+// If there is no room, the least recently used glyphs in the lru list are evicted.
+// glyphs which still do not fit will use the fallback texture, and the cache is flagged for compaction.
+// This never compacts the cache, so the cost of an insert is bounded.
+// Pixels are uploaded before returning, unless GB_CONTEXT_OPTION_DEFER_UPLOADS is set.
 GB_ERROR GB_CacheInsert(struct GB_Context *gb, struct GB_Cache *cache,
                         struct GB_Glyph **glyph_ptrs, int num_glyph_ptrs);
+
+// compacts every sheet at once, all unused glyphs are discarded.
 GB_ERROR GB_CacheCompact(struct GB_Context *gb, struct GB_Cache *cache);
 
-void GB_CacheHashAdd(struct GB_Cache *cache, struct GB_Glyph *glyph);
+// performs a slice of an incremental compaction pass, copying at most max_bytes of glyph pixels.
+// A pass starts when the cache has been flagged by GB_CacheInsert and rebuilds one sheet at a time.
+// done_out is set to 1 when no pass is in progress.
+GB_ERROR GB_CacheCompactStep(struct GB_Context *gb, struct GB_Cache *cache, uint32_t max_bytes, int *done_out);
+
+// uploads the dirty regions of every sheet shadow to its texture.
+GB_ERROR GB_CacheFlush(struct GB_Cache *cache);
+
+// add glyph to the cache hash, and retain glyph. The glyph uses the fallback texture until it is placed by GB_CacheInsert.
+GB_ERROR GB_CacheHashAdd(struct GB_Cache *cache, struct GB_Glyph *glyph);
+
+// look up glyph in the cache hash and return it.
+// returns NULL if glyph is not present.
 struct GB_Glyph *GB_CacheHashFind(struct GB_Cache *cache, uint32_t glyph_index, uint32_t font_index);
 
+// glyph is no longer used by any GB_Text, add it to the lru list so it can be evicted.
+void GB_CacheLRUAdd(struct GB_Cache *cache, struct GB_Glyph *glyph);
+
+// glyph is in use again, remove it from the lru list. (if present)
+void GB_CacheLRURemove(struct GB_Cache *cache, struct GB_Glyph *glyph);
+
 #ifdef __cplusplus
 }
 #endif
@@ -1,9 +1,14 @@
 #include <assert.h>
 #include "gb_context.h"
 #include "gb_glyph.h"
+#include "gb_font.h"
 #include "gb_cache.h"
+#include "gb_packer.h"
 #include "gb_text.h"
 #include "gb_texture.h"
+#include "gb_worker.h"
+#include "gb_alloc.h"
+#include "gb_shape_cache.h"
 
 static GB_ERROR _GB_ContextInitFallbackOpenGLTexture(uint32_t *gl_tex_out)
 {
@@ -24,10 +29,13 @@ static int IsPowerOfTwo(uint32_t x)
     return ((x != 0) && !(x & (x - 1)));
 }
 
-GB_ERROR GB_ContextMake(uint32_t texture_size, uint32_t num_sheets,
-                        enum GB_TextureFormat texture_format, struct GB_Context **gb_out)
+GB_ERROR GB_ContextMake(uint32_t texture_size, uint32_t max_texture_bytes,
+                        enum GB_TextureFormat texture_format, enum GB_PackerType packer_type,
+                        uint32_t option_flags, struct GB_Context **gb_out)
 {
-    if (num_sheets < GB_MAX_SHEETS_PER_CACHE && texture_size > 0 && IsPowerOfTwo(texture_size)) {
+    const uint32_t pixel_size = texture_format == GB_TEXTURE_FORMAT_ALPHA ? 1 : 4;
+    if (texture_size > 0 && IsPowerOfTwo(texture_size) && GB_PackerGet(packer_type) &&
+        (uint64_t)texture_size * texture_size * pixel_size <= max_texture_bytes) {
         struct GB_Context *gb = (struct GB_Context*)malloc(sizeof(struct GB_Context));
         if (gb) {
             memset(gb, 0, sizeof(struct GB_Context));
@@ -42,16 +50,37 @@ GB_ERROR GB_ContextMake(uint32_t texture_size, uint32_t num_sheets,
             printf("FT_Version %d.%d.%d\n", major, minor, patch);
 #endif
 
+            // the allocator must outlive every glyph, it is destroyed last.
+            GB_ERROR err = GB_AllocatorMake(sizeof(struct GB_Glyph), &gb->allocator);
+            if (err != GB_ERROR_NONE) {
+                FT_Done_FreeType(gb->ft_library);
+                free(gb);
+                return err;
+            }
+
             struct GB_Cache *cache = NULL;
-            GB_ERROR err = GB_CacheMake(texture_size, num_sheets, texture_format, &cache);
+            err = GB_CacheMake(texture_size, max_texture_bytes, texture_format, packer_type, option_flags, &cache);
             if (err == GB_ERROR_NONE) {
                 gb->cache = cache;
             }
             gb->font_list = NULL;
-            gb->glyph_hash = NULL;
+            gb->face_list = NULL;
+            gb->text_list = NULL;
             gb->next_font_index = 0;
+            gb->frame = 0;
             _GB_ContextInitFallbackOpenGLTexture(&gb->fallback_gl_tex_obj);
             gb->texture_format = texture_format;
+            gb->option_flags = option_flags;
+            gb->worker_pool = NULL;
+            gb->text_ready_func = NULL;
+            gb->shape_cache = NULL;
+            gb->intern_table = NULL;
+            gb->intern_capacity = 0;
+            gb->num_interned = 0;
+            if (err == GB_ERROR_NONE)
+                err = GB_WorkerPoolMake(gb, (option_flags & GB_CONTEXT_OPTION_PARALLEL_RASTERIZE) != 0, &gb->worker_pool);
+            if (err == GB_ERROR_NONE && (option_flags & GB_CONTEXT_OPTION_SHAPE_CACHE))
+                err = GB_ShapeCacheMake(gb->allocator, GB_SHAPE_CACHE_MAX_ENTRIES, &gb->shape_cache);
             *gb_out = gb;
             return err;
         } else {
@@ -76,20 +105,21 @@ GB_ERROR GB_ContextRetain(struct GB_Context *gb)
 static void _GB_ContextDestroy(struct GB_Context *gb)
 {
     assert(gb);
-    if (gb->ft_library) {
-        FT_Done_FreeType(gb->ft_library);
+    if (gb->worker_pool) {
+        GB_WorkerPoolDestroy(gb->worker_pool);
     }
 
-    // release all glyphs
-    struct GB_Glyph *glyph, *tmp;
-    HASH_ITER(context_hh, gb->glyph_hash, glyph, tmp) {
-        HASH_DELETE(context_hh, gb->glyph_hash, glyph);
-        GB_GlyphRelease(glyph);
+    if (gb->ft_library) {
+        FT_Done_FreeType(gb->ft_library);
     }
 
     GB_TextureDestroy(gb->fallback_gl_tex_obj);
 
     GB_CacheDestroy(gb->cache);
+    if (gb->shape_cache)
+        GB_ShapeCacheDestroy(gb->shape_cache);
+    free(gb->intern_table);
+    GB_AllocatorDestroy(gb->allocator);
     free(gb);
 }
 
@@ -112,45 +142,158 @@ GB_ERROR GB_ContextCompact(struct GB_Context *gb)
     return GB_CacheCompact(gb, gb->cache);
 }
 
-void GB_ContextHashAdd(struct GB_Context *gb, struct GB_Glyph *glyph)
+GB_ERROR GB_ContextCompactStep(struct GB_Context *gb, uint32_t max_bytes, int *done_out)
 {
-#ifndef NDEBUG
-    if (GB_ContextHashFind(gb, glyph->index, glyph->font_index)) {
-        printf("GB_ContextHashAdd() WARNING glyph index = %d, font_index = %d is already in context!\n", glyph->index, glyph->font_index);
+    if (gb && done_out) {
+        return GB_CacheCompactStep(gb, gb->cache, max_bytes, done_out);
+    } else {
+        return GB_ERROR_INVAL;
     }
-#endif
-    HASH_ADD(context_hh, gb->glyph_hash, key, sizeof(uint64_t), glyph);
-    GB_GlyphRetain(glyph);
 }
 
-struct GB_Glyph *GB_ContextHashFind(struct GB_Context *gb, uint32_t glyph_index, uint32_t font_index)
+GB_ERROR GB_ContextFlush(struct GB_Context *gb)
 {
-    struct GB_Glyph *glyph = NULL;
-    uint64_t key = ((uint64_t)font_index << 32) | glyph_index;
-    HASH_FIND(context_hh, gb->glyph_hash, &key, sizeof(uint64_t), glyph);
-    return glyph;
+    if (gb) {
+        return GB_CacheFlush(gb->cache);
+    } else {
+        return GB_ERROR_INVAL;
+    }
 }
 
-void GB_ContextHashRemove(struct GB_Context *gb, uint32_t glyph_index, uint32_t font_index)
+GB_ERROR GB_ContextPoll(struct GB_Context *gb)
 {
-    struct GB_Glyph *glyph = NULL;
-    uint64_t key = ((uint64_t)font_index << 32) | glyph_index;
-    HASH_FIND(context_hh, gb->glyph_hash, &key, sizeof(uint64_t), glyph);
+    if (!gb)
+        return GB_ERROR_INVAL;
+
+    struct GB_WorkerPool *pool = gb->worker_pool;
+    if (pool->num_workers == 0)
+        GB_WorkerPoolRunQueued(gb, pool, GB_WORKER_QUEUED_GLYPHS_PER_RUN);
+
+    struct GB_RasterJob *finished = GB_WorkerPoolTakeFinished(pool);
+    if (!finished)
+        return GB_ERROR_NONE;
+
+    uint32_t num_jobs = 0;
+    struct GB_RasterJob *job;
+    for (job = finished; job != NULL; job = job->next)
+        num_jobs++;
+
+    // fill in the placeholders, unless they were evicted or rasterized by a synchronous text in the meantime.
+    struct GB_Glyph **glyph_ptrs = (struct GB_Glyph**)GB_AllocatorAllocScratch(gb->allocator, sizeof(struct GB_Glyph*) * num_jobs);
+    if (!glyph_ptrs) {
+        GB_WorkerPoolFreeJobs(finished);
+        return GB_ERROR_NOMEM;
+    }
+    uint32_t num_glyph_ptrs = 0;
+    for (job = finished; job != NULL; job = job->next) {
+        struct GB_Glyph *glyph = GB_CacheHashFind(gb->cache, job->index, job->font_index);
+        if (glyph && glyph->pending) {
+            GB_GlyphResolvePending(glyph, job->glyph);
+            glyph_ptrs[num_glyph_ptrs++] = glyph;
+        }
+    }
+    GB_WorkerPoolFreeJobs(finished);
+
+    GB_ERROR error = GB_CacheInsert(gb, gb->cache, glyph_ptrs, num_glyph_ptrs);
+    GB_AllocatorResetScratch(gb->allocator);
+    if (error != GB_ERROR_NONE)
+        return error;
+
+    // lay out pending texts again, the ones which are now ready are retained so the ready func may release them.
+    uint32_t num_pending = 0, num_ready = 0;
+    struct GB_Text *text;
+    for (text = gb->text_list; text != NULL; text = text->next)
+        num_pending += text->pending;
+    // the ready func may make new texts, so this array can not live in the scratch arena.
+    struct GB_Text **ready = (struct GB_Text**)GB_AllocatorMalloc(gb->allocator, sizeof(struct GB_Text*) * (num_pending + 1));
+    if (!ready)
+        return GB_ERROR_NOMEM;
+    for (text = gb->text_list; text != NULL; text = text->next) {
+        if (text->pending) {
+            GB_TextUpdatePending(gb, text);
+            if (!text->pending) {
+                GB_TextRetain(gb, text);
+                ready[num_ready++] = text;
+            }
+        }
+    }
+    GB_AllocatorResetScratch(gb->allocator);
+
+    uint32_t i;
+    for (i = 0; i < num_ready; i++) {
+        if (gb->text_ready_func)
+            gb->text_ready_func(gb, ready[i]);
+        GB_TextRelease(gb, ready[i]);
+    }
+    GB_AllocatorFree(gb->allocator, ready);
+    return GB_ERROR_NONE;
+}
+
+GB_ERROR GB_ContextSetTextReadyFunc(struct GB_Context *gb, GB_TextReadyFunc func)
+{
+    if (gb) {
+        gb->text_ready_func = func;
+        return GB_ERROR_NONE;
+    } else {
+        return GB_ERROR_INVAL;
+    }
+}
+
+GB_ERROR GB_ContextGetStats(struct GB_Context *gb, struct GB_ContextStats *stats_out)
+{
+    if (gb && stats_out) {
+        struct GB_Allocator *allocator = gb->allocator;
+        stats_out->num_heap_allocs = __atomic_load_n(&allocator->num_heap_allocs, __ATOMIC_RELAXED);
+        pthread_mutex_lock(&allocator->mutex);
+        stats_out->num_pool_allocs = allocator->num_pool_allocs;
+        pthread_mutex_unlock(&allocator->mutex);
+        stats_out->scratch_bytes = allocator->scratch.capacity;
+        stats_out->num_shape_lookups = gb->shape_cache ? gb->shape_cache->num_lookups : 0;
+        stats_out->num_shape_hits = gb->shape_cache ? gb->shape_cache->num_hits : 0;
+        return GB_ERROR_NONE;
+    } else {
+        return GB_ERROR_INVAL;
+    }
+}
+
+GB_ERROR GB_ContextBeginFrame(struct GB_Context *gb)
+{
+    if (gb) {
+        gb->frame++;
+        return GB_ERROR_NONE;
+    } else {
+        return GB_ERROR_INVAL;
+    }
+}
+
+void GB_ContextAddGlyphUse(struct GB_Context *gb, struct GB_Glyph *glyph)
+{
+    glyph->frame = gb->frame;
+    if (glyph->num_users == 0) {
+        // glyph is in use, it can no longer be evicted.
+        GB_CacheLRURemove(gb->cache, glyph);
+    }
+    glyph->num_users++;
+}
+
+void GB_ContextRemoveGlyphUse(struct GB_Context *gb, struct GB_Font *font, uint32_t glyph_index)
+{
+    struct GB_Glyph *glyph = GB_FontFindGlyph(gb, font, glyph_index);
     if (glyph) {
-        HASH_DELETE(context_hh, gb->glyph_hash, glyph);
-        GB_GlyphRelease(glyph);
+        assert(glyph->num_users > 0);
+        glyph->num_users--;
+        if (glyph->num_users == 0) {
+            // glyph is no longer in use, it may be evicted from the cache after this frame.
+            glyph->frame = gb->frame;
+            GB_CacheLRUAdd(gb->cache, glyph);
+        }
     }
 }
 
-struct GB_Glyph **GB_ContextHashValues(struct GB_Context *gb, uint32_t *num_ptrs_out)
+void GB_ContextUpdateTextQuads(struct GB_Context *gb)
 {
-    int num_glyph_ptrs = HASH_CNT(context_hh, gb->glyph_hash);
-    struct GB_Glyph **glyph_ptrs = (struct GB_Glyph**)malloc(sizeof(struct GB_Glyph*) * num_glyph_ptrs);
-    struct GB_Glyph *glyph;
-    int i = 0;
-    for (glyph = gb->glyph_hash; glyph != NULL; glyph = glyph->context_hh.next) {
-        glyph_ptrs[i++] = glyph;
+    struct GB_Text *text;
+    for (text = gb->text_list; text != NULL; text = text->next) {
+        GB_TextUpdateGlyphQuads(gb, text);
     }
-    *num_ptrs_out = num_glyph_ptrs;
-    return glyph_ptrs;
 }
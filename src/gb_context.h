@@ -10,12 +10,48 @@ extern "C" {
 #include FT_FREETYPE_H
 #include "gb_error.h"
 
+struct GB_Context;
 struct GB_GlyphQuad;  // in gb_text.h
+struct GB_Text;  // in gb_text.h
+struct GB_Glyph;  // in gb_glyph.h
+struct GB_Font;  // in gb_font.h
+struct GB_WorkerPool;  // in gb_worker.h
+struct GB_Allocator;  // in gb_alloc.h
+struct GB_ShapeCache;  // in gb_shape_cache.h
 
 enum GB_TextureFormat { GB_TEXTURE_FORMAT_ALPHA, GB_TEXTURE_FORMAT_RGBA = 1 };
 
+// strategy used to pack glyphs into the texture sheets of the glyph cache.
+enum GB_PackerType {
+    GB_PACKER_SHELF = 0,  // fixed height levels, fast but wastes space when glyph heights vary.
+    GB_PACKER_SKYLINE,  // skyline bottom-left, good utilization at a low cost.
+    GB_PACKER_MAXRECTS,  // maxrects best short side fit, best utilization, slowest insert.
+    GB_PACKER_NUM_PACKERS
+};
+
+typedef enum GB_Context_Option_Flags {
+    // glyph pixels are written into a cpu copy of each cache texture, and only uploaded by GB_ContextFlush.
+    // This lets all the glyphs added during a frame share a handful of texture uploads.
+    GB_CONTEXT_OPTION_DEFER_UPLOADS = 0x01,
+
+    // glyph bitmaps are freed once they have been written into a cache sheet,
+    // cpu memory is then bounded by max_texture_bytes, no matter how many glyphs are cached.
+    GB_CONTEXT_OPTION_RELEASE_GLYPH_IMAGES = 0x02,
+
+    // large batches of new glyphs are rasterized by a pool of worker threads, one per extra cpu core.
+    // each worker opens its own FT_Library and FT_Face instances, glyphs are still cached on the calling thread.
+    GB_CONTEXT_OPTION_PARALLEL_RASTERIZE = 0x04,
+
+    // texts are shaped a word at a time, splitting at spaces, and each shaped word is kept in a bounded lru cache.
+    // repeated words skip HarfBuzz, see num_shape_lookups & num_shape_hits in GB_ContextStats.
+    GB_CONTEXT_OPTION_SHAPE_CACHE = 0x08
+} GB_CONTEXT_OPTION_FLAGS;
+
 typedef void (*GB_TextRenderFunc)(struct GB_GlyphQuad *quads, uint32_t num_quads);
 
+// called by GB_ContextPoll when the quads of a GB_TEXT_OPTION_ASYNC text become final.
+typedef void (*GB_TextReadyFunc)(struct GB_Context *gb, struct GB_Text *text);
+
 // main context object, must be created before any GB_Font or GB_Text objects.
 // you should only need one per application.
 // reference counted
@@ -24,44 +60,94 @@ struct GB_Context {
     FT_Library ft_library;  // freetype2
     struct GB_Cache *cache;  // holds textures which contain rendered glyphs
     struct GB_Font *font_list;  // list of all GB_Font instances
-    struct GB_Glyph *glyph_hash;  // retains all glyphs in use by GB_Text structs
+    struct GB_Face *face_list;  // font files used by the fonts, shared between their point sizes
+    struct GB_Text *text_list;  // list of all GB_Text instances, their quads are updated when glyphs move, interned texts are not listed but their layouts are
     uint32_t next_font_index;  // counter used to uniquely identify GB_Font objects
+    uint32_t frame;  // frame counter, used to stamp glyph usage. see GB_ContextBeginFrame
     uint32_t fallback_gl_tex_obj;  // this texture is used to render glyphs which do not fit in the cache
     enum GB_TextureFormat texture_format;  // pixel format of cache textures
+    uint32_t option_flags;  // GB_CONTEXT_OPTION_FLAGS
+    struct GB_WorkerPool *worker_pool;  // rasterizes glyphs, only has threads if GB_CONTEXT_OPTION_PARALLEL_RASTERIZE is set
+    GB_TextReadyFunc text_ready_func;  // see GB_ContextSetTextReadyFunc, may be NULL
+    struct GB_Allocator *allocator;  // pools for glyphs & glyph images, and scratch memory for making texts
+    struct GB_ShapeCache *shape_cache;  // shaped words, NULL unless GB_CONTEXT_OPTION_SHAPE_CACHE is set
+    struct GB_Text **intern_table;  // layouts shared by GB_TEXT_OPTION_INTERN texts, hashed by content
+    uint32_t intern_capacity;  // buckets in intern_table, always a power of two
+    uint32_t num_interned;
+};
+
+// counters, see GB_ContextGetStats
+struct GB_ContextStats {
+    uint64_t num_heap_allocs;  // heap allocations made for glyphs, glyph images, texts, shaped words & scratch memory
+    uint64_t num_pool_allocs;  // glyphs & glyph images handed out by the context pools
+    uint64_t scratch_bytes;  // size of the scratch arena, it grows to fit the largest text
+    uint64_t num_shape_lookups;  // words looked up in the shape cache, 0 without GB_CONTEXT_OPTION_SHAPE_CACHE
+    uint64_t num_shape_hits;  // words found in the shape cache, which were not shaped again
 };
 
 // texture_size - width of texture sheets used by glyph cache in pixels (must be power of two)
-// num_sheets - number of texture sheets used by glyph cache.
+// max_texture_bytes - memory budget for the glyph cache textures, must be large enough to hold at least one sheet.
+//     sheets are created on demand, so the cache starts out small and grows as glyphs are added.
 // texture_format - pixel format of each texture used by the glyph cache.
 //     use GB_TEXTURE_FORMAT_ALPHA unless you are using LCD sub-pixel rendering
+// packer_type - strategy used to pack glyphs into the texture sheets.
+// option_flags - GB_CONTEXT_OPTION_FLAGS
 // Reference count starts at 1, must release to destroy.
-GB_ERROR GB_ContextMake(uint32_t texture_size, uint32_t num_sheets,
-                        enum GB_TextureFormat texture_format, struct GB_Context **gb_out);
+GB_ERROR GB_ContextMake(uint32_t texture_size, uint32_t max_texture_bytes,
+                        enum GB_TextureFormat texture_format, enum GB_PackerType packer_type,
+                        uint32_t option_flags, struct GB_Context **gb_out);
 
 // reference count
 GB_ERROR GB_ContextRetain(struct GB_Context *gb);
 GB_ERROR GB_ContextRelease(struct GB_Context *gb);
 
 // perform compaction/garbage collection on texture glyphs.
+// every sheet is rebuilt in a single call, see GB_ContextCompactStep for a cheaper alternative.
 GB_ERROR GB_ContextCompact(struct GB_Context *gb);
 
-// private
+// incrementally compact the glyph cache, call this once per frame.
+// When glyphs no longer fit, a compaction pass is started which rebuilds one sheet at a time.
+// Each call uploads roughly max_bytes of glyph pixels, glyphs remain valid while their sheet is being rebuilt.
+// NOTE: the sheet being rebuilt is double-buffered, so the textures may temporarily exceed max_texture_bytes by one sheet.
+// done_out is set to 1 when there is no compaction pass in progress.
+GB_ERROR GB_ContextCompactStep(struct GB_Context *gb, uint32_t max_bytes, int *done_out);
+
+// uploads all pending glyph pixels to the cache textures, with as few texture subloads as possible.
+// Only needed with GB_CONTEXT_OPTION_DEFER_UPLOADS, call it once per frame before rendering any text.
+GB_ERROR GB_ContextFlush(struct GB_Context *gb);
+
+// finish asynchronous texts, call this once per frame when using GB_TEXT_OPTION_ASYNC.
+// glyphs rasterized since the last call are added to the cache, and the texts using them are laid out again.
+// texts whose glyphs are all ready are passed to the text ready func.
+// Without worker threads, a handful of queued glyphs are rasterized by each call, so its cost stays bounded.
+GB_ERROR GB_ContextPoll(struct GB_Context *gb);
+
+// func is called by GB_ContextPoll for each asynchronous text once its quads are final, pass NULL to disable.
+GB_ERROR GB_ContextSetTextReadyFunc(struct GB_Context *gb, GB_TextReadyFunc func);
+
+// counters are cumulative, take the difference between two calls to measure an operation.
+// Once the pools & the scratch arena have warmed up, making a text from glyphs which are already cached
+// costs a single heap allocation. (HarfBuzz allocates its own buffers, those are not counted)
+GB_ERROR GB_ContextGetStats(struct GB_Context *gb, struct GB_ContextStats *stats_out);
+
+// marks the start of a new frame.
+// When the cache is full, glyphs which are no longer used by any GB_Text are evicted one at a time,
+// least recently used first. Glyphs used during the current frame are never evicted,
+// so texts can be destroyed and re-created every frame without losing their glyphs.
+// If this is never called, any glyph which is not used by a GB_Text can be evicted.
+GB_ERROR GB_ContextBeginFrame(struct GB_Context *gb);
 
-// add glyph to context hash, and retain glyph
-void GB_ContextHashAdd(struct GB_Context *gb, struct GB_Glyph *glyph);
+// private
 
-// look up glyph in context hash and return it.
-// returns NULL if glyph is not present.
-struct GB_Glyph *GB_ContextHashFind(struct GB_Context *gb, uint32_t glyph_index,
-                                    uint32_t font_index);
+// count one use of glyph by a GB_Text, glyphs in use are never evicted from the cache.
+// each call must be balanced by a call to GB_ContextRemoveGlyphUse.
+void GB_ContextAddGlyphUse(struct GB_Context *gb, struct GB_Glyph *glyph);
 
-// remove glyph from context hash
-void GB_ContextHashRemove(struct GB_Context *gb, uint32_t glyph_index, uint32_t font_index);
+// remove one use of a glyph, when the last use is removed the glyph becomes a candidate for eviction from the cache.
+void GB_ContextRemoveGlyphUse(struct GB_Context *gb, struct GB_Font *font, uint32_t glyph_index);
 
-// returns an array of pointers to all the glyphs currently in the context hash.
-// num_ptrs_out is modified to contain the number of elements
-// caller must free returned ptr.
-struct GB_Glyph **GB_ContextHashValues(struct GB_Context *gb, uint32_t *num_ptrs_out);
+// glyphs have moved within the cache, update the quads of every text.
+void GB_ContextUpdateTextQuads(struct GB_Context *gb);
 
 #ifdef __cplusplus
 }
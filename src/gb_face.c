@@ -0,0 +1,258 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "utlist.h"
+#include "gb_context.h"
+#include "gb_face.h"
+
+static struct GB_Face *_GB_FaceFindMapped(struct GB_Context *gb, dev_t dev, ino_t ino, uint64_t offset, size_t size)
+{
+    struct GB_Face *face;
+    DL_FOREACH(gb->face_list, face) {
+        if (face->map_base && face->dev == dev && face->ino == ino &&
+            face->offset == offset && face->data_size == size)
+            return face;
+    }
+    return NULL;
+}
+
+static struct GB_Face *_GB_FaceFindMemory(struct GB_Context *gb, const uint8_t *data, size_t size,
+                                          GB_FontReleaseFunc release_func, void *user_data)
+{
+    struct GB_Face *face;
+    DL_FOREACH(gb->face_list, face) {
+        if (!face->map_base && face->data == data && face->data_size == size &&
+            face->release_func == release_func && face->release_user_data == user_data)
+            return face;
+    }
+    return NULL;
+}
+
+static void _GB_FaceDestroy(struct GB_Context *gb, struct GB_Face *face)
+{
+    assert(face->rc == 0);
+
+    if (face->coverage) {
+        free(face->coverage->range);
+        free(face->coverage);
+    }
+
+    if (face->hb_face)
+        hb_face_destroy(face->hb_face);
+    if (face->ft_face)
+        FT_Done_Face(face->ft_face);
+
+    // give the font data back
+    if (face->map_base)
+        munmap(face->map_base, face->map_size);
+    else if (face->release_func)
+        face->release_func(face->release_user_data);
+
+    // context holds a list of all faces
+    DL_DELETE(gb->face_list, face);
+    free(face);
+}
+
+// opens the FreeType & HarfBuzz faces of face->data, neither copies it.
+// the face is destroyed on failure.
+static GB_ERROR _GB_FaceOpen(struct GB_Context *gb, struct GB_Face *face, struct GB_Face **face_out)
+{
+    // context holds a list of all faces
+    DL_PREPEND(gb->face_list, face);
+
+    if (FT_New_Memory_Face(gb->ft_library, face->data, (FT_Long)face->data_size, 0, &face->ft_face)) {
+        face->ft_face = NULL;
+        face->rc = 0;
+        _GB_FaceDestroy(gb, face);
+        return GB_ERROR_NOENT;
+    }
+
+    // harfbuzz reads the same data, the blob is released along with hb_face.
+    hb_blob_t *hb_blob = hb_blob_create((const char*)face->data, (unsigned int)face->data_size,
+                                        HB_MEMORY_MODE_READONLY, NULL, NULL);
+    face->hb_face = hb_face_create(hb_blob, 0);
+    hb_blob_destroy(hb_blob);
+
+    *face_out = face;
+    return GB_ERROR_NONE;
+}
+
+static struct GB_Face *_GB_FaceAlloc(void)
+{
+    struct GB_Face *face = (struct GB_Face*)malloc(sizeof(struct GB_Face));
+    if (face) {
+        memset(face, 0, sizeof(struct GB_Face));
+        face->rc = 1;
+    }
+    return face;
+}
+
+GB_ERROR GB_FaceMake(struct GB_Context *gb, const char *filename, struct GB_Face **face_out)
+{
+    if (!gb || !filename || !face_out)
+        return GB_ERROR_INVAL;
+
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0)
+        return GB_ERROR_NOENT;
+
+    GB_ERROR error = GB_FaceMakeFromMapped(gb, fd, 0, 0, face_out);
+    close(fd);
+    return error;
+}
+
+GB_ERROR GB_FaceMakeFromMapped(struct GB_Context *gb, int fd, uint64_t offset, size_t size, struct GB_Face **face_out)
+{
+    if (!gb || fd < 0 || !face_out)
+        return GB_ERROR_INVAL;
+
+    struct stat st;
+    if (fstat(fd, &st))
+        return GB_ERROR_NOENT;
+
+    // size 0 runs to the end of the file
+    if (offset > (uint64_t)st.st_size)
+        return GB_ERROR_INVAL;
+    if (size == 0)
+        size = (size_t)((uint64_t)st.st_size - offset);
+    if (size == 0 || offset + size > (uint64_t)st.st_size)
+        return GB_ERROR_INVAL;
+
+    // another font already uses this part of the file, possibly opened under a different path.
+    struct GB_Face *face = _GB_FaceFindMapped(gb, st.st_dev, st.st_ino, offset, size);
+    if (face) {
+        face->rc++;
+        *face_out = face;
+        return GB_ERROR_NONE;
+    }
+
+    face = _GB_FaceAlloc();
+    if (!face)
+        return GB_ERROR_NOMEM;
+    face->dev = st.st_dev;
+    face->ino = st.st_ino;
+    face->offset = offset;
+    face->data_size = size;
+
+    // mappings start on a page boundary, the font may not.
+    const uint64_t page_size = (uint64_t)sysconf(_SC_PAGESIZE);
+    const uint64_t map_offset = offset - offset % page_size;
+    face->map_size = (size_t)(offset - map_offset) + size;
+    void *map_base = mmap(NULL, face->map_size, PROT_READ, MAP_PRIVATE, fd, (off_t)map_offset);
+    if (map_base == MAP_FAILED) {
+        free(face);
+        return GB_ERROR_NOMEM;
+    }
+    face->map_base = map_base;
+    face->data = (const uint8_t*)map_base + (offset - map_offset);
+
+    return _GB_FaceOpen(gb, face, face_out);
+}
+
+GB_ERROR GB_FaceMakeFromMemory(struct GB_Context *gb, const uint8_t *data, size_t size,
+                               GB_FontReleaseFunc release_func, void *user_data, struct GB_Face **face_out)
+{
+    if (!gb || !data || size == 0 || !face_out) {
+        if (release_func)
+            release_func(user_data);
+        return GB_ERROR_INVAL;
+    }
+
+    struct GB_Face *face = _GB_FaceFindMemory(gb, data, size, release_func, user_data);
+    if (face) {
+        face->rc++;
+        *face_out = face;
+        return GB_ERROR_NONE;
+    }
+
+    face = _GB_FaceAlloc();
+    if (!face) {
+        if (release_func)
+            release_func(user_data);
+        return GB_ERROR_NOMEM;
+    }
+    face->data = data;
+    face->data_size = size;
+    face->release_func = release_func;
+    face->release_user_data = user_data;
+
+    return _GB_FaceOpen(gb, face, face_out);
+}
+
+// walk the cmap once, returns NULL if out of memory.
+static struct GB_FaceCoverage *_GB_FaceCoverageMake(FT_Face ft_face)
+{
+    struct GB_FaceCoverage *coverage = (struct GB_FaceCoverage*)malloc(sizeof(struct GB_FaceCoverage));
+    if (!coverage)
+        return NULL;
+    memset(coverage, 0, sizeof(struct GB_FaceCoverage));
+
+    uint32_t range_capacity = 0;
+    FT_UInt glyph_index = 0;
+    FT_ULong cp = FT_Get_First_Char(ft_face, &glyph_index);
+    while (glyph_index != 0) {
+        if (cp < 0x10000) {
+            coverage->bmp[cp >> 5] |= 1u << (cp & 31);
+        } else if (coverage->num_ranges && coverage->range[coverage->num_ranges - 1].last + 1 == cp) {
+            // codepoints arrive in increasing order, so they usually extend the last range.
+            coverage->range[coverage->num_ranges - 1].last = (uint32_t)cp;
+        } else {
+            if (coverage->num_ranges == range_capacity) {
+                range_capacity = range_capacity ? range_capacity * 2 : 16;
+                struct GB_CoverageRange *range = (struct GB_CoverageRange*)realloc(coverage->range, sizeof(struct GB_CoverageRange) * range_capacity);
+                if (!range) {
+                    free(coverage->range);
+                    free(coverage);
+                    return NULL;
+                }
+                coverage->range = range;
+            }
+            coverage->range[coverage->num_ranges].first = (uint32_t)cp;
+            coverage->range[coverage->num_ranges].last = (uint32_t)cp;
+            coverage->num_ranges++;
+        }
+        cp = FT_Get_Next_Char(ft_face, cp, &glyph_index);
+    }
+    return coverage;
+}
+
+int GB_FaceCovers(struct GB_Face *face, uint32_t cp)
+{
+    if (!face->coverage) {
+        face->coverage = _GB_FaceCoverageMake(face->ft_face);
+
+        // without an index, ask the cmap directly.
+        if (!face->coverage)
+            return FT_Get_Char_Index(face->ft_face, cp) != 0;
+    }
+
+    const struct GB_FaceCoverage *coverage = face->coverage;
+    if (cp < 0x10000)
+        return (coverage->bmp[cp >> 5] >> (cp & 31)) & 1;
+
+    uint32_t lo = 0, hi = coverage->num_ranges;
+    while (lo < hi) {
+        uint32_t mid = (lo + hi) / 2;
+        if (cp < coverage->range[mid].first)
+            hi = mid;
+        else if (cp > coverage->range[mid].last)
+            lo = mid + 1;
+        else
+            return 1;
+    }
+    return 0;
+}
+
+void GB_FaceRelease(struct GB_Context *gb, struct GB_Face *face)
+{
+    assert(gb && face);
+    face->rc--;
+    assert(face->rc >= 0);
+    if (face->rc == 0)
+        _GB_FaceDestroy(gb, face);
+}
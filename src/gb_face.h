@@ -0,0 +1,80 @@
+#ifndef GB_FACE_H
+#define GB_FACE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include <ft2build.h>
+#include FT_FREETYPE_H
+#include <harfbuzz/hb.h>
+#include "gb_error.h"
+#include "gb_font.h"
+
+struct GB_Context;
+
+// codepoints above the basic multilingual plane covered by a face, first & last are inclusive.
+struct GB_CoverageRange {
+    uint32_t first;
+    uint32_t last;
+};
+
+// the codepoints mapped by a face's unicode cmap, built the first time it is needed by GB_FaceCovers.
+// BMP codepoints are found with a single bit test, the rest with a binary search of the ranges.
+struct GB_FaceCoverage {
+    uint32_t bmp[0x10000 / 32];
+    struct GB_CoverageRange *range;  // sorted, never adjacent
+    uint32_t num_ranges;
+};
+
+// the data of a font file, shared by every GB_Font made from it whatever their point size.
+// The data is either mapped from a file, or memory owned by the caller. It is never copied,
+// FreeType & HarfBuzz both read their tables straight from it.
+// Each GB_Font is a size instance: an FT_Size of ft_face and an hb_font of hb_face.
+// reference counted by the fonts which use it
+struct GB_Face {
+    int32_t rc;
+    dev_t dev;  // file identity of mapped faces, they are looked up by this rather than by filename
+    ino_t ino;
+    uint64_t offset;  // of data within the file
+    const uint8_t *data;
+    size_t data_size;
+    void *map_base;  // mapping which holds data, NULL if data belongs to the caller
+    size_t map_size;
+    GB_FontReleaseFunc release_func;  // called when a caller's data is no longer used, may be NULL
+    void *release_user_data;
+    FT_Face ft_face;  // only one FT_Size is active at a time, see GB_FontActivateSize
+    hb_face_t *hb_face;
+    struct GB_FaceCoverage *coverage;  // NULL until GB_FaceCovers is first called
+    struct GB_Face *prev;
+    struct GB_Face *next;
+};
+
+// returns the face of the font file at filename, mapping & opening it if no font uses it yet.
+// an existing face is retained, a new one starts with a reference count of 1.
+GB_ERROR GB_FaceMake(struct GB_Context *gb, const char *filename, struct GB_Face **face_out);
+
+// same as GB_FaceMake, for size bytes of an open file starting at offset. size 0 runs to the end of the file.
+// fd is not kept, the caller may close it.
+GB_ERROR GB_FaceMakeFromMapped(struct GB_Context *gb, int fd, uint64_t offset, size_t size, struct GB_Face **face_out);
+
+// face of font data owned by the caller, see GB_FontMakeFromMemory.
+// faces are shared by calls with the same data, size, release_func & user_data.
+GB_ERROR GB_FaceMakeFromMemory(struct GB_Context *gb, const uint8_t *data, size_t size,
+                               GB_FontReleaseFunc release_func, void *user_data, struct GB_Face **face_out);
+
+// returns 1 if the face has a glyph for the unicode codepoint cp.
+// The coverage index is built from the cmap on the first call, after that no FreeType call is made.
+int GB_FaceCovers(struct GB_Face *face, uint32_t cp);
+
+// reference count, the data is unmapped or given back to the caller when the last font is destroyed.
+void GB_FaceRelease(struct GB_Context *gb, struct GB_Face *face);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // GB_FACE_H
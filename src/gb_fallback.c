@@ -0,0 +1,200 @@
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "gb_context.h"
+#include "gb_font.h"
+#include "gb_face.h"
+#include "gb_fallback.h"
+
+GB_ERROR GB_FontFallbackChainMake(struct GB_Context *gb, struct GB_Font **fonts, uint32_t num_fonts,
+                                  struct GB_FontFallbackChain **chain_out)
+{
+    if (gb && fonts && num_fonts > 0 && num_fonts <= GB_FONT_FALLBACK_MAX_FONTS && chain_out) {
+        uint32_t i;
+        for (i = 0; i < num_fonts; i++) {
+            if (!fonts[i])
+                return GB_ERROR_INVAL;
+        }
+
+        struct GB_FontFallbackChain *chain = (struct GB_FontFallbackChain*)malloc(sizeof(struct GB_FontFallbackChain));
+        if (chain) {
+            memset(chain, 0, sizeof(struct GB_FontFallbackChain));
+            chain->rc = 1;
+            for (i = 0; i < num_fonts; i++) {
+                chain->font[i] = fonts[i];
+                GB_FontRetain(gb, fonts[i]);
+            }
+            chain->num_fonts = num_fonts;
+            *chain_out = chain;
+            return GB_ERROR_NONE;
+        } else {
+            return GB_ERROR_NOMEM;
+        }
+    } else {
+        return GB_ERROR_INVAL;
+    }
+}
+
+GB_ERROR GB_FontFallbackChainRetain(struct GB_Context *gb, struct GB_FontFallbackChain *chain)
+{
+    if (gb && chain) {
+        assert(chain->rc > 0);
+        chain->rc++;
+        return GB_ERROR_NONE;
+    } else {
+        return GB_ERROR_INVAL;
+    }
+}
+
+GB_ERROR GB_FontFallbackChainRelease(struct GB_Context *gb, struct GB_FontFallbackChain *chain)
+{
+    if (gb && chain) {
+        chain->rc--;
+        assert(chain->rc >= 0);
+        if (chain->rc == 0) {
+            uint32_t i;
+            for (i = 0; i < chain->num_fonts; i++)
+                GB_FontRelease(gb, chain->font[i]);
+            free(chain);
+        }
+        return GB_ERROR_NONE;
+    } else {
+        return GB_ERROR_INVAL;
+    }
+}
+
+// returns the number of bytes to advance, fills cp_out with the code point at p.
+// invalid bytes are returned as U+FFFD one at a time.
+static uint32_t _GB_Utf8Next(const uint8_t *p, const uint8_t *end, uint32_t *cp_out)
+{
+    uint32_t length, cp;
+    if (p[0] < 0x80) {
+        *cp_out = p[0];
+        return 1;
+    } else if ((p[0] & 0xe0) == 0xc0) {
+        length = 2;
+        cp = p[0] & 0x1f;
+    } else if ((p[0] & 0xf0) == 0xe0) {
+        length = 3;
+        cp = p[0] & 0x0f;
+    } else if ((p[0] & 0xf8) == 0xf0) {
+        length = 4;
+        cp = p[0] & 0x07;
+    } else {
+        *cp_out = 0xfffd;
+        return 1;
+    }
+
+    uint32_t i;
+    if ((uint32_t)(end - p) < length) {
+        *cp_out = 0xfffd;
+        return 1;
+    }
+    for (i = 1; i < length; i++) {
+        if ((p[i] & 0xc0) != 0x80) {
+            *cp_out = 0xfffd;
+            return 1;
+        }
+        cp = (cp << 6) | (p[i] & 0x3f);
+    }
+    *cp_out = cp;
+    return length;
+}
+
+int GB_IsClusterContinuation(uint32_t cp)
+{
+    return (cp >= 0x0300 && cp <= 0x036f) ||  // combining diacritical marks
+           (cp >= 0x1ab0 && cp <= 0x1aff) ||  // combining diacritical marks extended
+           (cp >= 0x20d0 && cp <= 0x20ff) ||  // combining diacritical marks for symbols
+           (cp >= 0xfe20 && cp <= 0xfe2f) ||  // combining half marks
+           (cp >= 0xfe00 && cp <= 0xfe0f) ||  // variation selectors
+           (cp >= 0xe0100 && cp <= 0xe01ef) ||  // variation selectors supplement
+           (cp >= 0x1f3fb && cp <= 0x1f3ff) ||  // emoji skin tone modifiers
+           cp == 0x200c || cp == 0x200d;  // zero width non joiner & joiner
+}
+
+// codepoints shared by every script: whitespace, ascii & general punctuation, digits & symbols.
+// sorted, first & last are inclusive.
+static const struct {
+    uint32_t first;
+    uint32_t last;
+} s_common_ranges[] = {
+    {0x0000, 0x0040},  // controls, space, digits & ascii punctuation
+    {0x005b, 0x0060},  // [ \ ] ^ _ `
+    {0x007b, 0x00a9},  // { | } ~, latin-1 controls, no-break space & punctuation
+    {0x00ab, 0x00b4},  // « ... ´, skips the feminine ordinal indicator
+    {0x00b6, 0x00b9},  // pilcrow ... superscript one, skips the micro sign
+    {0x00bb, 0x00bf},  // » ... ¿, skips the masculine ordinal indicator
+    {0x00d7, 0x00d7},  // multiplication sign
+    {0x00f7, 0x00f7},  // division sign
+    {0x2000, 0x206f},  // general punctuation, incl. spaces
+    {0x3000, 0x3000},  // ideographic space
+};
+
+// returns 1 for codepoints which any font of a run may draw.
+static int _GB_IsCommon(uint32_t cp)
+{
+    uint32_t i;
+    for (i = 0; i < sizeof(s_common_ranges) / sizeof(s_common_ranges[0]) && s_common_ranges[i].first <= cp; i++) {
+        if (cp <= s_common_ranges[i].last)
+            return 1;
+    }
+    return 0;
+}
+
+GB_ERROR GB_FontFallbackChainItemize(struct GB_Context *gb, struct GB_FontFallbackChain *chain,
+                                     const uint8_t *utf8_string, uint32_t utf8_string_len,
+                                     struct GB_FontRun *runs, uint32_t max_runs, uint32_t *num_runs_out)
+{
+    if (!gb || !chain || !utf8_string || (!runs && max_runs > 0) || !num_runs_out)
+        return GB_ERROR_INVAL;
+
+    const uint8_t *end = utf8_string + utf8_string_len;
+    uint32_t num_runs = 0;
+    uint32_t run_offset = 0, run_font = 0;
+    uint32_t offset = 0;
+    while (offset < utf8_string_len) {
+        uint32_t cp;
+        uint32_t length = _GB_Utf8Next(utf8_string + offset, end, &cp);
+
+        // spaces, punctuation & digits stay in the current run if its font covers them, so they do not
+        // split a run. every other codepoint takes the first font which covers it.
+        uint32_t font_index = run_font;
+        if (!GB_IsClusterContinuation(cp) &&
+            !(offset > 0 && _GB_IsCommon(cp) && GB_FaceCovers(chain->font[run_font]->face, cp))) {
+            uint32_t i;
+            for (i = 0; i < chain->num_fonts; i++) {
+                if (GB_FaceCovers(chain->font[i]->face, cp)) {
+                    font_index = i;
+                    break;
+                }
+            }
+        }
+
+        if (offset == 0) {
+            run_font = font_index;
+        } else if (font_index != run_font) {
+            if (num_runs < max_runs) {
+                runs[num_runs].offset = run_offset;
+                runs[num_runs].length = offset - run_offset;
+                runs[num_runs].font_index = run_font;
+            }
+            num_runs++;
+            run_offset = offset;
+            run_font = font_index;
+        }
+        offset += length;
+    }
+
+    if (utf8_string_len > 0) {
+        if (num_runs < max_runs) {
+            runs[num_runs].offset = run_offset;
+            runs[num_runs].length = utf8_string_len - run_offset;
+            runs[num_runs].font_index = run_font;
+        }
+        num_runs++;
+    }
+
+    *num_runs_out = num_runs;
+    return GB_ERROR_NONE;
+}
@@ -0,0 +1,62 @@
+#ifndef GB_FALLBACK_H
+#define GB_FALLBACK_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include "gb_error.h"
+
+struct GB_Context;
+struct GB_Font;
+
+// upper limit on the number of fonts in a fallback chain
+#define GB_FONT_FALLBACK_MAX_FONTS 16
+
+// an ordered list of fonts, each codepoint of a text is drawn with the first font which has a glyph for it.
+// e.g. a latin font, followed by a CJK font, followed by an emoji font.
+// see GB_TextMakeWithFallback
+// reference counted, retains its fonts.
+struct GB_FontFallbackChain {
+    int32_t rc;
+    struct GB_Font *font[GB_FONT_FALLBACK_MAX_FONTS];
+    uint32_t num_fonts;
+};
+
+// a run of a utf8 string which is drawn with a single font of a fallback chain.
+struct GB_FontRun {
+    uint32_t offset;  // in bytes, from the start of the string
+    uint32_t length;  // in bytes
+    uint32_t font_index;  // index into the chain's fonts
+};
+
+// fonts - num_fonts fonts, in order of preference. the first font also provides the line height.
+// reference count starts at 1, must release chain objects to destroy them.
+GB_ERROR GB_FontFallbackChainMake(struct GB_Context *gb, struct GB_Font **fonts, uint32_t num_fonts,
+                                  struct GB_FontFallbackChain **chain_out);
+
+// reference count
+GB_ERROR GB_FontFallbackChainRetain(struct GB_Context *gb, struct GB_FontFallbackChain *chain);
+GB_ERROR GB_FontFallbackChainRelease(struct GB_Context *gb, struct GB_FontFallbackChain *chain);
+
+// split utf8_string into runs, each using the first font of chain which covers its codepoints.
+// Codepoints which no font covers, combining marks & joiners stay in the current run, so do spaces,
+// punctuation & digits which the current run's font covers.
+// At most max_runs runs are written to runs, num_runs_out is set to the total number of runs.
+// runs may be NULL if max_runs is 0, to count them.
+GB_ERROR GB_FontFallbackChainItemize(struct GB_Context *gb, struct GB_FontFallbackChain *chain,
+                                     const uint8_t *utf8_string, uint32_t utf8_string_len,
+                                     struct GB_FontRun *runs, uint32_t max_runs, uint32_t *num_runs_out);
+
+// private
+
+// returns 1 for codepoints which belong with the one before them, e.g. combining marks & joiners.
+// splitting a run before one would break up a cluster.
+int GB_IsClusterContinuation(uint32_t cp);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // GB_FALLBACK_H
@@ -1,56 +1,145 @@
+#include <pthread.h>
+#include <ft2build.h>
+#include FT_SIZES_H
 #include <harfbuzz/hb.h>
-#include <harfbuzz/hb-ft.h>
+#include <harfbuzz/hb-ot.h>
 #include "utlist.h"
-#include "uthash.h"
 #include "gb_context.h"
+#include "gb_face.h"
 #include "gb_glyph.h"
 #include "gb_cache.h"
 #include "gb_font.h"
+#include "gb_worker.h"
+#include "gb_shape_cache.h"
 
-GB_ERROR GB_FontMake(struct GB_Context *gb, const char *filename, uint32_t point_size, 
-                     enum GB_FontRenderOptions render_options, enum GB_FontHintOptions hint_options,
-                     struct GB_Font **font_out)
+// harfbuzz asks the font for advances, so shaped text is laid out with the same hinted advances
+// as text which is not shaped. font_data is the GB_Font.
+static hb_position_t _GB_FontGetGlyphHAdvance(hb_font_t *hb_font, void *font_data, hb_codepoint_t glyph, void *user_data)
 {
-    if (gb && filename && font_out) {
+    struct GB_Font *font = (struct GB_Font*)font_data;
+    int32_t advance = 0;
+    GB_GlyphGetAdvance(font->gb, glyph, font, &advance);
+    return advance;
+}
 
-        // create freetype face
-        FT_Face face = NULL;
-        FT_New_Face(gb->ft_library, filename, 0, &face);
-        if (face) {
-            struct GB_Font *font = (struct GB_Font*)malloc(sizeof(struct GB_Font));
-            if (font) {
-                memset(font, 0, sizeof(struct GB_Font));
+// shared by every font, never destroyed.
+static hb_font_funcs_t *s_hb_font_funcs = NULL;
+static pthread_once_t s_hb_font_funcs_once = PTHREAD_ONCE_INIT;
 
-                font->rc = 1;
-                font->index = gb->next_font_index++;
-                font->ft_face = face;
+static void _GB_FontMakeFuncs(void)
+{
+    s_hb_font_funcs = hb_font_funcs_create();
+    hb_font_funcs_set_glyph_h_advance_func(s_hb_font_funcs, _GB_FontGetGlyphHAdvance, NULL, NULL);
+    hb_font_funcs_make_immutable(s_hb_font_funcs);
+}
 
-                FT_Set_Char_Size(font->ft_face, (int)(point_size * 64), 0, 72, 72);
+// makes a size instance of face, takes ownership of the face reference.
+static GB_ERROR _GB_FontMakeFromFace(struct GB_Context *gb, struct GB_Face *face, uint32_t point_size,
+                                     enum GB_FontRenderOptions render_options, enum GB_FontHintOptions hint_options,
+                                     struct GB_Font **font_out)
+{
+    struct GB_Font *font = (struct GB_Font*)malloc(sizeof(struct GB_Font));
+    if (font) {
+        memset(font, 0, sizeof(struct GB_Font));
 
-                // create harfbuzz font
-                font->hb_font = hb_ft_font_create(font->ft_face, 0);
-                hb_ft_font_set_funcs(font->hb_font);
+        font->rc = 1;
+        font->gb = gb;
+        font->index = gb->next_font_index++;
+        font->face = face;
+        font->ft_face = face->ft_face;
+        font->point_size = point_size;
 
-                // context holds a list of all fonts
-                DL_PREPEND(gb->font_list, font);
+        // each font has its own size of the shared freetype face
+        if (FT_New_Size(font->ft_face, &font->ft_size)) {
+            GB_FaceRelease(gb, face);
+            free(font);
+            return GB_ERROR_FTERR;
+        }
+        FT_Activate_Size(font->ft_size);
+        FT_Set_Char_Size(font->ft_face, (int)(point_size * 64), 0, 72, 72);
 
-                font->render_options = render_options;
-                font->hint_options = hint_options;
+        // create harfbuzz font, scaled to 26.6 pixels like the freetype metrics.
+        // glyph lookup & positioning come from the OpenType tables of the parent,
+        // horizontal advances from the font's hinted advance table, see GB_GlyphGetAdvance.
+        hb_font_t *ot_font = hb_font_create(face->hb_face);
+        hb_ot_font_set_funcs(ot_font);
+        hb_font_set_scale(ot_font, (int)(point_size * 64), (int)(point_size * 64));
+        hb_font_set_ppem(ot_font, point_size, point_size);
+        pthread_once(&s_hb_font_funcs_once, _GB_FontMakeFuncs);
+        font->hb_font = hb_font_create_sub_font(ot_font);
+        hb_font_set_funcs(font->hb_font, s_hb_font_funcs, font, NULL);
+        hb_font_destroy(ot_font);
 
-                *font_out = font;
-                return GB_ERROR_NONE;
-            } else {
-                return GB_ERROR_NOMEM;
-            }
+        // context holds a list of all fonts
+        DL_PREPEND(gb->font_list, font);
+
+        font->render_options = render_options;
+        font->hint_options = hint_options;
+
+        *font_out = font;
+        return GB_ERROR_NONE;
+    } else {
+        GB_FaceRelease(gb, face);
+        return GB_ERROR_NOMEM;
+    }
+}
+
+GB_ERROR GB_FontMake(struct GB_Context *gb, const char *filename, uint32_t point_size, 
+                     enum GB_FontRenderOptions render_options, enum GB_FontHintOptions hint_options,
+                     struct GB_Font **font_out)
+{
+    if (gb && filename && font_out) {
+
+        // find or load the font file
+        struct GB_Face *face = NULL;
+        GB_ERROR error = GB_FaceMake(gb, filename, &face);
+        if (error == GB_ERROR_NONE) {
+            return _GB_FontMakeFromFace(gb, face, point_size, render_options, hint_options, font_out);
         } else {
             fprintf(stderr, "Error loading font \"%s\"\n", filename);
-            return GB_ERROR_NOENT;
+            return error;
         }
     } else {
         return GB_ERROR_INVAL;
     }
 }
 
+GB_ERROR GB_FontMakeFromMapped(struct GB_Context *gb, int fd, uint64_t offset, size_t size, uint32_t point_size,
+                               enum GB_FontRenderOptions render_options, enum GB_FontHintOptions hint_options,
+                               struct GB_Font **font_out)
+{
+    if (gb && font_out) {
+        struct GB_Face *face = NULL;
+        GB_ERROR error = GB_FaceMakeFromMapped(gb, fd, offset, size, &face);
+        if (error == GB_ERROR_NONE)
+            return _GB_FontMakeFromFace(gb, face, point_size, render_options, hint_options, font_out);
+        else
+            return error;
+    } else {
+        return GB_ERROR_INVAL;
+    }
+}
+
+GB_ERROR GB_FontMakeFromMemory(struct GB_Context *gb, const uint8_t *data, size_t size,
+                               GB_FontReleaseFunc release_func, void *user_data, uint32_t point_size,
+                               enum GB_FontRenderOptions render_options, enum GB_FontHintOptions hint_options,
+                               struct GB_Font **font_out)
+{
+    if (gb && font_out) {
+        // on failure the face has already called release_func
+        struct GB_Face *face = NULL;
+        GB_ERROR error = GB_FaceMakeFromMemory(gb, data, size, release_func, user_data, &face);
+        if (error == GB_ERROR_NONE)
+            return _GB_FontMakeFromFace(gb, face, point_size, render_options, hint_options, font_out);
+        else
+            return error;
+    } else {
+        if (release_func)
+            release_func(user_data);
+        return GB_ERROR_INVAL;
+    }
+}
+
 GB_ERROR GB_FontRetain(struct GB_Context *gb, struct GB_Font *font)
 {
     if (gb && font) {
@@ -67,16 +156,42 @@ static void _GB_FontDestroy(struct GB_Context *gb, struct GB_Font *font)
     assert(font);
     assert(font->rc == 0);
 
-    // destroy freetype face
-    if (font->ft_face) {
-        FT_Done_Face(font->ft_face);
+    // cached glyphs may outlive the font, they must no longer point into its glyph pages.
+    uint32_t i, j;
+    for (i = 0; i < font->num_glyph_pages; i++) {
+        if (font->glyph_page[i]) {
+            for (j = 0; j < GB_FONT_GLYPH_PAGE_SIZE; j++) {
+                if (font->glyph_page[i][j])
+                    font->glyph_page[i][j]->font_slot = NULL;
+            }
+            free(font->glyph_page[i]);
+        }
     }
+    free(font->glyph_page);
+    for (i = 0; i < font->num_advance_pages; i++)
+        free(font->advance_page[i]);
+    free(font->advance_page);
+    free(font->kerning);
+
+    // worker threads hold their own faces of this font
+    if (gb->worker_pool)
+        GB_WorkerPoolForgetFont(gb->worker_pool, font);
+
+    // font indices are never reused, but its shaped words would never be found again.
+    if (gb->shape_cache)
+        GB_ShapeCacheRemoveFont(gb->shape_cache, font->index);
 
     // destroy harfbuzz font
     if (font->hb_font) {
         hb_font_destroy(font->hb_font);
     }
 
+    // destroy freetype size, the face goes once no other size of it remains.
+    if (font->ft_size) {
+        FT_Done_Size(font->ft_size);
+    }
+    GB_FaceRelease(gb, font->face);
+
     // context holds a list of all fonts
     DL_DELETE(gb->font_list, font);
 
@@ -103,8 +218,8 @@ GB_ERROR GB_FontRelease(struct GB_Context *gb, struct GB_Font *font)
 GB_ERROR GB_FontGetMaxAdvance(struct GB_Context *gb, struct GB_Font *font, uint32_t *max_advance_out)
 {
     if (gb && font && max_advance_out) {
-        if (font->ft_face && font->ft_face->size) {
-            *max_advance_out = FIXED_TO_INT(font->ft_face->size->metrics.max_advance);
+        if (font->ft_size) {
+            *max_advance_out = FIXED_TO_INT(font->ft_size->metrics.max_advance);
             return GB_ERROR_NONE;
         } else {
             return GB_ERROR_INVAL;
@@ -117,8 +232,8 @@ GB_ERROR GB_FontGetMaxAdvance(struct GB_Context *gb, struct GB_Font *font, uint3
 GB_ERROR GB_FontGetLineHeight(struct GB_Context *gb, struct GB_Font *font, uint32_t *line_height_out)
 {
     if (gb && font && line_height_out) {
-        if (font->ft_face && font->ft_face->size) {
-            *line_height_out = FIXED_TO_INT(font->ft_face->size->metrics.height);
+        if (font->ft_size) {
+            *line_height_out = FIXED_TO_INT(font->ft_size->metrics.height);
             return GB_ERROR_NONE;
         } else {
             return GB_ERROR_INVAL;
@@ -127,3 +242,135 @@ GB_ERROR GB_FontGetLineHeight(struct GB_Context *gb, struct GB_Font *font, uint3
         return GB_ERROR_INVAL;
     }
 }
+
+void GB_FontActivateSize(struct GB_Font *font)
+{
+    if (font->ft_face->size != font->ft_size)
+        FT_Activate_Size(font->ft_size);
+}
+
+static uint32_t _GB_KerningHash(uint32_t left, uint32_t right)
+{
+    return (left * 0x9e3779b1u) ^ (right * 0x85ebca77u);
+}
+
+static struct GB_KerningPair *_GB_FontFindKerningSlot(struct GB_KerningPair *kerning, uint32_t capacity,
+                                                      uint32_t left, uint32_t right)
+{
+    uint32_t mask = capacity - 1;
+    uint32_t i = _GB_KerningHash(left, right) & mask;
+    while (kerning[i].left && (kerning[i].left != left || kerning[i].right != right))
+        i = (i + 1) & mask;
+    return kerning + i;
+}
+
+// keep the table at most half full, returns 0 if it can not grow.
+static int _GB_FontGrowKerning(struct GB_Font *font)
+{
+    if (font->num_kerning_pairs >= GB_FONT_MAX_KERNING_PAIRS)
+        return 0;
+    if (font->kerning && (font->num_kerning_pairs + 1) * 2 <= font->kerning_capacity)
+        return 1;
+
+    uint32_t capacity = font->kerning_capacity ? font->kerning_capacity * 2 : 256;
+    struct GB_KerningPair *kerning = (struct GB_KerningPair*)calloc(capacity, sizeof(struct GB_KerningPair));
+    if (!kerning)
+        return 0;
+    uint32_t i;
+    for (i = 0; i < font->kerning_capacity; i++) {
+        if (font->kerning[i].left)
+            *_GB_FontFindKerningSlot(kerning, capacity, font->kerning[i].left, font->kerning[i].right) = font->kerning[i];
+    }
+    free(font->kerning);
+    font->kerning = kerning;
+    font->kerning_capacity = capacity;
+    return 1;
+}
+
+int32_t GB_FontGetKerning(struct GB_Font *font, uint32_t left, uint32_t right)
+{
+    // the notdef glyph is never kerned
+    if (!FT_HAS_KERNING(font->ft_face) || left == 0 || right == 0)
+        return 0;
+
+    if (font->kerning) {
+        struct GB_KerningPair *pair = _GB_FontFindKerningSlot(font->kerning, font->kerning_capacity, left, right);
+        if (pair->left)
+            return pair->kern;
+    }
+
+    // kerning is scaled by the active size of the font's face
+    FT_Vector delta;
+    GB_FontActivateSize(font);
+    if (FT_Get_Kerning(font->ft_face, left, right, FT_KERNING_DEFAULT, &delta))
+        delta.x = 0;
+
+    if (_GB_FontGrowKerning(font)) {
+        struct GB_KerningPair *pair = _GB_FontFindKerningSlot(font->kerning, font->kerning_capacity, left, right);
+        pair->left = left;
+        pair->right = right;
+        pair->kern = (int32_t)delta.x;
+        font->num_kerning_pairs++;
+    }
+    return (int32_t)delta.x;
+}
+
+struct GB_Glyph *GB_FontFindGlyph(struct GB_Context *gb, struct GB_Font *font, uint32_t glyph_index)
+{
+    uint32_t page = glyph_index >> GB_FONT_GLYPH_PAGE_SHIFT;
+    if (page < font->num_glyph_pages && font->glyph_page[page])
+        return font->glyph_page[page][glyph_index & (GB_FONT_GLYPH_PAGE_SIZE - 1)];
+    else
+        return GB_CacheHashFind(gb->cache, glyph_index, font->index);
+}
+
+static void _GB_FontSetGlyphSlot(struct GB_Font *font, uint32_t page, struct GB_Glyph *glyph)
+{
+    struct GB_Glyph **slot = &font->glyph_page[page][glyph->index & (GB_FONT_GLYPH_PAGE_SIZE - 1)];
+    *slot = glyph;
+    glyph->font_slot = slot;
+}
+
+void GB_FontAddGlyph(struct GB_Context *gb, struct GB_Font *font, struct GB_Glyph *glyph)
+{
+    assert(glyph->font_index == font->index);
+    uint32_t page = glyph->index >> GB_FONT_GLYPH_PAGE_SHIFT;
+    if (page >= GB_FONT_MAX_GLYPH_PAGES)
+        return;
+
+    // grow the page table, new pages are NULL
+    if (page >= font->num_glyph_pages) {
+        uint32_t num_pages = page + 1;
+        struct GB_Glyph ***glyph_page = (struct GB_Glyph***)realloc(font->glyph_page, sizeof(struct GB_Glyph**) * num_pages);
+        if (!glyph_page)
+            return;
+        memset(glyph_page + font->num_glyph_pages, 0, sizeof(struct GB_Glyph**) * (num_pages - font->num_glyph_pages));
+        font->glyph_page = glyph_page;
+        font->num_glyph_pages = num_pages;
+    }
+
+    if (!font->glyph_page[page]) {
+        font->glyph_page[page] = (struct GB_Glyph**)calloc(GB_FONT_GLYPH_PAGE_SIZE, sizeof(struct GB_Glyph*));
+        if (!font->glyph_page[page])
+            return;
+
+        // a new page must hold every cached glyph in its range, some may have been cached
+        // while an earlier allocation of this page failed.
+        uint32_t i, first_index = page << GB_FONT_GLYPH_PAGE_SHIFT;
+        for (i = 0; i < GB_FONT_GLYPH_PAGE_SIZE; i++) {
+            struct GB_Glyph *cached = GB_CacheHashFind(gb->cache, first_index + i, font->index);
+            if (cached)
+                _GB_FontSetGlyphSlot(font, page, cached);
+        }
+    }
+
+    _GB_FontSetGlyphSlot(font, page, glyph);
+}
+
+void GB_FontRemoveGlyph(struct GB_Glyph *glyph)
+{
+    if (glyph->font_slot) {
+        *glyph->font_slot = NULL;
+        glyph->font_slot = NULL;
+    }
+}
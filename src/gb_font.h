@@ -6,12 +6,25 @@ extern "C" {
 #endif
 
 #include <stdint.h>
+#include <stddef.h>
 #include <ft2build.h>
 #include FT_FREETYPE_H
 #include <harfbuzz/hb.h>
 #include "gb_error.h"
 
 struct GB_Context;
+struct GB_Glyph;
+struct GB_Face;
+
+// glyph indices below GB_FONT_MAX_GLYPH_PAGES * GB_FONT_GLYPH_PAGE_SIZE are found with a direct lookup,
+// pages are allocated the first time one of their glyphs is cached.
+#define GB_FONT_GLYPH_PAGE_SHIFT 8
+#define GB_FONT_GLYPH_PAGE_SIZE (1 << GB_FONT_GLYPH_PAGE_SHIFT)
+#define GB_FONT_MAX_GLYPH_PAGES 256
+
+// glyph advances are looked up in bulk, a page at a time, see GB_GlyphGetAdvance.
+#define GB_FONT_ADVANCE_PAGE_SHIFT 6
+#define GB_FONT_ADVANCE_PAGE_SIZE (1 << GB_FONT_ADVANCE_PAGE_SHIFT)
 
 // argument to GB_FontMake
 enum GB_FontRenderOptions {
@@ -32,21 +45,46 @@ enum GB_FontHintOptions {
     GB_HINT_NONE  // use no hinting algorithm at all.
 };
 
-// font object
+// the kerning cache stops growing at this many pairs, further pairs are looked up every time.
+#define GB_FONT_MAX_KERNING_PAIRS 4096
+
+// a kerning pair looked up by GB_FontGetKerning. kern is in 26.6 fixed point pixels.
+struct GB_KerningPair {
+    uint32_t left;  // glyph indices, 0 marks an empty slot
+    uint32_t right;
+    int32_t kern;
+};
+
+// called once font data passed to GB_FontMakeFromMemory is no longer used.
+typedef void (*GB_FontReleaseFunc)(void *user_data);
+
+// font object, one size of a font file.
+// every font made from the same file shares a single GB_Face.
 // reference counted
 struct GB_Font {
     int32_t rc;
     uint32_t index;
-    FT_Face ft_face;
-    hb_font_t *hb_font;
+    struct GB_Context *gb;  // owner, used by the harfbuzz advance callback
+    struct GB_Face *face;
+    FT_Face ft_face;  // face->ft_face, call GB_FontActivateSize before using anything which depends on the size.
+    FT_Size ft_size;  // this font's size of ft_face
+    hb_font_t *hb_font;  // scaled instance of face->hb_face, with hinted advances
     struct GB_Font *prev;
     struct GB_Font *next;
     enum GB_FontRenderOptions render_options;
     enum GB_FontHintOptions hint_options;
     uint32_t flags;
+    uint32_t point_size;
+    struct GB_Glyph ***glyph_page;  // cached glyphs by glyph index, does not retain. NULL pages have no cached glyphs.
+    uint32_t num_glyph_pages;
+    int32_t **advance_page;  // 26.6 advance of every glyph in the font, by glyph index. NULL pages are not loaded yet.
+    uint32_t num_advance_pages;  // enough pages for ft_face->num_glyphs, allocated with the first page.
+    struct GB_KerningPair *kerning;  // open addressing hash of kerning pairs, only used for texts which are not shaped.
+    uint32_t kerning_capacity;  // power of two
+    uint32_t num_kerning_pairs;
 };
 
-// filename - ttf or otf font
+// filename - ttf or otf font, the file is only loaded once however many sizes are made from it.
 // point_size - pixels per em
 // render_options - controls how anti-aliasing is preformed during glyph rendering.
 // hint_pitons - controls which hinting algorithm is chosen during glyph rendering.
@@ -55,6 +93,22 @@ GB_ERROR GB_FontMake(struct GB_Context *gb, const char *filename, uint32_t point
                      enum GB_FontRenderOptions render_options, enum GB_FontHintOptions hint_options,
                      struct GB_Font **font_out);
 
+// same as GB_FontMake, for a font stored in size bytes of an open file starting at offset, e.g. in an asset archive.
+// size 0 runs to the end of the file. The font is mapped read only, so its pages are shared with other processes
+// which map the same file. fd is not kept, the caller may close it once this returns.
+GB_ERROR GB_FontMakeFromMapped(struct GB_Context *gb, int fd, uint64_t offset, size_t size, uint32_t point_size,
+                               enum GB_FontRenderOptions render_options, enum GB_FontHintOptions hint_options,
+                               struct GB_Font **font_out);
+
+// same as GB_FontMake, for a font already in memory. data is used in place, it must stay valid & unchanged
+// until release_func is called. Fonts made from the same data, release_func & user_data share it,
+// release_func is called once after the last of them is destroyed. If this fails release_func is called before returning.
+// release_func may be NULL if the caller frees data itself, after destroying every font made from it.
+GB_ERROR GB_FontMakeFromMemory(struct GB_Context *gb, const uint8_t *data, size_t size,
+                               GB_FontReleaseFunc release_func, void *user_data, uint32_t point_size,
+                               enum GB_FontRenderOptions render_options, enum GB_FontHintOptions hint_options,
+                               struct GB_Font **font_out);
+
 // reference count
 GB_ERROR GB_FontRetain(struct GB_Context *gb, struct GB_Font *font);
 GB_ERROR GB_FontRelease(struct GB_Context *gb, struct GB_Font *font);
@@ -65,6 +119,26 @@ GB_ERROR GB_FontGetMaxAdvance(struct GB_Context *gb, struct GB_Font *font, uint3
 // fills line_height_out with line height in pixels
 GB_ERROR GB_FontGetLineHeight(struct GB_Context *gb, struct GB_Font *font, uint32_t *line_height_out);
 
+// private
+
+// make font->ft_size the active size of the shared ft_face.
+void GB_FontActivateSize(struct GB_Font *font);
+
+// kerning between two glyphs in 26.6 fixed point pixels, from the font's kern table.
+// pairs are cached, so each one costs a single FT_Get_Kerning call. Shaped texts get kerning from HarfBuzz instead.
+int32_t GB_FontGetKerning(struct GB_Font *font, uint32_t left, uint32_t right);
+
+// look up a cached glyph of this font, glyphs beyond the font glyph pages are found in the cache hash.
+// returns NULL if glyph is not in the cache.
+struct GB_Glyph *GB_FontFindGlyph(struct GB_Context *gb, struct GB_Font *font, uint32_t glyph_index);
+
+// record a glyph which was just added to the cache hash, so GB_FontFindGlyph can find it without hashing.
+// if memory runs out the glyph is left to the cache hash.
+void GB_FontAddGlyph(struct GB_Context *gb, struct GB_Font *font, struct GB_Glyph *glyph);
+
+// forget a glyph which is being removed from the cache.
+void GB_FontRemoveGlyph(struct GB_Glyph *glyph);
+
 #ifdef __cplusplus
 }
 #endif
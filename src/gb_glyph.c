@@ -1,16 +1,24 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <assert.h>
+#include <string.h>
+#include <ft2build.h>
+#include FT_ADVANCES_H
+#include FT_OUTLINE_H
 #include "gb_font.h"
 #include "gb_glyph.h"
+#include "gb_image.h"
+#include "gb_alloc.h"
 
 // 26.6 fixed to int (truncates)
 #define FIXED_TO_INT(n) (uint32_t)(n >> 6)
 
-static void _InitGlyphImage(FT_Bitmap *ft_bitmap, enum GB_TextureFormat texture_format,
+static void _InitGlyphImage(struct GB_Allocator *allocator, FT_Bitmap *ft_bitmap, enum GB_TextureFormat texture_format,
                             enum GB_FontRenderOptions render_options, uint8_t **image_out, uint32_t size_out[2])
 {
+    const struct GB_ImageKernels *kernels = GB_ImageKernelsGet();
     uint8_t *image = NULL;
-    int i, j;
+    int i;
     if (ft_bitmap->width > 0 && ft_bitmap->rows > 0) {
 
         // Most of these glyph textures should be rendered using non-premultiplied alpha
@@ -27,7 +35,7 @@ static void _InitGlyphImage(FT_Bitmap *ft_bitmap, enum GB_TextureFormat texture_
         case GB_RENDER_LIGHT:
             if (texture_format == GB_TEXTURE_FORMAT_ALPHA) {
                 // allocate an image to hold a copy of the rasterized glyph
-                image = (uint8_t*)malloc(ft_bitmap->width * ft_bitmap->rows);
+                image = GB_AllocatorAllocImage(allocator, ft_bitmap->width * ft_bitmap->rows);
 
                 // copy image from ft_bitmap.buffer into image, row by row.
                 // The pitch of each row in the ft_bitmap maybe >= width,
@@ -37,7 +45,7 @@ static void _InitGlyphImage(FT_Bitmap *ft_bitmap, enum GB_TextureFormat texture_
                 }
             } else {
                 // allocate an image to hold a copy of the rasterized glyph
-                image = (uint8_t*)malloc(4 * ft_bitmap->width * ft_bitmap->rows);
+                image = GB_AllocatorAllocImage(allocator, 4 * ft_bitmap->width * ft_bitmap->rows);
 
                 // copy image from ft_bitmap.buffer into image, row by row.
                 // The pitch of each row in the ft_bitmap maybe >= width,
@@ -45,13 +53,8 @@ static void _InitGlyphImage(FT_Bitmap *ft_bitmap, enum GB_TextureFormat texture_
                 // NOTE: This glyph texture should be rendered using non-premultiplied alpha
                 // i.e. glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
                 for (i = 0; i < ft_bitmap->rows; i++) {
-                    for (j = 0; j < ft_bitmap->width; j++) {
-                        // white with alpha, i.e. non-premultiplied alpha.
-                        image[i * ft_bitmap->width * 4 + (j * 4) + 0] = 0xff;
-                        image[i * ft_bitmap->width * 4 + (j * 4) + 1] = 0xff;
-                        image[i * ft_bitmap->width * 4 + (j * 4) + 2] = 0xff;
-                        image[i * ft_bitmap->width * 4 + (j * 4) + 3] = ft_bitmap->buffer[i * ft_bitmap->pitch + j];
-                    }
+                    // white with alpha, i.e. non-premultiplied alpha.
+                    kernels->alpha_to_rgba(image + i * ft_bitmap->width * 4, ft_bitmap->buffer + i * ft_bitmap->pitch, ft_bitmap->width);
                 }
             }
             size_out[0] = ft_bitmap->width;
@@ -62,32 +65,19 @@ static void _InitGlyphImage(FT_Bitmap *ft_bitmap, enum GB_TextureFormat texture_
             // ft_bitmap is 1 bit per pixel.
             if (texture_format == GB_TEXTURE_FORMAT_ALPHA) {
                 // allocate an image to hold a copy of the rasterized glyph
-                image = (uint8_t*)malloc(ft_bitmap->width * ft_bitmap->rows);
+                image = GB_AllocatorAllocImage(allocator, ft_bitmap->width * ft_bitmap->rows);
 
                 // copy image from ft_bitmap.buffer into image
-                uint8_t byte, mask;
                 for (i = 0; i < ft_bitmap->rows; i++) {
-                    for (j = 0; j < ft_bitmap->width; j++) {
-                        byte = ft_bitmap->buffer[i * ft_bitmap->pitch + (j/8)];
-                        mask = 0x1 << (7 - (j % 8));
-                        image[i * ft_bitmap->width + j] = (byte & mask) ? 0xff : 0x00;
-                    }
+                    kernels->mono_to_alpha(image + i * ft_bitmap->width, ft_bitmap->buffer + i * ft_bitmap->pitch, ft_bitmap->width);
                 }
             } else {
                 // allocate an image to hold a copy of the rasterized glyph
-                image = (uint8_t*)malloc(4 * ft_bitmap->width * ft_bitmap->rows);
+                image = GB_AllocatorAllocImage(allocator, 4 * ft_bitmap->width * ft_bitmap->rows);
 
                 // copy image from ft_bitmap.buffer into image
-                uint8_t byte, mask;
                 for (i = 0; i < ft_bitmap->rows; i++) {
-                    for (j = 0; j < ft_bitmap->width; j++) {
-                        byte = ft_bitmap->buffer[i * ft_bitmap->pitch + (j/8)];
-                        mask = 0x1 << (7 - (j % 8));
-                        image[i * ft_bitmap->width * 4 + j * 4 + 0] = 0xff;
-                        image[i * ft_bitmap->width * 4 + j * 4 + 1] = 0xff;
-                        image[i * ft_bitmap->width * 4 + j * 4 + 2] = 0xff;
-                        image[i * ft_bitmap->width * 4 + j * 4 + 3] = (byte & mask) ? 0xff : 0x00;
-                    }
+                    kernels->mono_to_rgba(image + i * ft_bitmap->width * 4, ft_bitmap->buffer + i * ft_bitmap->pitch, ft_bitmap->width);
                 }
             }
             size_out[0] = ft_bitmap->width;
@@ -101,7 +91,7 @@ static void _InitGlyphImage(FT_Bitmap *ft_bitmap, enum GB_TextureFormat texture_
             assert(texture_format == GB_TEXTURE_FORMAT_RGBA);
             if (texture_format == GB_TEXTURE_FORMAT_RGBA) {
                 // allocate an image to hold a copy of the rasterized glyph
-                image = (uint8_t*)malloc(4 * ft_bitmap->width * ft_bitmap->rows);
+                image = GB_AllocatorAllocImage(allocator, 4 * ft_bitmap->width * ft_bitmap->rows);
 
                 if (render_options == GB_RENDER_LCD_RGB || render_options == GB_RENDER_LCD_RGB_V) {
                     // copy image from ft_bitmap.buffer into image, row by row.
@@ -110,12 +100,7 @@ static void _InitGlyphImage(FT_Bitmap *ft_bitmap, enum GB_TextureFormat texture_
                     // TODO: Is this pre mulitplied alpha?  What should the alpha be, currently I'm just using g
                     const uint32_t width = ft_bitmap->width / 3;
                     for (i = 0; i < ft_bitmap->rows; i++) {
-                        for (j = 0; j < width; j++) {
-                            image[i * width * 4 + (j * 4) + 0] = ft_bitmap->buffer[i * ft_bitmap->pitch + (j * 3) + 0];
-                            image[i * width * 4 + (j * 4) + 1] = ft_bitmap->buffer[i * ft_bitmap->pitch + (j * 3) + 1];
-                            image[i * width * 4 + (j * 4) + 2] = ft_bitmap->buffer[i * ft_bitmap->pitch + (j * 3) + 2];
-                            image[i * width * 4 + (j * 4) + 3] = 0xff;
-                        }
+                        kernels->rgb_to_rgba(image + i * width * 4, ft_bitmap->buffer + i * ft_bitmap->pitch, width);
                     }
                 } else {
                     // copy image from ft_bitmap.buffer into image, row by row.
@@ -124,12 +109,7 @@ static void _InitGlyphImage(FT_Bitmap *ft_bitmap, enum GB_TextureFormat texture_
                     // TODO: Is this pre mulitplied alpha?  What should the alpha be, currently I'm just using g
                     const uint32_t width = ft_bitmap->width / 3;
                     for (i = 0; i < ft_bitmap->rows; i++) {
-                        for (j = 0; j < width; j++) {
-                            image[i * width * 4 + (j * 4) + 0] = ft_bitmap->buffer[i * ft_bitmap->pitch + (j * 3) + 2];
-                            image[i * width * 4 + (j * 4) + 1] = ft_bitmap->buffer[i * ft_bitmap->pitch + (j * 3) + 1];
-                            image[i * width * 4 + (j * 4) + 2] = ft_bitmap->buffer[i * ft_bitmap->pitch + (j * 3) + 0];
-                            image[i * width * 4 + (j * 4) + 3] = 0xff;
-                        }
+                        kernels->bgr_to_rgba(image + i * width * 4, ft_bitmap->buffer + i * ft_bitmap->pitch, width);
                     }
                 }
                 size_out[0] = ft_bitmap->width / 3;
@@ -152,39 +132,107 @@ static void _InitGlyphImage(FT_Bitmap *ft_bitmap, enum GB_TextureFormat texture_
     }
 }
 
-GB_ERROR GB_GlyphMake(struct GB_Context* gb, uint32_t index, struct GB_Font *font, struct GB_Glyph **glyph_out)
+static uint32_t _GB_GlyphLoadFlags(struct GB_Context *gb, struct GB_Font *font)
 {
-    if (glyph_out && font && font->ft_face) {
-
-        FT_Face ft_face = font->ft_face;
-
-        uint32_t load_flags;
-        switch (font->hint_options) {
+    uint32_t load_flags;
+    switch (font->hint_options) {
         default:
         case GB_HINT_DEFAULT: load_flags = FT_LOAD_DEFAULT; break;
         case GB_HINT_FORCE_AUTO: load_flags = FT_LOAD_FORCE_AUTOHINT; break;
         case GB_HINT_NO_AUTO: load_flags = FT_LOAD_NO_AUTOHINT; break;
-        case GB_HINT_NONE: load_flags = FT_LOAD_NO_HINTING; break;
-        }
-        switch (font->render_options) {
-        default:
-        case GB_RENDER_NORMAL: load_flags |= FT_LOAD_TARGET_NORMAL; break;
-        case GB_RENDER_LIGHT: load_flags |= FT_LOAD_TARGET_LIGHT; break;
-        case GB_RENDER_MONO: load_flags |= FT_LOAD_TARGET_MONO; break;
+    case GB_HINT_NONE: load_flags = FT_LOAD_NO_HINTING; break;
+    }
+    switch (font->render_options) {
+    default:
+    case GB_RENDER_NORMAL: load_flags |= FT_LOAD_TARGET_NORMAL; break;
+    case GB_RENDER_LIGHT: load_flags |= FT_LOAD_TARGET_LIGHT; break;
+    case GB_RENDER_MONO: load_flags |= FT_LOAD_TARGET_MONO; break;
 
-        // NOTE: only do sub-pixel anti-aliasing if we are using RGBA textures.
-        case GB_RENDER_LCD_RGB:
-        case GB_RENDER_LCD_BGR:
-            if (gb->texture_format == GB_TEXTURE_FORMAT_RGBA)
-                load_flags |= FT_LOAD_TARGET_LCD;
-            break;
-        case GB_RENDER_LCD_RGB_V:
-        case GB_RENDER_LCD_BGR_V:
-            if (gb->texture_format == GB_TEXTURE_FORMAT_RGBA)
-                load_flags |= FT_LOAD_TARGET_LCD_V;
-            break;
-        }
+    // NOTE: only do sub-pixel anti-aliasing if we are using RGBA textures.
+    case GB_RENDER_LCD_RGB:
+    case GB_RENDER_LCD_BGR:
+        if (gb->texture_format == GB_TEXTURE_FORMAT_RGBA)
+            load_flags |= FT_LOAD_TARGET_LCD;
+        break;
+    case GB_RENDER_LCD_RGB_V:
+    case GB_RENDER_LCD_BGR_V:
+        if (gb->texture_format == GB_TEXTURE_FORMAT_RGBA)
+            load_flags |= FT_LOAD_TARGET_LCD_V;
+        break;
+    }
+    return load_flags;
+}
+
+static struct GB_Glyph *_GB_GlyphAlloc(struct GB_Context *gb, uint32_t index, struct GB_Font *font)
+{
+    struct GB_Glyph *glyph = (struct GB_Glyph*)GB_AllocatorAllocGlyph(gb->allocator);
+    if (glyph) {
+        memset(glyph, 0, sizeof(struct GB_Glyph));
+        glyph->allocator = gb->allocator;
+        glyph->key = ((uint64_t)font->index << 32) | index;
+        glyph->rc = 1;
+        glyph->index = index;
+        glyph->font_index = font->index;
+    }
+    return glyph;
+}
+
+// copy the outline in the glyph slot, translated so that its pixel box starts at (0, 0).
+// only done for the anti-aliased render modes, which FT_Outline_Get_Bitmap rasterizes exactly like FT_Render_Glyph.
+// returns NULL if the glyph must be rendered by FT_Render_Glyph instead, size_out is then left alone.
+static struct GB_GlyphOutline *_GB_GlyphCopyOutline(struct GB_Allocator *allocator, FT_GlyphSlot slot,
+                                                     FT_Render_Mode render_mode, uint32_t size_out[2])
+{
+    if (slot->format != FT_GLYPH_FORMAT_OUTLINE ||
+        (render_mode != FT_RENDER_MODE_NORMAL && render_mode != FT_RENDER_MODE_LIGHT))
+        return NULL;
+
+    const FT_Outline *src = &slot->outline;
+#ifdef FT_OUTLINE_OVERLAP
+    // overlapping contours are oversampled by the smooth renderer.
+    if (src->flags & FT_OUTLINE_OVERLAP)
+        return NULL;
+#endif
+
+    // same pixel box as the smooth renderer
+    FT_BBox cbox;
+    FT_Outline_Get_CBox(src, &cbox);
+    const FT_Pos x_min = cbox.xMin & ~63;
+    const FT_Pos y_min = cbox.yMin & ~63;
+    const FT_Pos x_max = (cbox.xMax + 63) & ~63;
+    const FT_Pos y_max = (cbox.yMax + 63) & ~63;
+    if (src->n_points == 0 || x_max <= x_min || y_max <= y_min)
+        return NULL;
+
+    const size_t points_bytes = sizeof(FT_Vector) * src->n_points;
+    const size_t contours_bytes = sizeof(*src->contours) * src->n_contours;
+    struct GB_GlyphOutline *outline = (struct GB_GlyphOutline*)GB_AllocatorMalloc(allocator, sizeof(struct GB_GlyphOutline) +
+                                                                                  points_bytes + contours_bytes + src->n_points);
+    if (!outline)
+        return NULL;
 
+    outline->ft_library = slot->library;
+    FT_Outline *dst = &outline->ft_outline;
+    *dst = *src;
+    dst->points = (FT_Vector*)(outline + 1);
+    dst->contours = (void*)((uint8_t*)dst->points + points_bytes);
+    dst->tags = (void*)((uint8_t*)dst->contours + contours_bytes);
+    memcpy(dst->points, src->points, points_bytes);
+    memcpy(dst->contours, src->contours, contours_bytes);
+    memcpy(dst->tags, src->tags, src->n_points);
+    FT_Outline_Translate(dst, -x_min, -y_min);
+
+    size_out[0] = (uint32_t)((x_max - x_min) >> 6);
+    size_out[1] = (uint32_t)((y_max - y_min) >> 6);
+    return outline;
+}
+
+static GB_ERROR _GB_GlyphMakeFromFace(struct GB_Context* gb, uint32_t index, struct GB_Font *font, FT_Face ft_face,
+                                      int keep_outline, struct GB_Glyph **glyph_out)
+{
+    if (glyph_out && font && ft_face) {
+
+        uint32_t load_flags = _GB_GlyphLoadFlags(gb, font);
         FT_Error ft_error = FT_Load_Glyph(ft_face, index, load_flags);
         if (ft_error)
             return GB_ERROR_FTERR;
@@ -209,30 +257,31 @@ GB_ERROR GB_GlyphMake(struct GB_Context* gb, uint32_t index, struct GB_Font *fon
             break;
         }
 
-        // render glyph into ft_face->glyph->bitmap
-        ft_error = FT_Render_Glyph(ft_face->glyph, render_mode);
-        if (ft_error)
-            return GB_ERROR_FTERR;
-
         // record post-hinted advance and bearing.
         uint32_t advance = FIXED_TO_INT(ft_face->glyph->metrics.horiAdvance);
         uint32_t bearing[2] = {FIXED_TO_INT(ft_face->glyph->metrics.horiBearingX),
                                FIXED_TO_INT(ft_face->glyph->metrics.horiBearingY)};
 
+        // the outline is rasterized later, straight into the cache sheet. see GB_GlyphRenderOutline
         uint8_t *image = NULL;
-        FT_Bitmap *ft_bitmap = &ft_face->glyph->bitmap;
-        uint32_t size[2];
-        _InitGlyphImage(ft_bitmap, gb->texture_format, font->render_options, &image, size);
+        uint32_t size[2] = {0, 0};
+        struct GB_GlyphOutline *outline = NULL;
+        if (keep_outline)
+            outline = _GB_GlyphCopyOutline(gb->allocator, ft_face->glyph, render_mode, size);
+
+        if (!outline) {
+            // render glyph into ft_face->glyph->bitmap
+            ft_error = FT_Render_Glyph(ft_face->glyph, render_mode);
+            if (ft_error)
+                return GB_ERROR_FTERR;
+
+            FT_Bitmap *ft_bitmap = &ft_face->glyph->bitmap;
+            _InitGlyphImage(gb->allocator, ft_bitmap, gb->texture_format, font->render_options, &image, size);
+        }
         uint32_t origin[2] = {0, 0};
 
-        struct GB_Glyph *glyph = (struct GB_Glyph*)malloc(sizeof(struct GB_Glyph));
+        struct GB_Glyph *glyph = _GB_GlyphAlloc(gb, index, font);
         if (glyph) {
-            uint64_t key = ((uint64_t)font->index << 32) | index;
-            glyph->key = key;
-            glyph->rc = 1;
-            glyph->index = index;
-            glyph->font_index = font->index;
-            glyph->gl_tex_obj = 0;
             glyph->origin[0] = origin[0];
             glyph->origin[1] = origin[1];
             glyph->size[0] = size[0];
@@ -241,9 +290,12 @@ GB_ERROR GB_GlyphMake(struct GB_Context* gb, uint32_t index, struct GB_Font *fon
             glyph->bearing[0] = bearing[0];
             glyph->bearing[1] = bearing[1];
             glyph->image = image;
+            glyph->outline = outline;
             *glyph_out = glyph;
             return GB_ERROR_NONE;
         } else {
+            GB_AllocatorFreeImage(gb->allocator, image);
+            GB_AllocatorFree(gb->allocator, outline);
             return GB_ERROR_NOMEM;
         }
     } else {
@@ -251,6 +303,169 @@ GB_ERROR GB_GlyphMake(struct GB_Context* gb, uint32_t index, struct GB_Font *fon
     }
 }
 
+GB_ERROR GB_GlyphMake(struct GB_Context* gb, uint32_t index, struct GB_Font *font, struct GB_Glyph **glyph_out)
+{
+    if (font) {
+        GB_FontActivateSize(font);
+        GB_ERROR error = _GB_GlyphMakeFromFace(gb, index, font, font->ft_face, 1, glyph_out);
+        if (error == GB_ERROR_NONE)
+            (*glyph_out)->frame = gb->frame;
+        return error;
+    } else {
+        return GB_ERROR_INVAL;
+    }
+}
+
+GB_ERROR GB_GlyphMakeFromFace(struct GB_Context* gb, uint32_t index, struct GB_Font *font, FT_Face ft_face,
+                              struct GB_Glyph **glyph_out)
+{
+    return _GB_GlyphMakeFromFace(gb, index, font, ft_face, 0, glyph_out);
+}
+
+// expand 8 bit alpha at the start of row into RGBA, in place.
+// done back to front one chunk at a time, so no alpha is overwritten before it has been read.
+static void _GB_AlphaToRGBAInPlace(const struct GB_ImageKernels *kernels, uint8_t *row, uint32_t width)
+{
+    uint8_t alpha[256];
+    uint32_t end = width;
+    while (end > 0) {
+        uint32_t n = end < sizeof(alpha) ? end : sizeof(alpha);
+        memcpy(alpha, row + end - n, n);
+        kernels->alpha_to_rgba(row + (end - n) * 4, alpha, n);
+        end -= n;
+    }
+}
+
+void GB_GlyphRenderOutline(struct GB_Glyph *glyph, enum GB_TextureFormat texture_format, uint8_t *dst, uint32_t stride)
+{
+    assert(glyph->outline);
+    uint32_t y;
+
+    // the rasterizer only writes covered pixels
+    for (y = 0; y < glyph->size[1]; y++)
+        memset(dst + y * stride, 0, glyph->size[0]);
+
+    // the first size[0] bytes of each row are used as a gray bitmap, top row first.
+    FT_Bitmap ft_bitmap;
+    memset(&ft_bitmap, 0, sizeof(FT_Bitmap));
+    ft_bitmap.rows = glyph->size[1];
+    ft_bitmap.width = glyph->size[0];
+    ft_bitmap.pitch = (int)stride;
+    ft_bitmap.buffer = dst;
+    ft_bitmap.num_grays = 256;
+    ft_bitmap.pixel_mode = FT_PIXEL_MODE_GRAY;
+    FT_Outline_Get_Bitmap(glyph->outline->ft_library, &glyph->outline->ft_outline, &ft_bitmap);
+
+    if (texture_format == GB_TEXTURE_FORMAT_RGBA) {
+        // white with alpha, i.e. non-premultiplied alpha.
+        const struct GB_ImageKernels *kernels = GB_ImageKernelsGet();
+        for (y = 0; y < glyph->size[1]; y++)
+            _GB_AlphaToRGBAInPlace(kernels, dst + y * stride, glyph->size[0]);
+    }
+
+    GB_AllocatorFree(glyph->allocator, glyph->outline);
+    glyph->outline = NULL;
+}
+
+// load the advances of a page of glyphs with a single FT_Get_Advances call.
+static int32_t *_GB_GlyphLoadAdvancePage(struct GB_Context *gb, struct GB_Font *font, uint32_t page)
+{
+    const uint32_t num_glyphs = (uint32_t)font->ft_face->num_glyphs;
+    if (!font->advance_page) {
+        uint32_t num_pages = (num_glyphs + GB_FONT_ADVANCE_PAGE_SIZE - 1) >> GB_FONT_ADVANCE_PAGE_SHIFT;
+        font->advance_page = (int32_t**)calloc(num_pages, sizeof(int32_t*));
+        if (!font->advance_page)
+            return NULL;
+        font->num_advance_pages = num_pages;
+    }
+
+    const uint32_t first = page << GB_FONT_ADVANCE_PAGE_SHIFT;
+    const uint32_t count = num_glyphs - first < GB_FONT_ADVANCE_PAGE_SIZE ? num_glyphs - first : GB_FONT_ADVANCE_PAGE_SIZE;
+    FT_Fixed advances[GB_FONT_ADVANCE_PAGE_SIZE];
+    GB_FontActivateSize(font);
+    if (FT_Get_Advances(font->ft_face, first, count, _GB_GlyphLoadFlags(gb, font), advances))
+        return NULL;
+
+    int32_t *advance_page = (int32_t*)malloc(sizeof(int32_t) * GB_FONT_ADVANCE_PAGE_SIZE);
+    if (!advance_page)
+        return NULL;
+    uint32_t i;
+    for (i = 0; i < count; i++) {
+        // 16.16 to 26.6
+        advance_page[i] = (int32_t)((advances[i] + 512) >> 10);
+    }
+    font->advance_page[page] = advance_page;
+    return advance_page;
+}
+
+GB_ERROR GB_GlyphGetAdvance(struct GB_Context* gb, uint32_t index, struct GB_Font *font, int32_t *advance_out)
+{
+    if (gb && font && font->ft_face && advance_out) {
+        if (index >= (uint32_t)font->ft_face->num_glyphs)
+            return GB_ERROR_INVAL;
+
+        const uint32_t page = index >> GB_FONT_ADVANCE_PAGE_SHIFT;
+        int32_t *advance_page = font->advance_page ? font->advance_page[page] : NULL;
+        if (!advance_page) {
+            advance_page = _GB_GlyphLoadAdvancePage(gb, font, page);
+            if (!advance_page) {
+                // fall back to a single glyph
+                FT_Fixed advance = 0;
+                GB_FontActivateSize(font);
+                if (FT_Get_Advance(font->ft_face, index, _GB_GlyphLoadFlags(gb, font), &advance))
+                    return GB_ERROR_FTERR;
+                *advance_out = (int32_t)((advance + 512) >> 10);
+                return GB_ERROR_NONE;
+            }
+        }
+        *advance_out = advance_page[index & (GB_FONT_ADVANCE_PAGE_SIZE - 1)];
+        return GB_ERROR_NONE;
+    } else {
+        return GB_ERROR_INVAL;
+    }
+}
+
+GB_ERROR GB_GlyphMakePending(struct GB_Context* gb, uint32_t index, struct GB_Font *font, struct GB_Glyph **glyph_out)
+{
+    if (gb && glyph_out && font && font->ft_face) {
+        // only the advance is known until the glyph is rasterized.
+        int32_t advance = 0;
+        GB_ERROR error = GB_GlyphGetAdvance(gb, index, font, &advance);
+        if (error != GB_ERROR_NONE)
+            return error;
+
+        struct GB_Glyph *glyph = _GB_GlyphAlloc(gb, index, font);
+        if (glyph) {
+            glyph->advance = (uint32_t)(advance >> 6);
+            glyph->frame = gb->frame;
+            glyph->pending = 1;
+            *glyph_out = glyph;
+            return GB_ERROR_NONE;
+        } else {
+            return GB_ERROR_NOMEM;
+        }
+    } else {
+        return GB_ERROR_INVAL;
+    }
+}
+
+void GB_GlyphResolvePending(struct GB_Glyph *glyph, struct GB_Glyph *rasterized)
+{
+    assert(glyph->pending && !glyph->sheet);
+    if (rasterized) {
+        glyph->size[0] = rasterized->size[0];
+        glyph->size[1] = rasterized->size[1];
+        glyph->advance = rasterized->advance;
+        glyph->bearing[0] = rasterized->bearing[0];
+        glyph->bearing[1] = rasterized->bearing[1];
+        glyph->image = rasterized->image;
+        glyph->outline = rasterized->outline;
+        rasterized->image = NULL;
+        rasterized->outline = NULL;
+    }
+    glyph->pending = 0;
+}
+
 GB_ERROR GB_GlyphRetain(struct GB_Glyph *glyph)
 {
     if (glyph) {
@@ -265,9 +480,9 @@ GB_ERROR GB_GlyphRetain(struct GB_Glyph *glyph)
 static void _GB_GlyphDestroy(struct GB_Glyph *glyph)
 {
     assert(glyph);
-    if (glyph->image)
-        free(glyph->image);
-    free(glyph);
+    GB_AllocatorFreeImage(glyph->allocator, glyph->image);
+    GB_AllocatorFree(glyph->allocator, glyph->outline);
+    GB_AllocatorFreeGlyph(glyph->allocator, glyph);
 }
 
 GB_ERROR GB_GlyphRelease(struct GB_Glyph *glyph)
@@ -7,10 +7,17 @@ extern "C" {
 
 #include <stdint.h>
 #include "gb_error.h"
-#include "uthash.h"
 #include "gb_context.h"
 
+// hinted outline of a glyph which has not been rasterized yet, see GB_GlyphRenderOutline.
+// points, tags & contours are stored in the same allocation, right after this struct.
+struct GB_GlyphOutline {
+    FT_Library ft_library;  // library of the face it was loaded from
+    FT_Outline ft_outline;  // translated so its pixel box starts at (0, 0)
+};
+
 struct GB_Glyph {
+    struct GB_Allocator *allocator;  // context allocator the glyph & its image come from
     uint64_t key;
     int rc;
     uint32_t index;
@@ -20,12 +27,44 @@ struct GB_Glyph {
     uint32_t size[2];
     uint32_t advance;
     uint32_t bearing[2];
-    uint8_t *image;
-    UT_hash_handle context_hh;
-    UT_hash_handle cache_hh;
+    uint8_t *image;  // see GB_AllocatorAllocImage
+    struct GB_GlyphOutline *outline;  // set instead of image, until the glyph is rasterized into a cache sheet
+    uint32_t num_users;  // number of uses by GB_Text structs, see GB_ContextAddGlyphUse
+    uint32_t frame;  // last frame this glyph was used in, see GB_ContextBeginFrame
+    struct GB_Sheet *sheet;  // sheet which holds this glyph, NULL when using the fallback texture
+    uint32_t sheet_slot;  // index of this glyph in sheet->glyph
+    struct GB_Glyph **font_slot;  // entry in the glyph pages of its GB_Font which points to this glyph, or NULL
+    uint32_t pending;  // 1 until the glyph has been rasterized, see GB_TEXT_OPTION_ASYNC
+    struct GB_Glyph *prev;  // cache lru list, only holds glyphs which are not used by any GB_Text
+    struct GB_Glyph *next;
 };
 
+// Anti-aliased outline glyphs are not rasterized here, only their size is computed from the outline's control box.
+// They keep a copy of the hinted outline instead of an image, which GB_CacheInsert rasterizes straight into a sheet.
 GB_ERROR GB_GlyphMake(struct GB_Context* gb, uint32_t index, struct GB_Font *font, struct GB_Glyph **glyph_out);
+
+// make a placeholder for a glyph which will be rasterized later, only its advance is filled in.
+// It has no image & zero size, so its quads are empty until GB_GlyphResolvePending is called.
+GB_ERROR GB_GlyphMakePending(struct GB_Context* gb, uint32_t index, struct GB_Font *font, struct GB_Glyph **glyph_out);
+
+// advance of a glyph in 26.6 fixed point pixels, as it will be when rasterized (i.e. hinted unless GB_HINT_NONE).
+// Advances are loaded a page at a time into the font's advance table, the glyph is never rasterized.
+// Used to position glyphs of texts which are not shaped, see GB_TEXT_OPTION_DISABLE_SHAPING.
+GB_ERROR GB_GlyphGetAdvance(struct GB_Context* gb, uint32_t index, struct GB_Font *font, int32_t *advance_out);
+
+// fill in a placeholder glyph, taking the metrics & image (or outline) of rasterized.
+// rasterized may be NULL if rasterization failed, the glyph then stays empty.
+void GB_GlyphResolvePending(struct GB_Glyph *glyph, struct GB_Glyph *rasterized);
+
+// rasterize using ft_face instead of font->ft_face, ft_face must be a face of the same font file and size.
+// Used by the worker threads, each of which owns its own FT_Library. glyph->frame is left at 0.
+// The glyph is always rasterized into an image, as its outline could not be rendered on another thread.
+GB_ERROR GB_GlyphMakeFromFace(struct GB_Context* gb, uint32_t index, struct GB_Font *font, FT_Face ft_face,
+                              struct GB_Glyph **glyph_out);
+// rasterize glyph->outline into dst, which has room for size[0] x size[1] pixels of texture_format, rows stride bytes apart.
+// The outline is freed afterwards, on error the glyph is left blank.
+void GB_GlyphRenderOutline(struct GB_Glyph *glyph, enum GB_TextureFormat texture_format, uint8_t *dst, uint32_t stride);
+
 GB_ERROR GB_GlyphRetain(struct GB_Glyph *glyph);
 GB_ERROR GB_GlyphRelease(struct GB_Glyph *glyph);
 
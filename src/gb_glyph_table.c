@@ -0,0 +1,133 @@
+#include <stdlib.h>
+#include <assert.h>
+#include "gb_glyph.h"
+#include "gb_glyph_table.h"
+
+#define GB_GLYPH_TABLE_INITIAL_CAPACITY_LOG2 8
+
+// fibonacci hashing, mixes the font index in the high bits & the glyph index in the low bits.
+static uint32_t _GB_GlyphTableHome(const struct GB_GlyphTable *table, uint64_t key)
+{
+    return (uint32_t)((key * 0x9e3779b97f4a7c15ULL) >> table->shift);
+}
+
+static GB_ERROR _GB_GlyphTableAlloc(struct GB_GlyphTable *table, uint32_t capacity_log2)
+{
+    const uint32_t capacity = 1u << capacity_log2;
+    uint64_t *key = (uint64_t*)malloc(sizeof(uint64_t) * capacity);
+    struct GB_Glyph **glyph = (struct GB_Glyph**)malloc(sizeof(struct GB_Glyph*) * capacity);
+    if (!key || !glyph) {
+        free(key);
+        free(glyph);
+        return GB_ERROR_NOMEM;
+    }
+
+    uint32_t i;
+    for (i = 0; i < capacity; i++) {
+        key[i] = GB_GLYPH_TABLE_EMPTY_KEY;
+        glyph[i] = NULL;
+    }
+
+    table->key = key;
+    table->glyph = glyph;
+    table->capacity = capacity;
+    table->shift = 64 - capacity_log2;
+    table->count = 0;
+    return GB_ERROR_NONE;
+}
+
+// insert into a table known to have room, glyph must not already be present.
+static void _GB_GlyphTableInsert(struct GB_GlyphTable *table, struct GB_Glyph *glyph)
+{
+    const uint32_t mask = table->capacity - 1;
+    uint32_t i = _GB_GlyphTableHome(table, glyph->key);
+    while (table->key[i] != GB_GLYPH_TABLE_EMPTY_KEY) {
+        assert(table->key[i] != glyph->key);
+        i = (i + 1) & mask;
+    }
+    table->key[i] = glyph->key;
+    table->glyph[i] = glyph;
+    table->count++;
+}
+
+GB_ERROR GB_GlyphTableInit(struct GB_GlyphTable *table)
+{
+    return _GB_GlyphTableAlloc(table, GB_GLYPH_TABLE_INITIAL_CAPACITY_LOG2);
+}
+
+void GB_GlyphTableDestroy(struct GB_GlyphTable *table)
+{
+    free(table->key);
+    free(table->glyph);
+    table->key = NULL;
+    table->glyph = NULL;
+    table->capacity = 0;
+    table->count = 0;
+}
+
+struct GB_Glyph *GB_GlyphTableFind(const struct GB_GlyphTable *table, uint64_t key)
+{
+    const uint32_t mask = table->capacity - 1;
+    uint32_t i = _GB_GlyphTableHome(table, key);
+    while (1) {
+        const uint64_t k = table->key[i];
+        if (k == key)
+            return table->glyph[i];
+        if (k == GB_GLYPH_TABLE_EMPTY_KEY)
+            return NULL;
+        i = (i + 1) & mask;
+    }
+}
+
+GB_ERROR GB_GlyphTableAdd(struct GB_GlyphTable *table, struct GB_Glyph *glyph)
+{
+    assert(glyph->key != GB_GLYPH_TABLE_EMPTY_KEY);
+
+    // keep the load factor at or below 1/2, so probe sequences stay short.
+    if ((table->count + 1) * 2 > table->capacity) {
+        struct GB_GlyphTable old = *table;
+        GB_ERROR error = _GB_GlyphTableAlloc(table, 64 - old.shift + 1);
+        if (error != GB_ERROR_NONE)
+            return error;
+
+        uint32_t i;
+        for (i = 0; i < old.capacity; i++) {
+            if (old.key[i] != GB_GLYPH_TABLE_EMPTY_KEY)
+                _GB_GlyphTableInsert(table, old.glyph[i]);
+        }
+        GB_GlyphTableDestroy(&old);
+    }
+
+    _GB_GlyphTableInsert(table, glyph);
+    return GB_ERROR_NONE;
+}
+
+void GB_GlyphTableRemove(struct GB_GlyphTable *table, uint64_t key)
+{
+    const uint32_t mask = table->capacity - 1;
+    uint32_t i = _GB_GlyphTableHome(table, key);
+    while (table->key[i] != key) {
+        if (table->key[i] == GB_GLYPH_TABLE_EMPTY_KEY)
+            return;
+        i = (i + 1) & mask;
+    }
+
+    // backward shift deletion, move later entries of the probe sequence into the hole,
+    // unless that would place them before their home slot.
+    uint32_t j = i;
+    while (1) {
+        j = (j + 1) & mask;
+        if (table->key[j] == GB_GLYPH_TABLE_EMPTY_KEY)
+            break;
+        const uint32_t home = _GB_GlyphTableHome(table, table->key[j]);
+        const int between = (i <= j) ? (i < home && home <= j) : (i < home || home <= j);
+        if (!between) {
+            table->key[i] = table->key[j];
+            table->glyph[i] = table->glyph[j];
+            i = j;
+        }
+    }
+    table->key[i] = GB_GLYPH_TABLE_EMPTY_KEY;
+    table->glyph[i] = NULL;
+    table->count--;
+}
@@ -0,0 +1,43 @@
+#ifndef GB_GLYPH_TABLE_H
+#define GB_GLYPH_TABLE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include "gb_error.h"
+
+struct GB_Glyph;
+
+// marks an unused slot, glyph keys never have all bits set.
+#define GB_GLYPH_TABLE_EMPTY_KEY UINT64_MAX
+
+// open addressing hash table from glyph key to GB_Glyph ptr.
+// keys are stored in their own flat array and probed linearly, so a lookup usually touches a single cache line.
+// Deletion shifts later entries back, so the table never fills up with tombstones.
+struct GB_GlyphTable {
+    uint64_t *key;  // GB_GLYPH_TABLE_EMPTY_KEY if slot is unused
+    struct GB_Glyph **glyph;
+    uint32_t capacity;  // always a power of two
+    uint32_t shift;  // 64 - log2(capacity)
+    uint32_t count;
+};
+
+GB_ERROR GB_GlyphTableInit(struct GB_GlyphTable *table);
+void GB_GlyphTableDestroy(struct GB_GlyphTable *table);
+
+// returns NULL if key is not present.
+struct GB_Glyph *GB_GlyphTableFind(const struct GB_GlyphTable *table, uint64_t key);
+
+// glyph->key must not already be present. The table does not retain glyph.
+GB_ERROR GB_GlyphTableAdd(struct GB_GlyphTable *table, struct GB_Glyph *glyph);
+
+// does nothing if key is not present.
+void GB_GlyphTableRemove(struct GB_GlyphTable *table, uint64_t key);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // GB_GLYPH_TABLE_H
@@ -0,0 +1,357 @@
+#include <string.h>
+#include <pthread.h>
+#include "gb_image.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define GB_IMAGE_X86
+#include <immintrin.h>
+#define GB_TARGET(isa) __attribute__((target(isa)))
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define GB_IMAGE_NEON
+#include <arm_neon.h>
+#endif
+
+typedef void (*_GB_RowFunc)(uint8_t *dst, const uint8_t *src, uint32_t width);
+
+// mono is expanded to alpha one chunk at a time, then to RGBA.
+#define GB_IMAGE_CHUNK 256
+
+static void _GB_MonoToRGBAChunked(uint8_t *dst, const uint8_t *src, uint32_t width,
+                                  _GB_RowFunc mono_to_alpha, _GB_RowFunc alpha_to_rgba)
+{
+    uint8_t alpha[GB_IMAGE_CHUNK];
+    uint32_t j;
+    for (j = 0; j < width; j += GB_IMAGE_CHUNK) {
+        uint32_t n = width - j < GB_IMAGE_CHUNK ? width - j : GB_IMAGE_CHUNK;
+        mono_to_alpha(alpha, src + j / 8, n);
+        alpha_to_rgba(dst + j * 4, alpha, n);
+    }
+}
+
+//
+// scalar
+//
+
+static void _GB_AlphaToRGBA_Scalar(uint8_t *dst, const uint8_t *src, uint32_t width)
+{
+    uint32_t j;
+    for (j = 0; j < width; j++, dst += 4) {
+        dst[0] = 0xff;
+        dst[1] = 0xff;
+        dst[2] = 0xff;
+        dst[3] = src[j];
+    }
+}
+
+static void _GB_MonoToAlpha_Scalar(uint8_t *dst, const uint8_t *src, uint32_t width)
+{
+    uint32_t j;
+    for (j = 0; j < width; j++)
+        dst[j] = (src[j / 8] & (0x80 >> (j % 8))) ? 0xff : 0x00;
+}
+
+static void _GB_MonoToRGBA_Scalar(uint8_t *dst, const uint8_t *src, uint32_t width)
+{
+    _GB_MonoToRGBAChunked(dst, src, width, _GB_MonoToAlpha_Scalar, _GB_AlphaToRGBA_Scalar);
+}
+
+static void _GB_RGBToRGBA_Scalar(uint8_t *dst, const uint8_t *src, uint32_t width)
+{
+    uint32_t j;
+    for (j = 0; j < width; j++, dst += 4, src += 3) {
+        dst[0] = src[0];
+        dst[1] = src[1];
+        dst[2] = src[2];
+        dst[3] = 0xff;
+    }
+}
+
+static void _GB_BGRToRGBA_Scalar(uint8_t *dst, const uint8_t *src, uint32_t width)
+{
+    uint32_t j;
+    for (j = 0; j < width; j++, dst += 4, src += 3) {
+        dst[0] = src[2];
+        dst[1] = src[1];
+        dst[2] = src[0];
+        dst[3] = 0xff;
+    }
+}
+
+static const struct GB_ImageKernels s_scalar_kernels = {
+    _GB_AlphaToRGBA_Scalar,
+    _GB_MonoToAlpha_Scalar,
+    _GB_MonoToRGBA_Scalar,
+    _GB_RGBToRGBA_Scalar,
+    _GB_BGRToRGBA_Scalar,
+    "scalar"
+};
+
+#ifdef GB_IMAGE_X86
+
+//
+// SSE2, lcd swizzles need pshufb from SSSE3
+//
+
+GB_TARGET("sse2")
+static void _GB_AlphaToRGBA_SSE2(uint8_t *dst, const uint8_t *src, uint32_t width)
+{
+    const __m128i ones = _mm_set1_epi8((char)0xff);
+    uint32_t j = 0;
+    for (; j + 16 <= width; j += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i*)(src + j));
+        __m128i lo = _mm_unpacklo_epi8(ones, a);  // ff a0 ff a1 ...
+        __m128i hi = _mm_unpackhi_epi8(ones, a);
+        _mm_storeu_si128((__m128i*)(dst + j * 4 + 0), _mm_unpacklo_epi16(ones, lo));  // ff ff ff a0 ...
+        _mm_storeu_si128((__m128i*)(dst + j * 4 + 16), _mm_unpackhi_epi16(ones, lo));
+        _mm_storeu_si128((__m128i*)(dst + j * 4 + 32), _mm_unpacklo_epi16(ones, hi));
+        _mm_storeu_si128((__m128i*)(dst + j * 4 + 48), _mm_unpackhi_epi16(ones, hi));
+    }
+    _GB_AlphaToRGBA_Scalar(dst + j * 4, src + j, width - j);
+}
+
+GB_TARGET("sse2")
+static void _GB_MonoToAlpha_SSE2(uint8_t *dst, const uint8_t *src, uint32_t width)
+{
+    const __m128i bits = _mm_set_epi8(0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, (char)0x80,
+                                      0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, (char)0x80);
+    uint32_t j = 0;
+    for (; j + 16 <= width; j += 16) {
+        // spread two source bytes over 8 lanes each, then test one bit per lane.
+        __m128i v = _mm_cvtsi32_si128(src[j / 8] | (src[j / 8 + 1] << 8));
+        v = _mm_unpacklo_epi8(v, v);
+        v = _mm_unpacklo_epi16(v, v);
+        v = _mm_unpacklo_epi32(v, v);
+        v = _mm_cmpeq_epi8(_mm_and_si128(v, bits), bits);
+        _mm_storeu_si128((__m128i*)(dst + j), v);
+    }
+    _GB_MonoToAlpha_Scalar(dst + j, src + j / 8, width - j);
+}
+
+GB_TARGET("sse2")
+static void _GB_MonoToRGBA_SSE2(uint8_t *dst, const uint8_t *src, uint32_t width)
+{
+    _GB_MonoToRGBAChunked(dst, src, width, _GB_MonoToAlpha_SSE2, _GB_AlphaToRGBA_SSE2);
+}
+
+// returns the number of pixels converted, the rest are left to the caller.
+GB_TARGET("ssse3")
+static uint32_t _GB_SwizzleToRGBA_SSSE3(uint8_t *dst, const uint8_t *src, uint32_t width, __m128i shuffle)
+{
+    const __m128i alpha = _mm_set1_epi32((int)0xff000000);
+    uint32_t j = 0;
+
+    // 16 bytes are loaded for every 12 used, stop early enough to stay within the row.
+    for (; j + 6 <= width; j += 4) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(src + j * 3));
+        _mm_storeu_si128((__m128i*)(dst + j * 4), _mm_or_si128(_mm_shuffle_epi8(v, shuffle), alpha));
+    }
+    return j;
+}
+
+GB_TARGET("ssse3")
+static void _GB_RGBToRGBA_SSSE3(uint8_t *dst, const uint8_t *src, uint32_t width)
+{
+    const __m128i shuffle = _mm_set_epi8(-1, 11, 10, 9, -1, 8, 7, 6, -1, 5, 4, 3, -1, 2, 1, 0);
+    uint32_t j = _GB_SwizzleToRGBA_SSSE3(dst, src, width, shuffle);
+    _GB_RGBToRGBA_Scalar(dst + j * 4, src + j * 3, width - j);
+}
+
+GB_TARGET("ssse3")
+static void _GB_BGRToRGBA_SSSE3(uint8_t *dst, const uint8_t *src, uint32_t width)
+{
+    const __m128i shuffle = _mm_set_epi8(-1, 9, 10, 11, -1, 6, 7, 8, -1, 3, 4, 5, -1, 0, 1, 2);
+    uint32_t j = _GB_SwizzleToRGBA_SSSE3(dst, src, width, shuffle);
+    _GB_BGRToRGBA_Scalar(dst + j * 4, src + j * 3, width - j);
+}
+
+//
+// AVX2
+//
+
+GB_TARGET("avx2")
+static void _GB_AlphaToRGBA_AVX2(uint8_t *dst, const uint8_t *src, uint32_t width)
+{
+    const __m256i white = _mm256_set1_epi32(0x00ffffff);
+    uint32_t j = 0;
+    for (; j + 8 <= width; j += 8) {
+        // widen 8 alpha bytes to 32 bits each, and move them into the alpha byte.
+        __m256i a = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)(src + j)));
+        _mm256_storeu_si256((__m256i*)(dst + j * 4), _mm256_or_si256(_mm256_slli_epi32(a, 24), white));
+    }
+    _GB_AlphaToRGBA_Scalar(dst + j * 4, src + j, width - j);
+}
+
+GB_TARGET("avx2")
+static void _GB_MonoToAlpha_AVX2(uint8_t *dst, const uint8_t *src, uint32_t width)
+{
+    const __m256i spread = _mm256_set_epi8(3, 3, 3, 3, 3, 3, 3, 3, 2, 2, 2, 2, 2, 2, 2, 2,
+                                           1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0, 0);
+    const __m256i bits = _mm256_set_epi8(0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, (char)0x80,
+                                         0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, (char)0x80,
+                                         0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, (char)0x80,
+                                         0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, (char)0x80);
+    uint32_t j = 0;
+    for (; j + 32 <= width; j += 32) {
+        // spread four source bytes over 8 lanes each, then test one bit per lane.
+        int32_t word;
+        memcpy(&word, src + j / 8, sizeof(word));
+        __m256i v = _mm256_shuffle_epi8(_mm256_set1_epi32(word), spread);
+        v = _mm256_cmpeq_epi8(_mm256_and_si256(v, bits), bits);
+        _mm256_storeu_si256((__m256i*)(dst + j), v);
+    }
+    _GB_MonoToAlpha_SSE2(dst + j, src + j / 8, width - j);
+}
+
+GB_TARGET("avx2")
+static void _GB_MonoToRGBA_AVX2(uint8_t *dst, const uint8_t *src, uint32_t width)
+{
+    _GB_MonoToRGBAChunked(dst, src, width, _GB_MonoToAlpha_AVX2, _GB_AlphaToRGBA_AVX2);
+}
+
+static const struct GB_ImageKernels s_sse2_kernels = {
+    _GB_AlphaToRGBA_SSE2,
+    _GB_MonoToAlpha_SSE2,
+    _GB_MonoToRGBA_SSE2,
+    _GB_RGBToRGBA_Scalar,
+    _GB_BGRToRGBA_Scalar,
+    "sse2"
+};
+
+static const struct GB_ImageKernels s_ssse3_kernels = {
+    _GB_AlphaToRGBA_SSE2,
+    _GB_MonoToAlpha_SSE2,
+    _GB_MonoToRGBA_SSE2,
+    _GB_RGBToRGBA_SSSE3,
+    _GB_BGRToRGBA_SSSE3,
+    "ssse3"
+};
+
+static const struct GB_ImageKernels s_avx2_kernels = {
+    _GB_AlphaToRGBA_AVX2,
+    _GB_MonoToAlpha_AVX2,
+    _GB_MonoToRGBA_AVX2,
+    _GB_RGBToRGBA_SSSE3,
+    _GB_BGRToRGBA_SSSE3,
+    "avx2"
+};
+
+#endif // GB_IMAGE_X86
+
+#ifdef GB_IMAGE_NEON
+
+//
+// NEON, selected at compile time
+//
+
+static void _GB_AlphaToRGBA_NEON(uint8_t *dst, const uint8_t *src, uint32_t width)
+{
+    uint8x16x4_t rgba;
+    rgba.val[0] = vdupq_n_u8(0xff);
+    rgba.val[1] = rgba.val[0];
+    rgba.val[2] = rgba.val[0];
+    uint32_t j = 0;
+    for (; j + 16 <= width; j += 16) {
+        rgba.val[3] = vld1q_u8(src + j);
+        vst4q_u8(dst + j * 4, rgba);
+    }
+    _GB_AlphaToRGBA_Scalar(dst + j * 4, src + j, width - j);
+}
+
+static void _GB_MonoToAlpha_NEON(uint8_t *dst, const uint8_t *src, uint32_t width)
+{
+    static const uint8_t bit_table[16] = {0x80, 0x40, 0x20, 0x10, 0x08, 0x04, 0x02, 0x01,
+                                          0x80, 0x40, 0x20, 0x10, 0x08, 0x04, 0x02, 0x01};
+    const uint8x16_t bits = vld1q_u8(bit_table);
+    uint32_t j = 0;
+    for (; j + 16 <= width; j += 16) {
+        uint8x16_t v = vcombine_u8(vdup_n_u8(src[j / 8]), vdup_n_u8(src[j / 8 + 1]));
+        vst1q_u8(dst + j, vtstq_u8(v, bits));
+    }
+    _GB_MonoToAlpha_Scalar(dst + j, src + j / 8, width - j);
+}
+
+static void _GB_MonoToRGBA_NEON(uint8_t *dst, const uint8_t *src, uint32_t width)
+{
+    _GB_MonoToRGBAChunked(dst, src, width, _GB_MonoToAlpha_NEON, _GB_AlphaToRGBA_NEON);
+}
+
+static void _GB_RGBToRGBA_NEON(uint8_t *dst, const uint8_t *src, uint32_t width)
+{
+    uint32_t j = 0;
+    for (; j + 16 <= width; j += 16) {
+        uint8x16x3_t rgb = vld3q_u8(src + j * 3);
+        uint8x16x4_t rgba = {{rgb.val[0], rgb.val[1], rgb.val[2], vdupq_n_u8(0xff)}};
+        vst4q_u8(dst + j * 4, rgba);
+    }
+    _GB_RGBToRGBA_Scalar(dst + j * 4, src + j * 3, width - j);
+}
+
+static void _GB_BGRToRGBA_NEON(uint8_t *dst, const uint8_t *src, uint32_t width)
+{
+    uint32_t j = 0;
+    for (; j + 16 <= width; j += 16) {
+        uint8x16x3_t bgr = vld3q_u8(src + j * 3);
+        uint8x16x4_t rgba = {{bgr.val[2], bgr.val[1], bgr.val[0], vdupq_n_u8(0xff)}};
+        vst4q_u8(dst + j * 4, rgba);
+    }
+    _GB_BGRToRGBA_Scalar(dst + j * 4, src + j * 3, width - j);
+}
+
+static const struct GB_ImageKernels s_neon_kernels = {
+    _GB_AlphaToRGBA_NEON,
+    _GB_MonoToAlpha_NEON,
+    _GB_MonoToRGBA_NEON,
+    _GB_RGBToRGBA_NEON,
+    _GB_BGRToRGBA_NEON,
+    "neon"
+};
+
+#endif // GB_IMAGE_NEON
+
+static const struct GB_ImageKernels *s_kernels = &s_scalar_kernels;
+static pthread_once_t s_kernels_once = PTHREAD_ONCE_INIT;
+
+static void _GB_ImageKernelsSelect(void)
+{
+#if defined(GB_IMAGE_X86)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        s_kernels = &s_avx2_kernels;
+    else if (__builtin_cpu_supports("ssse3"))
+        s_kernels = &s_ssse3_kernels;
+    else if (__builtin_cpu_supports("sse2"))
+        s_kernels = &s_sse2_kernels;
+#elif defined(GB_IMAGE_NEON)
+    s_kernels = &s_neon_kernels;
+#endif
+}
+
+const struct GB_ImageKernels *GB_ImageKernelsGet(void)
+{
+    // glyphs may be rasterized on worker threads
+    pthread_once(&s_kernels_once, _GB_ImageKernelsSelect);
+    return s_kernels;
+}
+
+const struct GB_ImageKernels *GB_ImageKernelsGetScalar(void)
+{
+    return &s_scalar_kernels;
+}
+
+uint32_t GB_ImageKernelsGetAll(const struct GB_ImageKernels *kernels[GB_IMAGE_MAX_KERNEL_SETS])
+{
+    uint32_t num_kernels = 0;
+    kernels[num_kernels++] = &s_scalar_kernels;
+#if defined(GB_IMAGE_X86)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse2"))
+        kernels[num_kernels++] = &s_sse2_kernels;
+    if (__builtin_cpu_supports("ssse3"))
+        kernels[num_kernels++] = &s_ssse3_kernels;
+    if (__builtin_cpu_supports("avx2"))
+        kernels[num_kernels++] = &s_avx2_kernels;
+#elif defined(GB_IMAGE_NEON)
+    kernels[num_kernels++] = &s_neon_kernels;
+#endif
+    return num_kernels;
+}
@@ -0,0 +1,44 @@
+#ifndef GB_IMAGE_H
+#define GB_IMAGE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+// row conversion kernels, used to copy FreeType bitmaps into glyph images.
+// each converts a single row of width pixels, src and dst must not overlap.
+struct GB_ImageKernels {
+    // 8 bit alpha to white RGBA with alpha, i.e. non-premultiplied alpha.
+    void (*alpha_to_rgba)(uint8_t *dst, const uint8_t *src, uint32_t width);
+
+    // 1 bit per pixel, most significant bit first, to 8 bit alpha. 0x00 or 0xff.
+    void (*mono_to_alpha)(uint8_t *dst, const uint8_t *src, uint32_t width);
+
+    // 1 bit per pixel to white RGBA with alpha.
+    void (*mono_to_rgba)(uint8_t *dst, const uint8_t *src, uint32_t width);
+
+    // packed lcd sub-pixels to RGBA, with opaque alpha. width is in pixels, i.e. src holds 3 * width bytes.
+    void (*rgb_to_rgba)(uint8_t *dst, const uint8_t *src, uint32_t width);
+    void (*bgr_to_rgba)(uint8_t *dst, const uint8_t *src, uint32_t width);
+
+    const char *name;  // instruction set used, for debugging
+};
+
+// returns the fastest kernels supported by the cpu, chosen the first time this is called.
+const struct GB_ImageKernels *GB_ImageKernelsGet(void);
+
+// returns the portable kernels, which every other set must match bit for bit.
+const struct GB_ImageKernels *GB_ImageKernelsGetScalar(void);
+
+// fills kernels with every set the cpu supports, scalar first, for tests & benchmarks.
+// returns the number of sets, at most GB_IMAGE_MAX_KERNEL_SETS.
+#define GB_IMAGE_MAX_KERNEL_SETS 4
+uint32_t GB_ImageKernelsGetAll(const struct GB_ImageKernels *kernels[GB_IMAGE_MAX_KERNEL_SETS]);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // GB_IMAGE_H
@@ -0,0 +1,383 @@
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "gb_glyph.h"
+#include "gb_cache.h"
+#include "gb_packer.h"
+
+//
+// sheet rect array helpers, used by the skyline & maxrects packers.
+//
+
+// make room for at least num_rects rects, returns 0 if out of memory & leaves the array alone.
+static int _GB_SheetRectReserve(struct GB_Sheet *sheet, uint32_t num_rects)
+{
+    if (num_rects <= sheet->rect_capacity)
+        return 1;
+
+    uint32_t new_capacity = sheet->rect_capacity ? sheet->rect_capacity * 2 : 16;
+    while (new_capacity < num_rects)
+        new_capacity *= 2;
+    struct GB_SheetRect *rect = (struct GB_SheetRect*)realloc(sheet->rect, sizeof(struct GB_SheetRect) * new_capacity);
+    if (!rect)
+        return 0;
+    sheet->rect = rect;
+    sheet->rect_capacity = new_capacity;
+    return 1;
+}
+
+// room must already be reserved, see _GB_SheetRectReserve.
+static void _GB_SheetRectInsert(struct GB_Sheet *sheet, uint32_t i, uint32_t x, uint32_t y, uint32_t w, uint32_t h)
+{
+    assert(i <= sheet->num_rects);
+    assert(sheet->num_rects < sheet->rect_capacity);
+
+    memmove(sheet->rect + i + 1, sheet->rect + i, sizeof(struct GB_SheetRect) * (sheet->num_rects - i));
+    sheet->rect[i].origin[0] = x;
+    sheet->rect[i].origin[1] = y;
+    sheet->rect[i].size[0] = w;
+    sheet->rect[i].size[1] = h;
+    sheet->num_rects++;
+}
+
+static void _GB_SheetRectErase(struct GB_Sheet *sheet, uint32_t i)
+{
+    assert(i < sheet->num_rects);
+    memmove(sheet->rect + i, sheet->rect + i + 1, sizeof(struct GB_SheetRect) * (sheet->num_rects - i - 1));
+    sheet->num_rects--;
+}
+
+//
+// shelf packer
+// Sheet is divided into horizontal levels, glyphs are placed left to right within a level.
+// A new level is opened at the height of the first glyph that does not fit into an existing one.
+//
+
+static int _GB_SheetAddNewLevel(struct GB_Cache *cache, struct GB_Sheet *sheet, uint32_t height)
+{
+    struct GB_SheetLevel *prev_level = (sheet->num_levels == 0) ? NULL : &sheet->level[sheet->num_levels - 1];
+    uint32_t baseline = prev_level ? prev_level->baseline + prev_level->height : 0;
+    if ((baseline + height) <= cache->texture_size) {
+        // grow level array if necessary
+        if (sheet->num_levels == sheet->level_capacity) {
+            const uint32_t new_capacity = sheet->level_capacity ? sheet->level_capacity * 2 : 16;
+            struct GB_SheetLevel *level = (struct GB_SheetLevel*)realloc(sheet->level, sizeof(struct GB_SheetLevel) * new_capacity);
+            if (!level)
+                return 0;  // out of memory, treated as out of room
+            sheet->level = level;
+            sheet->level_capacity = new_capacity;
+        }
+
+        struct GB_SheetLevel *level = &sheet->level[sheet->num_levels++];
+        level->baseline = baseline;
+        level->height = height;
+        level->width = 0;
+        return 1;
+    } else {
+        return 0;
+    }
+}
+
+static int _GB_SheetLevelInsertGlyph(struct GB_Cache *cache, struct GB_SheetLevel *level,
+                                     struct GB_Glyph *glyph)
+{
+    // NOTE: levels only track their used width, not the glyphs themselves.
+    // glyphs may be evicted at any time, see _GB_CacheEvictGlyph.
+    if (level->width + glyph->size[0] <= cache->texture_size) {
+
+        // update glyph origin
+        glyph->origin[0] = level->width;
+        glyph->origin[1] = level->baseline;
+
+        // add glyph to level
+        level->width += glyph->size[0];
+        return 1;
+    }
+
+    // no free space
+    return 0;
+}
+
+static void _GB_ShelfClear(struct GB_Cache *cache, struct GB_Sheet *sheet)
+{
+    sheet->num_levels = 0;
+}
+
+static int _GB_ShelfInsert(struct GB_Cache *cache, struct GB_Sheet *sheet, struct GB_Glyph *glyph)
+{
+    int i = 0;
+    for (i = 0; i < sheet->num_levels; i++) {
+        if (glyph->size[1] <= sheet->level[i].height) {
+            if (_GB_SheetLevelInsertGlyph(cache, &sheet->level[i], glyph)) {
+                return 1;
+            }
+        }
+    }
+
+    // add a new level.
+    if (_GB_SheetAddNewLevel(cache, sheet, glyph->size[1])) {
+        // if this fails, glyph is wider then the texture?!?
+        return _GB_SheetLevelInsertGlyph(cache, &sheet->level[i], glyph);
+    } else {
+        // out of room
+        return 0;
+    }
+}
+
+//
+// skyline bottom-left packer
+// sheet->rect holds the skyline, sorted by x. Each segment is origin = (x, y) & size[0] = width,
+// where y is the lowest free row above that segment (y axis points down).
+// Glyphs are placed at the position which keeps their bottom edge as close to the top of the sheet as possible.
+//
+
+// returns the y position a w pixel wide glyph would occupy if its left edge was placed at segment i.
+// returns 0 if it does not fit.
+static int _GB_SkylineFit(struct GB_Cache *cache, struct GB_Sheet *sheet, uint32_t i,
+                          uint32_t w, uint32_t h, uint32_t *y_out)
+{
+    const uint32_t texture_size = cache->texture_size;
+    uint32_t x = sheet->rect[i].origin[0];
+    if (x + w > texture_size)
+        return 0;
+
+    uint32_t y = 0;
+    int32_t width_left = w;
+    while (width_left > 0) {
+        assert(i < sheet->num_rects);
+        if (sheet->rect[i].origin[1] > y)
+            y = sheet->rect[i].origin[1];
+        if (y + h > texture_size)
+            return 0;
+        width_left -= sheet->rect[i].size[0];
+        i++;
+    }
+    *y_out = y;
+    return 1;
+}
+
+// out of memory leaves the sheet without any free space, until it is cleared again.
+static void _GB_SkylineClear(struct GB_Cache *cache, struct GB_Sheet *sheet)
+{
+    sheet->num_rects = 0;
+    if (_GB_SheetRectReserve(sheet, 1))
+        _GB_SheetRectInsert(sheet, 0, 0, 0, cache->texture_size, 0);
+}
+
+static int _GB_SkylineInsert(struct GB_Cache *cache, struct GB_Sheet *sheet, struct GB_Glyph *glyph)
+{
+    const uint32_t w = glyph->size[0];
+    const uint32_t h = glyph->size[1];
+    uint32_t best_bottom = UINT32_MAX, best_width = UINT32_MAX;
+    uint32_t best_i = 0, best_y = 0;
+
+    uint32_t i, y;
+    for (i = 0; i < sheet->num_rects; i++) {
+        if (_GB_SkylineFit(cache, sheet, i, w, h, &y)) {
+            const uint32_t bottom = y + h;
+            if (bottom < best_bottom || (bottom == best_bottom && sheet->rect[i].size[0] < best_width)) {
+                best_bottom = bottom;
+                best_width = sheet->rect[i].size[0];
+                best_i = i;
+                best_y = y;
+            }
+        }
+    }
+
+    // at most one segment is added, running out of memory is treated as out of room.
+    if (best_bottom == UINT32_MAX || !_GB_SheetRectReserve(sheet, sheet->num_rects + 1))
+        return 0;
+
+    glyph->origin[0] = sheet->rect[best_i].origin[0];
+    glyph->origin[1] = best_y;
+
+    // zero sized glyphs do not change the skyline
+    if (w == 0)
+        return 1;
+
+    // raise the skyline underneath the new glyph
+    const uint32_t x = glyph->origin[0];
+    _GB_SheetRectInsert(sheet, best_i, x, best_y + h, w, 0);
+
+    // shrink or remove the segments which are now covered by the new one.
+    i = best_i + 1;
+    while (i < sheet->num_rects) {
+        struct GB_SheetRect *rect = sheet->rect + i;
+        if (rect->origin[0] < x + w) {
+            const uint32_t shrink = x + w - rect->origin[0];
+            if (rect->size[0] <= shrink) {
+                _GB_SheetRectErase(sheet, i);
+                continue;
+            } else {
+                rect->origin[0] += shrink;
+                rect->size[0] -= shrink;
+            }
+        }
+        break;
+    }
+
+    // merge neighboring segments at the same height
+    for (i = 0; i + 1 < sheet->num_rects; i++) {
+        if (sheet->rect[i].origin[1] == sheet->rect[i + 1].origin[1]) {
+            sheet->rect[i].size[0] += sheet->rect[i + 1].size[0];
+            _GB_SheetRectErase(sheet, i + 1);
+            i--;
+        }
+    }
+
+    return 1;
+}
+
+//
+// maxrects packer
+// sheet->rect holds a list of maximal free rectangles, which may overlap.
+// Each glyph is placed into the free rectangle which leaves the shortest leftover side. (best short side fit)
+//
+
+static int _GB_RectContains(const struct GB_SheetRect *a, const struct GB_SheetRect *b)
+{
+    return b->origin[0] >= a->origin[0] && b->origin[1] >= a->origin[1] &&
+        b->origin[0] + b->size[0] <= a->origin[0] + a->size[0] &&
+        b->origin[1] + b->size[1] <= a->origin[1] + a->size[1];
+}
+
+// out of memory leaves the sheet without any free space, until it is cleared again.
+static void _GB_MaxRectsClear(struct GB_Cache *cache, struct GB_Sheet *sheet)
+{
+    sheet->num_rects = 0;
+    if (_GB_SheetRectReserve(sheet, 1))
+        _GB_SheetRectInsert(sheet, 0, 0, 0, cache->texture_size, cache->texture_size);
+}
+
+static int _GB_RectOverlaps(const struct GB_SheetRect *a, const struct GB_SheetRect *b)
+{
+    return b->origin[0] < a->origin[0] + a->size[0] && a->origin[0] < b->origin[0] + b->size[0] &&
+        b->origin[1] < a->origin[1] + a->size[1] && a->origin[1] < b->origin[1] + b->size[1];
+}
+
+// splits free rect i around the used rect, the leftover pieces are appended to the end of the rect array.
+// returns 1 if free rect i was split and should be removed.
+static int _GB_MaxRectsSplit(struct GB_Sheet *sheet, uint32_t i, const struct GB_SheetRect *used)
+{
+    struct GB_SheetRect free_rect = sheet->rect[i];
+    const uint32_t fx0 = free_rect.origin[0], fy0 = free_rect.origin[1];
+    const uint32_t fx1 = fx0 + free_rect.size[0], fy1 = fy0 + free_rect.size[1];
+    const uint32_t ux0 = used->origin[0], uy0 = used->origin[1];
+    const uint32_t ux1 = ux0 + used->size[0], uy1 = uy0 + used->size[1];
+
+    if (!_GB_RectOverlaps(&free_rect, used))
+        return 0;
+
+    // above & below the used rect
+    if (uy0 > fy0)
+        _GB_SheetRectInsert(sheet, sheet->num_rects, fx0, fy0, free_rect.size[0], uy0 - fy0);
+    if (uy1 < fy1)
+        _GB_SheetRectInsert(sheet, sheet->num_rects, fx0, uy1, free_rect.size[0], fy1 - uy1);
+
+    // left & right of the used rect
+    if (ux0 > fx0)
+        _GB_SheetRectInsert(sheet, sheet->num_rects, fx0, fy0, ux0 - fx0, free_rect.size[1]);
+    if (ux1 < fx1)
+        _GB_SheetRectInsert(sheet, sheet->num_rects, ux1, fy0, fx1 - ux1, free_rect.size[1]);
+
+    return 1;
+}
+
+static void _GB_MaxRectsPrune(struct GB_Sheet *sheet)
+{
+    // remove free rects which are completely contained within another free rect.
+    uint32_t i, j;
+    for (i = 0; i < sheet->num_rects; i++) {
+        for (j = i + 1; j < sheet->num_rects; j++) {
+            if (_GB_RectContains(sheet->rect + j, sheet->rect + i)) {
+                _GB_SheetRectErase(sheet, i);
+                i--;
+                break;
+            }
+            if (_GB_RectContains(sheet->rect + i, sheet->rect + j)) {
+                _GB_SheetRectErase(sheet, j);
+                j--;
+            }
+        }
+    }
+}
+
+static int _GB_MaxRectsInsert(struct GB_Cache *cache, struct GB_Sheet *sheet, struct GB_Glyph *glyph)
+{
+    const uint32_t w = glyph->size[0];
+    const uint32_t h = glyph->size[1];
+    uint32_t best_short = UINT32_MAX, best_long = UINT32_MAX;
+    uint32_t best_i = 0;
+
+    uint32_t i;
+    for (i = 0; i < sheet->num_rects; i++) {
+        const struct GB_SheetRect *rect = sheet->rect + i;
+        if (w <= rect->size[0] && h <= rect->size[1]) {
+            const uint32_t dx = rect->size[0] - w;
+            const uint32_t dy = rect->size[1] - h;
+            const uint32_t short_side = dx < dy ? dx : dy;
+            const uint32_t long_side = dx < dy ? dy : dx;
+            if (short_side < best_short || (short_side == best_short && long_side < best_long)) {
+                best_short = short_side;
+                best_long = long_side;
+                best_i = i;
+            }
+        }
+    }
+
+    if (best_short == UINT32_MAX)
+        return 0;
+
+    glyph->origin[0] = sheet->rect[best_i].origin[0];
+    glyph->origin[1] = sheet->rect[best_i].origin[1];
+
+    // zero sized glyphs do not use any space
+    if (w == 0 || h == 0)
+        return 1;
+
+    // split every free rect that overlaps the new glyph, each one leaves at most 4 pieces.
+    // room for them is reserved first, running out of memory is treated as out of room.
+    struct GB_SheetRect used;
+    used.origin[0] = glyph->origin[0];
+    used.origin[1] = glyph->origin[1];
+    used.size[0] = w;
+    used.size[1] = h;
+    const uint32_t num_rects = sheet->num_rects;
+    uint32_t num_overlaps = 0;
+    for (i = 0; i < num_rects; i++)
+        num_overlaps += _GB_RectOverlaps(sheet->rect + i, &used);
+    if (!_GB_SheetRectReserve(sheet, num_rects + num_overlaps * 4))
+        return 0;
+    for (i = 0; i < num_rects; i++) {
+        if (_GB_MaxRectsSplit(sheet, i, &used)) {
+            // mark as degenerate, removed below.
+            sheet->rect[i].size[0] = 0;
+            sheet->rect[i].size[1] = 0;
+        }
+    }
+    for (i = 0; i < sheet->num_rects; i++) {
+        if (sheet->rect[i].size[0] == 0 || sheet->rect[i].size[1] == 0) {
+            _GB_SheetRectErase(sheet, i);
+            i--;
+        }
+    }
+
+    _GB_MaxRectsPrune(sheet);
+
+    return 1;
+}
+
+static const struct GB_Packer s_packers[GB_PACKER_NUM_PACKERS] = {
+    {_GB_ShelfClear, _GB_ShelfInsert},
+    {_GB_SkylineClear, _GB_SkylineInsert},
+    {_GB_MaxRectsClear, _GB_MaxRectsInsert}
+};
+
+const struct GB_Packer *GB_PackerGet(enum GB_PackerType packer_type)
+{
+    if (packer_type >= 0 && packer_type < GB_PACKER_NUM_PACKERS) {
+        return s_packers + packer_type;
+    } else {
+        return NULL;
+    }
+}
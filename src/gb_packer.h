@@ -0,0 +1,34 @@
+#ifndef GB_PACKER_H
+#define GB_PACKER_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include "gb_error.h"
+#include "gb_context.h"
+
+struct GB_Cache;
+struct GB_Sheet;
+struct GB_Glyph;
+
+// A packer decides where each glyph is placed within a single sheet.
+// All packer state lives in the GB_Sheet, so the same packer can be shared by every sheet in a cache.
+struct GB_Packer {
+    // forget all glyph placements, the entire sheet becomes free space.
+    void (*clear)(struct GB_Cache *cache, struct GB_Sheet *sheet);
+
+    // find room for glyph->size within sheet, on success glyph->origin is updated and 1 is returned.
+    // returns 0 if there is no room.
+    int (*insert)(struct GB_Cache *cache, struct GB_Sheet *sheet, struct GB_Glyph *glyph);
+};
+
+// returns the packer which implements the given strategy, or NULL if packer_type is invalid.
+const struct GB_Packer *GB_PackerGet(enum GB_PackerType packer_type);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // GB_PACKER_H
@@ -0,0 +1,141 @@
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "utlist.h"
+#include "gb_alloc.h"
+#include "gb_shape_cache.h"
+
+// FNV-1a over the segment, then the rest of the key.
+static uint64_t _GB_ShapeKeyHash(const struct GB_ShapeKey *key)
+{
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    uint32_t i;
+    for (i = 0; i < key->length; i++) {
+        hash ^= key->bytes[i];
+        hash *= 0x100000001b3ULL;
+    }
+    hash ^= ((uint64_t)key->font_index << 32) | (uint64_t)key->script;
+    hash *= 0x9e3779b97f4a7c15ULL;
+    hash ^= ((uint64_t)key->direction << 32) ^ (uint64_t)(uintptr_t)key->language;
+    hash *= 0x9e3779b97f4a7c15ULL;
+    return hash ^ (hash >> 29);
+}
+
+static int _GB_ShapeKeyEqual(const struct GB_ShapeKey *a, const struct GB_ShapeKey *b)
+{
+    return a->font_index == b->font_index && a->script == b->script && a->direction == b->direction &&
+           a->language == b->language && a->length == b->length && memcmp(a->bytes, b->bytes, a->length) == 0;
+}
+
+static struct GB_ShapeCacheEntry **_GB_ShapeCacheBucket(struct GB_ShapeCache *cache, uint64_t hash)
+{
+    return cache->bucket + (hash & (cache->num_buckets - 1));
+}
+
+static void _GB_ShapeCacheRemove(struct GB_ShapeCache *cache, struct GB_ShapeCacheEntry *entry)
+{
+    struct GB_ShapeCacheEntry **link = _GB_ShapeCacheBucket(cache, entry->hash);
+    while (*link != entry)
+        link = &(*link)->hash_next;
+    *link = entry->hash_next;
+    DL_DELETE(cache->lru_list, entry);
+    cache->num_entries--;
+    GB_AllocatorFree(cache->allocator, entry);
+}
+
+GB_ERROR GB_ShapeCacheMake(struct GB_Allocator *allocator, uint32_t max_entries, struct GB_ShapeCache **cache_out)
+{
+    if (!allocator || max_entries == 0 || !cache_out)
+        return GB_ERROR_INVAL;
+
+    struct GB_ShapeCache *cache = (struct GB_ShapeCache*)malloc(sizeof(struct GB_ShapeCache));
+    if (!cache)
+        return GB_ERROR_NOMEM;
+    memset(cache, 0, sizeof(struct GB_ShapeCache));
+
+    // about two buckets per entry, so chains stay short when the cache is full.
+    uint32_t num_buckets = 1;
+    while (num_buckets < max_entries * 2)
+        num_buckets <<= 1;
+    cache->bucket = (struct GB_ShapeCacheEntry**)calloc(num_buckets, sizeof(struct GB_ShapeCacheEntry*));
+    if (!cache->bucket) {
+        free(cache);
+        return GB_ERROR_NOMEM;
+    }
+    cache->allocator = allocator;
+    cache->num_buckets = num_buckets;
+    cache->max_entries = max_entries;
+    *cache_out = cache;
+    return GB_ERROR_NONE;
+}
+
+void GB_ShapeCacheDestroy(struct GB_ShapeCache *cache)
+{
+    assert(cache);
+    while (cache->lru_list)
+        _GB_ShapeCacheRemove(cache, cache->lru_list);
+    free(cache->bucket);
+    free(cache);
+}
+
+const struct GB_ShapeCacheEntry *GB_ShapeCacheFind(struct GB_ShapeCache *cache, const struct GB_ShapeKey *key)
+{
+    const uint64_t hash = _GB_ShapeKeyHash(key);
+    cache->num_lookups++;
+
+    struct GB_ShapeCacheEntry *entry = *_GB_ShapeCacheBucket(cache, hash);
+    while (entry && !(entry->hash == hash && _GB_ShapeKeyEqual(&entry->key, key)))
+        entry = entry->hash_next;
+    if (!entry)
+        return NULL;
+
+    cache->num_hits++;
+    if (cache->lru_list != entry) {
+        DL_DELETE(cache->lru_list, entry);
+        DL_PREPEND(cache->lru_list, entry);
+    }
+    return entry;
+}
+
+GB_ERROR GB_ShapeCacheAdd(struct GB_ShapeCache *cache, const struct GB_ShapeKey *key, const hb_glyph_info_t *info,
+                          const hb_glyph_position_t *position, uint32_t num_glyphs)
+{
+    const size_t info_offset = sizeof(struct GB_ShapeCacheEntry);
+    const size_t position_offset = info_offset + sizeof(hb_glyph_info_t) * num_glyphs;
+    const size_t bytes_offset = position_offset + sizeof(hb_glyph_position_t) * num_glyphs;
+    uint8_t *block = (uint8_t*)GB_AllocatorMalloc(cache->allocator, bytes_offset + key->length);
+    if (!block)
+        return GB_ERROR_NOMEM;
+
+    struct GB_ShapeCacheEntry *entry = (struct GB_ShapeCacheEntry*)block;
+    memset(entry, 0, sizeof(struct GB_ShapeCacheEntry));
+    entry->hash = _GB_ShapeKeyHash(key);
+    entry->key = *key;
+    entry->key.bytes = block + bytes_offset;
+    memcpy(block + bytes_offset, key->bytes, key->length);
+    entry->num_glyphs = num_glyphs;
+    entry->info = (hb_glyph_info_t*)(block + info_offset);
+    entry->position = (hb_glyph_position_t*)(block + position_offset);
+    memcpy(entry->info, info, sizeof(hb_glyph_info_t) * num_glyphs);
+    memcpy(entry->position, position, sizeof(hb_glyph_position_t) * num_glyphs);
+
+    // the least recently used entry is at the tail of the list
+    if (cache->num_entries == cache->max_entries)
+        _GB_ShapeCacheRemove(cache, cache->lru_list->prev);
+
+    struct GB_ShapeCacheEntry **bucket = _GB_ShapeCacheBucket(cache, entry->hash);
+    entry->hash_next = *bucket;
+    *bucket = entry;
+    DL_PREPEND(cache->lru_list, entry);
+    cache->num_entries++;
+    return GB_ERROR_NONE;
+}
+
+void GB_ShapeCacheRemoveFont(struct GB_ShapeCache *cache, uint32_t font_index)
+{
+    struct GB_ShapeCacheEntry *entry, *tmp;
+    DL_FOREACH_SAFE(cache->lru_list, entry, tmp) {
+        if (entry->key.font_index == font_index)
+            _GB_ShapeCacheRemove(cache, entry);
+    }
+}
@@ -0,0 +1,76 @@
+#ifndef GB_SHAPE_CACHE_H
+#define GB_SHAPE_CACHE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <harfbuzz/hb.h>
+#include "gb_error.h"
+
+struct GB_Allocator;
+
+// upper limit on the number of shaped segments kept by a context, the least recently used is evicted first.
+#define GB_SHAPE_CACHE_MAX_ENTRIES 4096
+
+// longer segments are shaped every time, they are unlikely to repeat.
+#define GB_SHAPE_CACHE_MAX_SEGMENT_LENGTH 64
+
+// everything which changes the result of shaping a segment.
+// features are not part of the key, texts are always shaped with the default features.
+struct GB_ShapeKey {
+    uint32_t font_index;  // GB_Font index, a font is a single point size of a face
+    hb_script_t script;
+    hb_direction_t direction;
+    hb_language_t language;
+    const uint8_t *bytes;  // utf8
+    uint32_t length;  // in bytes
+};
+
+// the glyphs HarfBuzz made from a segment, in visual order.
+// clusters are byte offsets from the start of the segment.
+// glyphs, positions & a copy of the segment share the entry's allocation.
+struct GB_ShapeCacheEntry {
+    uint64_t hash;
+    struct GB_ShapeKey key;  // key.bytes points at the entry's copy
+    uint32_t num_glyphs;
+    hb_glyph_info_t *info;
+    hb_glyph_position_t *position;
+    struct GB_ShapeCacheEntry *hash_next;
+    struct GB_ShapeCacheEntry *prev;  // lru list, most recently used first
+    struct GB_ShapeCacheEntry *next;
+};
+
+// context-wide cache of shaped words & runs of spaces, see GB_CONTEXT_OPTION_SHAPE_CACHE.
+// chained hash table, it never grows past max_entries so the buckets are allocated up front.
+struct GB_ShapeCache {
+    struct GB_Allocator *allocator;
+    struct GB_ShapeCacheEntry **bucket;
+    uint32_t num_buckets;  // always a power of two
+    struct GB_ShapeCacheEntry *lru_list;
+    uint32_t num_entries;
+    uint32_t max_entries;
+    uint64_t num_lookups;
+    uint64_t num_hits;
+};
+
+GB_ERROR GB_ShapeCacheMake(struct GB_Allocator *allocator, uint32_t max_entries, struct GB_ShapeCache **cache_out);
+void GB_ShapeCacheDestroy(struct GB_ShapeCache *cache);
+
+// returns NULL if the segment has not been shaped yet, a hit becomes the most recently used entry.
+const struct GB_ShapeCacheEntry *GB_ShapeCacheFind(struct GB_ShapeCache *cache, const struct GB_ShapeKey *key);
+
+// copy num_glyphs shaped glyphs of the segment key into the cache, evicting the least recently used entry when full.
+// key must not already be present.
+GB_ERROR GB_ShapeCacheAdd(struct GB_ShapeCache *cache, const struct GB_ShapeKey *key, const hb_glyph_info_t *info,
+                          const hb_glyph_position_t *position, uint32_t num_glyphs);
+
+// drop every segment shaped with a font which is being destroyed.
+void GB_ShapeCacheRemoveFont(struct GB_ShapeCache *cache, uint32_t font_index);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // GB_SHAPE_CACHE_H
@@ -1,59 +1,70 @@
 #include <assert.h>
+#include <stdlib.h>
 #include <unicode/ubidi.h>
 #include <unicode/ustring.h>
-#include "uthash.h"
+#include "utlist.h"
 #include "gb_context.h"
 #include "gb_font.h"
 #include "gb_glyph.h"
 #include "gb_cache.h"
 #include "gb_text.h"
+#include "gb_worker.h"
+#include "gb_alloc.h"
+#include "gb_fallback.h"
+#include "gb_shape_cache.h"
 
 // 26.6 fixed to int (truncates)
 #define FIXED_TO_INT(n) (uint32_t)(n >> 6)
 
-// cp is a utf32 codepoint
-static int is_space(uint32_t cp)
-{
-    switch (cp) {
-    case 0x0020: // space
-    case 0x1680: // ogham space mark
-    case 0x180e: // mongolian vowel separator
-    case 0x2000: // en quad
-    case 0x2001: // em quad
-    case 0x2002: // en space
-    case 0x2003: // em space
-    case 0x2004: // three-per-em space
-    case 0x2005: // four-per-em space
-    case 0x2006: // six-per-em space
-    case 0x2008: // punctuation space
-    case 0x2009: // thin space
-    case 0x200a: // hair space
-    case 0x200b: // zero width space
-    case 0x200c: // zero width non joiner
-    case 0x200d: // zero width joiner
-    case 0x205f: // medium mathematical space
-    case 0x3000: // ideograpfic space
-        return 1;
-    default:
-        return 0;
-    }
-}
+// how a glyph takes part in word-wrapping, classified once per text, see _GB_TextClassifyGlyphs.
+// a line may also break after a BREAK_AFTER glyph, which stays at the end of the line.
+enum GlyphClass { GLYPH_CLASS_NORMAL = 0, GLYPH_CLASS_SPACE, GLYPH_CLASS_NEWLINE, GLYPH_CLASS_BREAK_AFTER };
+
+// class of each ascii codepoint, everything else is normal.
+static const uint8_t s_ascii_class[0x80] = {
+    [0x0a] = GLYPH_CLASS_NEWLINE,  // new line
+    [0x0b] = GLYPH_CLASS_NEWLINE,  // vertical tab
+    [0x0c] = GLYPH_CLASS_NEWLINE,  // form feed
+    [0x0d] = GLYPH_CLASS_NEWLINE,  // carriage return
+    [0x20] = GLYPH_CLASS_SPACE,  // space
+    [0x2d] = GLYPH_CLASS_BREAK_AFTER,  // hyphen-minus
+    [0x2f] = GLYPH_CLASS_BREAK_AFTER,  // slash
+};
+
+// spaces, new lines & break opportunities above ascii, sorted. first & last are inclusive.
+static const struct {
+    uint32_t first;
+    uint32_t last;
+    uint8_t glyph_class;
+} s_unicode_class[] = {
+    {0x0085, 0x0085, GLYPH_CLASS_NEWLINE},  // NEL next line
+    {0x1680, 0x1680, GLYPH_CLASS_SPACE},  // ogham space mark
+    {0x180e, 0x180e, GLYPH_CLASS_SPACE},  // mongolian vowel separator
+    {0x2000, 0x2006, GLYPH_CLASS_SPACE},  // en quad ... six-per-em space
+    {0x2008, 0x200d, GLYPH_CLASS_SPACE},  // punctuation space ... zero width joiner
+    {0x2010, 0x2010, GLYPH_CLASS_BREAK_AFTER},  // hyphen
+    {0x2013, 0x2014, GLYPH_CLASS_BREAK_AFTER},  // en & em dash
+    {0x2028, 0x2029, GLYPH_CLASS_NEWLINE},  // line & paragraph separator
+    {0x205f, 0x205f, GLYPH_CLASS_SPACE},  // medium mathematical space
+    {0x2e80, 0x2fff, GLYPH_CLASS_BREAK_AFTER},  // CJK radicals, kangxi radicals ... ideographic description
+    {0x3000, 0x3000, GLYPH_CLASS_SPACE},  // ideographic space
+    {0x3001, 0x9fff, GLYPH_CLASS_BREAK_AFTER},  // CJK punctuation, kana ... CJK unified ideographs
+    {0xf900, 0xfaff, GLYPH_CLASS_BREAK_AFTER},  // CJK compatibility ideographs
+    {0xff00, 0xffef, GLYPH_CLASS_BREAK_AFTER},  // halfwidth & fullwidth forms
+};
 
 // cp is a utf32 codepoint
-static int is_newline(uint32_t cp)
-{
-    switch (cp) {
-    case 0x000a: // new line
-    case 0x000b: // vertical tab
-    case 0x000c: // form feed
-    case 0x000d: // carriage return
-    case 0x0085: // NEL next line
-    case 0x2028: // line separator
-    case 0x2029: // paragraph separator
-        return 1;
-    default:
-        return 0;
+static uint8_t _GB_GlyphClass(uint32_t cp)
+{
+    if (cp < 0x80)
+        return s_ascii_class[cp];
+
+    uint32_t i;
+    for (i = 0; i < sizeof(s_unicode_class) / sizeof(s_unicode_class[0]) && s_unicode_class[i].first <= cp; i++) {
+        if (cp <= s_unicode_class[i].last)
+            return s_unicode_class[i].glyph_class;
     }
+    return GLYPH_CLASS_NORMAL;
 }
 
 // returns the number of bytes to advance
@@ -70,7 +81,7 @@ static uint32_t utf8_next_cp(const uint8_t *p, uint32_t *cp_out)
         *cp_out = ((*p & ~0xf0) << 12) | ((*(p+1) & ~0xc0) << 6) | (*(p+2) & ~0xc0);
         return 3;
     } else if ((*p & 0xf8) == 0xf0) { // 11110xxx 10xxxxxx 10xxxxxx 10xxxxxx
-        *cp_out = ((*p & ~0xf8) << 18) | ((*(p+1) & ~0xc0) << 12) | ((*(p+1) & ~0xc0) << 6) | (*(p+2) & ~0xc0);
+        *cp_out = ((*p & ~0xf8) << 18) | ((*(p+1) & ~0xc0) << 12) | ((*(p+2) & ~0xc0) << 6) | (*(p+3) & ~0xc0);
         return 4;
     } else {
         // p is not at a valid starting point. p is not utf8 encoded or is at a bad offset.
@@ -80,6 +91,46 @@ static uint32_t utf8_next_cp(const uint8_t *p, uint32_t *cp_out)
     }
 }
 
+// fill glyph_class with the class of the first codepoint of each glyph's cluster in hb_buffer.
+static void _GB_TextClassifyGlyphs(hb_buffer_t *hb_buffer, const uint8_t *utf8_string, uint8_t *glyph_class)
+{
+    uint32_t num_glyphs = hb_buffer_get_length(hb_buffer);
+    hb_glyph_info_t *glyphs = hb_buffer_get_glyph_infos(hb_buffer, NULL);
+    const int rtl = hb_buffer_get_direction(hb_buffer) == HB_DIRECTION_RTL;
+    uint32_t i;
+    for (i = 0; i < num_glyphs; i++) {
+        uint32_t cp;
+        utf8_next_cp(utf8_string + glyphs[i].cluster, &cp);
+        glyph_class[i] = _GB_GlyphClass(cp);
+
+        // only the last glyph of a cluster may be followed by a break, rtl glyphs are in reverse order.
+        const uint32_t next = rtl ? i - 1 : i + 1;
+        if (glyph_class[i] == GLYPH_CLASS_BREAK_AFTER && next < num_glyphs && glyphs[next].cluster == glyphs[i].cluster)
+            glyph_class[i] = GLYPH_CLASS_NORMAL;
+    }
+}
+
+// font of the i'th glyph in text->hb_buffer
+static struct GB_Font *_GB_TextGlyphFont(struct GB_Text *text, uint32_t i)
+{
+    return text->glyph_font ? text->fallback_chain->font[text->glyph_font[i]] : text->font;
+}
+
+// missing glyphs are sorted by font, then glyph index.
+struct GB_MissingGlyph {
+    uint32_t font_slot;  // index into the text's fallback chain, 0 without one
+    uint32_t index;
+};
+
+static int _GB_CompareMissingGlyph(const void *a, const void *b)
+{
+    const struct GB_MissingGlyph *a_glyph = (const struct GB_MissingGlyph*)a;
+    const struct GB_MissingGlyph *b_glyph = (const struct GB_MissingGlyph*)b;
+    if (a_glyph->font_slot != b_glyph->font_slot)
+        return a_glyph->font_slot < b_glyph->font_slot ? -1 : 1;
+    return a_glyph->index < b_glyph->index ? -1 : (a_glyph->index > b_glyph->index ? 1 : 0);
+}
+
 static GB_ERROR _GB_TextUpdateCache(struct GB_Context *gb, struct GB_Text *text)
 {
     assert(gb);
@@ -87,9 +138,15 @@ static GB_ERROR _GB_TextUpdateCache(struct GB_Context *gb, struct GB_Text *text)
 
     // hold a temp array of glyph ptrs, this is so we can sort glyphs by height before
     // adding them to the GlyphCache, which improves texture utilization for long strings of glyphs.
+    // these arrays live in the scratch arena, which is reset by GB_TextMake.
     int num_glyphs = hb_buffer_get_length(text->hb_buffer);
-    struct GB_Glyph **glyph_ptrs = (struct GB_Glyph**)malloc(sizeof(struct GB_Glyph*) * num_glyphs);
-    int num_glyph_ptrs = 0;
+    struct GB_Allocator *allocator = gb->allocator;
+    struct GB_Glyph **glyph_ptrs = (struct GB_Glyph**)GB_AllocatorAllocScratch(allocator, sizeof(struct GB_Glyph*) * num_glyphs);
+    struct GB_MissingGlyph *missing = (struct GB_MissingGlyph*)GB_AllocatorAllocScratch(allocator, sizeof(struct GB_MissingGlyph) * num_glyphs);
+    struct GB_RasterJob *jobs = (struct GB_RasterJob*)GB_AllocatorAllocScratch(allocator, sizeof(struct GB_RasterJob) * num_glyphs);
+    int num_glyph_ptrs = 0, num_missing = 0, num_jobs = 0;
+    if (!glyph_ptrs || !missing || !jobs)
+        return GB_ERROR_NOMEM;
 
     struct GB_Cache *cache = gb->cache;
 
@@ -98,41 +155,103 @@ static GB_ERROR _GB_TextUpdateCache(struct GB_Context *gb, struct GB_Text *text)
     // prepare to iterate over all the glyphs in the hb_buffer
     hb_glyph_info_t *glyphs = hb_buffer_get_glyph_infos(text->hb_buffer, NULL);
 
-    // iterate over each glyph
+    // find the glyphs which are not in the cache yet, skipping new-lines.
+    // synchronous texts also rasterize glyphs which are still pending for an async text.
+    int async = (text->option_flags & GB_TEXT_OPTION_ASYNC) != 0;
     int i;
     for (i = 0; i < num_glyphs; i++) {
-        int index = glyphs[i].codepoint;
-
-        // check to see if this glyph already exists in the context
-        struct GB_Glyph *glyph = GB_ContextHashFind(gb, index, text->font->index);
-        if (!glyph) {
-            // check to see if this glyph already exists in the cache
-            glyph = GB_CacheHashFind(cache, index, text->font->index);
-            if (!glyph) {
-
-                // skip new-lines
-                uint32_t cp;
-                utf8_next_cp(text->utf8_string + glyphs[i].cluster, &cp);
-                if (!is_newline(cp)) {
-
-                    // will rasterize and initialize glyph
-                    GB_ERROR gb_error = GB_GlyphMake(gb, index, text->font, &glyph);
-                    if (gb_error)
-                        return gb_error;
-
-                    // add to glyph_ptr array
+        if (text->glyph_class[i] == GLYPH_CLASS_NEWLINE)
+            continue;
+        struct GB_Glyph *glyph = GB_FontFindGlyph(gb, _GB_TextGlyphFont(text, i), glyphs[i].codepoint);
+        if (!glyph || (glyph->pending && !async)) {
+            missing[num_missing].font_slot = text->glyph_font ? text->glyph_font[i] : 0;
+            missing[num_missing].index = glyphs[i].codepoint;
+            num_missing++;
+        }
+    }
+
+    // each missing glyph is only rasterized once
+    qsort(missing, num_missing, sizeof(struct GB_MissingGlyph), _GB_CompareMissingGlyph);
+    for (i = 0; i < num_missing; i++) {
+        if (i == 0 || _GB_CompareMissingGlyph(missing + i, missing + i - 1) != 0) {
+            struct GB_Font *font = text->glyph_font ? text->fallback_chain->font[missing[i].font_slot] : text->font;
+            jobs[num_jobs].font = font;
+            jobs[num_jobs].index = missing[i].index;
+            jobs[num_jobs].font_index = font->index;
+            num_jobs++;
+        }
+    }
+
+    GB_ERROR gb_error = GB_ERROR_NONE;
+    if (async) {
+        // placeholders are used until the worker pool has rasterized each glyph, see GB_ContextPoll
+        for (i = 0; i < num_jobs && gb_error == GB_ERROR_NONE; i++) {
+            struct GB_Glyph *glyph = NULL;
+            struct GB_RasterJob *job = (struct GB_RasterJob*)malloc(sizeof(struct GB_RasterJob));
+            gb_error = job ? GB_GlyphMakePending(gb, jobs[i].index, jobs[i].font, &glyph) : GB_ERROR_NOMEM;
+            if (gb_error == GB_ERROR_NONE) {
+                gb_error = GB_CacheHashAdd(cache, glyph);
+                if (gb_error == GB_ERROR_NONE) {
+                    GB_FontAddGlyph(gb, jobs[i].font, glyph);
                     glyph_ptrs[num_glyph_ptrs++] = glyph;
+                    *job = jobs[i];
+                    GB_WorkerPoolQueue(gb->worker_pool, job);
+                    job = NULL;
                 }
-            } else {
-                // add glyph to context
-                GB_ContextHashAdd(gb, glyph);
+                GB_GlyphRelease(glyph);
             }
+            free(job);
         }
+    } else {
+        // rasterize in parallel if the context has worker threads.
+        gb_error = GB_WorkerPoolRasterize(gb, gb->worker_pool, jobs, num_jobs);
+
+        // the cache hash now owns the new glyphs
+        for (i = 0; i < num_jobs; i++) {
+            struct GB_Glyph *glyph = jobs[i].glyph;
+            if (!glyph)
+                continue;
+            if (gb_error == GB_ERROR_NONE) {
+                struct GB_Glyph *pending = GB_FontFindGlyph(gb, jobs[i].font, glyph->index);
+                if (pending) {
+                    GB_GlyphResolvePending(pending, glyph);
+                    glyph_ptrs[num_glyph_ptrs++] = pending;
+                } else {
+                    gb_error = GB_CacheHashAdd(cache, glyph);
+                    if (gb_error == GB_ERROR_NONE) {
+                        GB_FontAddGlyph(gb, jobs[i].font, glyph);
+
+                        // add to glyph_ptr array
+                        glyph_ptrs[num_glyph_ptrs++] = glyph;
+                    }
+                }
+            }
+            GB_GlyphRelease(glyph);
+        }
+    }
+    if (gb_error) {
+        // glyphs already added to the cache hash stay there, unused.
+        for (i = 0; i < num_glyph_ptrs; i++) {
+            if (glyph_ptrs[i]->num_users == 0 && !glyph_ptrs[i]->prev)
+                GB_CacheLRUAdd(cache, glyph_ptrs[i]);
+        }
+        return gb_error;
     }
 
-    // add glyphs to cache and context
+    // every use of a glyph is counted, even duplicates.
+    // This keeps it out of the cache lru list until the last text using it is released.
+    text->pending = 0;
+    for (i = 0; i < num_glyphs; i++) {
+        if (text->glyph_class[i] != GLYPH_CLASS_NEWLINE) {
+            struct GB_Glyph *glyph = GB_FontFindGlyph(gb, _GB_TextGlyphFont(text, i), glyphs[i].codepoint);
+            GB_ContextAddGlyphUse(gb, glyph);
+            if (glyph->pending)
+                text->pending = 1;
+        }
+    }
+
+    // add new glyphs to cache, pending glyphs are added once they are rasterized.
     GB_CacheInsert(gb, gb->cache, glyph_ptrs, num_glyph_ptrs);
-    free(glyph_ptrs);
 
     return GB_ERROR_NONE;
 }
@@ -147,33 +266,36 @@ struct GB_GlyphInfo {
 };
 
 struct GB_GlyphInfoQueue {
+    struct GB_Allocator *allocator;
     struct GB_GlyphInfo *data;
     uint32_t count;
     uint32_t capacity;
+    GB_ERROR error;  // set if a push ran out of memory
 };
 
-static void _GB_QueueMake(struct GB_GlyphInfoQueue **q_out)
+// the queue lives in the scratch arena, there is no need to destroy it.
+static GB_ERROR _GB_QueueInit(struct GB_GlyphInfoQueue *q, struct GB_Allocator *allocator, uint32_t initial_capacity)
 {
-    struct GB_GlyphInfoQueue* q = (struct GB_GlyphInfoQueue*)malloc(sizeof(struct GB_GlyphInfoQueue));
-    const uint32_t initial_capacity = 8;
-    q->data = (struct GB_GlyphInfo*)malloc(sizeof(struct GB_GlyphInfo) * initial_capacity);
+    q->allocator = allocator;
+    q->data = (struct GB_GlyphInfo*)GB_AllocatorAllocScratch(allocator, sizeof(struct GB_GlyphInfo) * initial_capacity);
     q->count = 0;
     q->capacity = initial_capacity;
-    *q_out = q;
-}
-
-static void _GB_QueueDestroy(struct GB_GlyphInfoQueue *q)
-{
-    free(q->data);
-    free(q);
+    q->error = q->data ? GB_ERROR_NONE : GB_ERROR_NOMEM;
+    return q->error;
 }
 
 static void _GB_QueuePush(struct GB_GlyphInfoQueue *q, struct GB_GlyphInfo* elem)
 {
-    // grow data if necessary
+    // grow data if necessary, the old data is reclaimed when the arena is reset.
     if (q->count == q->capacity) {
         const uint32_t new_capacity = q->capacity * 2;
-        q->data = (struct GB_GlyphInfo*)realloc(q->data, sizeof(struct GB_GlyphInfo) * new_capacity);
+        struct GB_GlyphInfo *data = (struct GB_GlyphInfo*)GB_AllocatorAllocScratch(q->allocator, sizeof(struct GB_GlyphInfo) * new_capacity);
+        if (!data) {
+            q->error = GB_ERROR_NOMEM;
+            return;
+        }
+        memcpy(data, q->data, sizeof(struct GB_GlyphInfo) * q->count);
+        q->data = data;
         q->capacity = new_capacity;
     }
 
@@ -192,12 +314,6 @@ static void _GB_QueuePushGlyph(struct GB_GlyphInfoQueue *q, enum GlyphType type,
     _GB_QueuePush(q, &info);
 }
 
-static void _GB_QueuePopBack(struct GB_GlyphInfoQueue *q)
-{
-    if (q->count > 0)
-        q->count--;
-}
-
 static void _GB_QueueDump(struct GB_GlyphInfoQueue *q, struct GB_Text* text)
 {
     static const char *s_typeToStringMap[] = {"Newline", "Space", "Normal"};
@@ -221,168 +337,174 @@ static void _GB_QueueDump(struct GB_GlyphInfoQueue *q, struct GB_Text* text)
     }
 }
 
-static uint32_t loop_begin_rtl(uint32_t num_glyphs) { return num_glyphs - 1; }
-static uint32_t loop_begin_ltr(uint32_t num_glyphs) { return 0; }
-
-static uint32_t loop_end_rtl(uint32_t num_glyphs) { return -1; }
-static uint32_t loop_end_ltr(uint32_t num_glyphs) { return num_glyphs; }
-
-static uint32_t loop_next_rtl(uint32_t i) { return i - 1; }
-static uint32_t loop_next_ltr(uint32_t i) { return i + 1; }
+// uv coordinates & texture of the glyph within the cache
+static void _GB_GlyphQuadInitTexture(struct GB_Context *gb, struct GB_GlyphQuad *quad, struct GB_Glyph *gb_glyph)
+{
+    const float texture_size = (float)gb->cache->texture_size;
+    quad->uv_origin[0] = gb_glyph->origin[0] / texture_size;
+    quad->uv_origin[1] = gb_glyph->origin[1] / texture_size;
+    quad->uv_size[0] = gb_glyph->size[0] / texture_size;
+    quad->uv_size[1] = gb_glyph->size[1] / texture_size;
+    quad->gl_tex_obj = gb_glyph->gl_tex_obj ? gb_glyph->gl_tex_obj : gb->fallback_gl_tex_obj;
+}
 
-// TODO: fix inf. loop if fit always returns false.
-static int loop_fit_ltr(int32_t pen_x, uint32_t advance, int32_t kern, uint32_t size) { return (pen_x + advance + kern) <= size; }
-static int loop_fit_rtl(int32_t pen_x, uint32_t advance, int32_t kern, uint32_t size) { return (-pen_x + advance + kern) <= size; }
+// 26.6 fixed to the nearest int, & rounded up
+#define FIXED_ROUND_TO_INT(n) (((n) + 32) >> 6)
+#define FIXED_CEIL_TO_INT(n) (((n) + 63) >> 6)
 
-static int32_t loop_advance_ltr(int32_t pen_x, uint32_t advance, int32_t kern) { return pen_x + advance + kern; }
-static int32_t loop_advance_rtl(int32_t pen_x, uint32_t advance, int32_t kern) { return pen_x - advance - kern; }
-static int32_t loop_advance_none(int32_t pen_x, uint32_t advance, int32_t kern) { return pen_x; }
+// the wrap loop is instantiated once per direction, with the direction known at compile time.
+#define GB_ALWAYS_INLINE static inline __attribute__((always_inline))
 
-typedef uint32_t (*iter_func_t)(uint32_t i);
-typedef int (*fit_func_t)(int32_t pen_x, uint32_t advance, int32_t kern, uint32_t size);
-typedef int32_t (*advance_func_t)(int32_t pen_x, uint32_t advance, int32_t kern);
+// no break opportunity on the current line
+#define NO_BREAK UINT32_MAX
 
-static GB_ERROR _GB_MakeGlyphQuadRuns(struct GB_Context *gb, struct GB_Text *text)
+// greedy word-wrap in a single pass, glyphs are visited in logical order.
+// pen is the distance from the start of the line, queued x is the left edge of each glyph: pen for ltr, -(pen + advance) for rtl.
+// A word which overflows a line with an earlier break moves to the next line once, a word which starts its line is split.
+// A word also ends after a BREAK_AFTER glyph, e.g. a hyphen, a slash or an ideograph.
+// Trailing spaces are dropped at a wrap, they do not count towards the width of the line.
+GB_ALWAYS_INLINE void _GB_WrapGlyphsDir(struct GB_GlyphInfoQueue *q, hb_glyph_info_t *glyphs, const hb_glyph_position_t *positions,
+                                        const uint8_t *glyph_class, uint32_t num_glyphs, int32_t width, const int rtl)
 {
-    // iterate over each glyph and build runs.
-    uint32_t num_glyphs = hb_buffer_get_length(text->hb_buffer);
-    hb_glyph_info_t *glyphs = hb_buffer_get_glyph_infos(text->hb_buffer, NULL);
-    hb_direction_t dir = hb_buffer_get_direction(text->hb_buffer);
-
-    // create a queue to hold word-wrapped glyphs
-    struct GB_GlyphInfoQueue *q;
-    _GB_QueueMake(&q);
-
-    fit_func_t fit;
-    advance_func_t pre_advance, post_advance;
-    iter_func_t begin, end, next, prev;
-    if (dir == HB_DIRECTION_RTL)
-    {
-        fit = loop_fit_rtl;
-        pre_advance = loop_advance_rtl;
-        post_advance = loop_advance_none;
-        begin = loop_begin_rtl;
-        end = loop_end_rtl;
-        next = loop_next_rtl;
-        prev = loop_next_ltr;
-    } else {
-        fit = loop_fit_ltr;
-        pre_advance = loop_advance_none;
-        post_advance = loop_advance_ltr;
-        begin = loop_begin_ltr;
-        end = loop_end_ltr;
-        next = loop_next_ltr;
-        prev = loop_next_rtl;
-    }
-
-    int32_t i = 0;
-    int32_t pen_x = 0;
-    uint32_t cp;
-    int32_t inside_word = 0;
-    uint32_t word_start_i = 0, word_end_i = 0;
-    int32_t word_start_x = 0, word_end_x = 0;
-    for (i = begin(num_glyphs); i != end(num_glyphs); i = next(i)) {
-        // NOTE: cluster is an offset to the first byte in the utf8 encoded string which represents this glyph.
-        utf8_next_cp(text->utf8_string + glyphs[i].cluster, &cp);
-
-        // lookup kerning
-        int32_t kern = 0;
-        if (next(i) != end(num_glyphs)) {
-            FT_Vector delta;
-            FT_Get_Kerning(text->font->ft_face, glyphs[i].codepoint, glyphs[next(i)].codepoint,
-                           FT_KERNING_DEFAULT, &delta);
-            kern = FIXED_TO_INT(delta.x);
-        }
-
-        if (is_newline(cp)) {
-            _GB_QueuePushGlyph(q, NEWLINE_GLYPH, NULL, NULL, pen_x);
-            pen_x = 0;
+    int32_t pen = 0;
+    uint32_t line_start = 0;  // queue index of the first glyph of the line
+    uint32_t break_q = NO_BREAK;  // queue index of the first space or glyph after the last word which ended on this line
+    int32_t break_pen = 0;  // pen at the end of that word
+    uint32_t word_q = 0;  // queue index of the first glyph of the current word
+    int32_t word_pen = 0;
+    int inside_word = 0, skip_spaces = 0;
+
+    uint32_t k;
+    for (k = 0; k < num_glyphs && q->error == GB_ERROR_NONE; k++) {
+        const uint32_t i = rtl ? num_glyphs - 1 - k : k;
+
+        // advances come from shaping & already include kerning, so word-wrapping does not wait for rasterization.
+        const int32_t advance = positions[i].x_advance > 0 ? positions[i].x_advance : 0;
+
+        if (glyph_class[i] == GLYPH_CLASS_NEWLINE) {
+            _GB_QueuePushGlyph(q, NEWLINE_GLYPH, NULL, NULL, rtl ? -pen : pen);
+            pen = 0;
+            line_start = q->count;
+            break_q = NO_BREAK;
             inside_word = 0;
-        } else {
-            struct GB_Glyph *glyph = GB_ContextHashFind(gb, glyphs[i].codepoint, text->font->index);
-            assert(glyph);
-
+            skip_spaces = 0;
+        } else if (glyph_class[i] == GLYPH_CLASS_SPACE) {
+            // spaces after a wrap would indent the next line
+            if (skip_spaces)
+                continue;
             if (inside_word) {
-                // does glyph fit on this line?
-                if (fit(pen_x, glyph->advance, kern, text->size[0])) {
-                    pen_x = pre_advance(pen_x, glyph->advance, kern);
-                    if (is_space(cp)) {
-                        _GB_QueuePushGlyph(q, SPACE_GLYPH, glyphs + i, glyph, pen_x);
-                        // exiting word
-                        word_end_i = i;
-                        word_end_x = pen_x;
-                        inside_word = 0;
-                    } else {
-                        _GB_QueuePushGlyph(q, NORMAL_GLYPH, glyphs + i, glyph, pen_x);
-                    }
-                    pen_x = post_advance(pen_x, glyph->advance, kern);
-                } else {
-                    if (is_space(cp)) {
-                        // skip spaces
-                        while (is_space(cp)) {
-                            i = next(i);
-                            utf8_next_cp(text->utf8_string + glyphs[i].cluster, &cp);
-                        }
-                        prev(i);
-                    } else {
-                        // if the current word starts at the beginning of the line.
-                        if (word_start_x == 0) {
-                            // we will have to split the word in the middle.
-                            i = prev(i);
-                        } else {
-                            // backtrack to one before word_start_i, and restore pen_x
-                            while (i != prev(word_start_i)) {
-                                if (dir == HB_DIRECTION_LTR)
-                                    pen_x = q->data[q->count-1].x;
-                                _GB_QueuePopBack(q);
-                                if (dir == HB_DIRECTION_RTL)
-                                    pen_x = q->data[q->count-1].x;
-                                i = prev(i);
-                            }
-                        }
-                    }
-                    _GB_QueuePushGlyph(q, NEWLINE_GLYPH, NULL, NULL, pen_x);
-                    pen_x = 0;
-                    inside_word = 0;
+                break_q = q->count;
+                break_pen = pen;
+                inside_word = 0;
+            }
+            // a glyph wider than the whole line is placed anyway.
+            if (pen + advance <= width || q->count == line_start) {
+                _GB_QueuePushGlyph(q, SPACE_GLYPH, glyphs + i, NULL, rtl ? -(pen + advance) : pen);
+                pen += advance;
+            } else {
+                if (break_q != NO_BREAK) {
+                    q->count = break_q;
+                    pen = break_pen;
                 }
-            } else { // !inside_word
-                // does glyph fit on this line?
-                if (fit(pen_x, glyph->advance, kern, text->size[0])) {
-                    pen_x = pre_advance(pen_x, glyph->advance, kern);
-                    if (is_space(cp)) {
-                        _GB_QueuePushGlyph(q, SPACE_GLYPH, glyphs + i, glyph, pen_x);
-                    } else {
-                        _GB_QueuePushGlyph(q, NORMAL_GLYPH, glyphs + i, glyph, pen_x);
-                        // entering word
-                        word_start_i = i;
-                        word_start_x = pen_x;
-                        inside_word = 1;
-                    }
-                    pen_x = post_advance(pen_x, glyph->advance, kern);
-                } else {
-                    // skip spaces
-                    while (is_space(cp)) {
-                        i = next(i);
-                        utf8_next_cp(text->utf8_string + glyphs[i].cluster, &cp);
-                    }
-                    i = prev(i); // backup one char, so the next iteration thru the loop will be a non-space character
-                    _GB_QueuePushGlyph(q, NEWLINE_GLYPH, NULL, NULL, word_end_x);
-                    pen_x = 0;
-                    inside_word = 0;
+                _GB_QueuePushGlyph(q, NEWLINE_GLYPH, NULL, NULL, rtl ? -pen : pen);
+                pen = 0;
+                line_start = q->count;
+                break_q = NO_BREAK;
+                skip_spaces = 1;
+            }
+        } else {
+            skip_spaces = 0;
+            if (!inside_word) {
+                word_q = q->count;
+                word_pen = pen;
+                inside_word = 1;
+            }
+            if (pen + advance > width && q->count != line_start) {
+                if (break_q != NO_BREAK) {
+                    // move the start of the word to the next line, dropping the spaces before it.
+                    const uint32_t num_moved = q->count - word_q;
+                    uint32_t j;
+                    memmove(q->data + break_q + 1, q->data + word_q, sizeof(struct GB_GlyphInfo) * num_moved);
+                    q->data[break_q].type = NEWLINE_GLYPH;
+                    q->data[break_q].hb_glyph = NULL;
+                    q->data[break_q].gb_glyph = NULL;
+                    q->data[break_q].x = rtl ? -break_pen : break_pen;
+                    line_start = break_q + 1;
+                    q->count = line_start + num_moved;
+                    for (j = line_start; j < q->count; j++)
+                        q->data[j].x += rtl ? word_pen : -word_pen;
+                    pen -= word_pen;
+                    word_q = line_start;
+                    word_pen = 0;
+                    break_q = NO_BREAK;
+                }
+                if (pen + advance > width && q->count != line_start) {
+                    // the word fills a whole line, split it here.
+                    _GB_QueuePushGlyph(q, NEWLINE_GLYPH, NULL, NULL, rtl ? -pen : pen);
+                    pen = 0;
+                    line_start = q->count;
+                    word_q = line_start;
+                    word_pen = 0;
                 }
             }
+            _GB_QueuePushGlyph(q, NORMAL_GLYPH, glyphs + i, NULL, rtl ? -(pen + advance) : pen);
+            pen += advance;
+
+            // the next glyph starts a new word, which may move to the next line without this one.
+            if (glyph_class[i] == GLYPH_CLASS_BREAK_AFTER) {
+                break_q = q->count;
+                break_pen = pen;
+                inside_word = 0;
+            }
         }
     }
+
     // end with a new line, (makes justification easier)
-    _GB_QueuePushGlyph(q, NEWLINE_GLYPH, NULL, NULL, pen_x);
+    _GB_QueuePushGlyph(q, NEWLINE_GLYPH, NULL, NULL, rtl ? -pen : pen);
+}
+
+// word-wrap the shaped glyphs of hb_buffer into q, which is initialized in the scratch arena.
+// glyph_class holds the class of each glyph, see _GB_TextClassifyGlyphs.
+// width & the pen position of each queued glyph are 26.6 fixed point, they are only rounded to pixels once quads are built.
+// Every line ends with a NEWLINE_GLYPH, its x is the far edge of the line. Only shaped advances are used,
+// so texts can be wrapped before their glyphs are rasterized, and measured without them, see GB_TextMeasure.
+static GB_ERROR _GB_WrapGlyphs(struct GB_Context *gb, hb_buffer_t *hb_buffer, const uint8_t *glyph_class,
+                               uint32_t width, struct GB_GlyphInfoQueue *q)
+{
+    uint32_t num_glyphs = hb_buffer_get_length(hb_buffer);
+    hb_glyph_info_t *glyphs = hb_buffer_get_glyph_infos(hb_buffer, NULL);
+    hb_glyph_position_t *positions = hb_buffer_get_glyph_positions(hb_buffer, NULL);
+
+    // room for every glyph & a new-line after each one is plenty, the queue never grows.
+    if (_GB_QueueInit(q, gb->allocator, num_glyphs * 2 + 2) != GB_ERROR_NONE)
+        return GB_ERROR_NOMEM;
+
+    if (hb_buffer_get_direction(hb_buffer) == HB_DIRECTION_RTL)
+        _GB_WrapGlyphsDir(q, glyphs, positions, glyph_class, num_glyphs, (int32_t)width, 1);
+    else
+        _GB_WrapGlyphsDir(q, glyphs, positions, glyph_class, num_glyphs, (int32_t)width, 0);
+    return q->error;
+}
+
+static GB_ERROR _GB_MakeGlyphQuadRuns(struct GB_Context *gb, struct GB_Text *text)
+{
+    uint32_t num_glyphs = hb_buffer_get_length(text->hb_buffer);
+    hb_glyph_info_t *glyphs = hb_buffer_get_glyph_infos(text->hb_buffer, NULL);
+    hb_glyph_position_t *positions = hb_buffer_get_glyph_positions(text->hb_buffer, NULL);
+    hb_direction_t dir = hb_buffer_get_direction(text->hb_buffer);
+    const uint32_t width = text->size[0] << 6;
 
-    // allocate glyph quads
-    // TODO: q->count will be slightly larger then the exact number required.
-    text->glyph_quads = (struct GB_GlyphQuad*)malloc(sizeof(struct GB_GlyphQuad) * q->count);
+    struct GB_GlyphInfoQueue queue;
+    struct GB_GlyphInfoQueue *q = &queue;
+    GB_ERROR ret = _GB_WrapGlyphs(gb, text->hb_buffer, text->glyph_class, width, q);
+    if (ret != GB_ERROR_NONE)
+        return ret;
+    uint32_t i;
+
+    // glyph quads were allocated along with the text, with room for every glyph.
     text->num_glyph_quads = 0;
 
-    const float texture_size = (float)gb->cache->texture_size;
-    int32_t line_height = FIXED_TO_INT(text->font->ft_face->size->metrics.height);
+    int32_t line_height = FIXED_TO_INT(text->font->ft_size->metrics.height);
     int32_t y = text->origin[1] + line_height;
 
     /*
@@ -403,10 +525,10 @@ static GB_ERROR _GB_MakeGlyphQuadRuns(struct GB_Context *gb, struct GB_Text *tex
                 offset = -left_edge;
                 break;
             case GB_HORIZONTAL_ALIGN_RIGHT:
-                offset = text->size[0] - right_edge;
+                offset = width - right_edge;
                 break;
             case GB_HORIZONTAL_ALIGN_CENTER:
-                offset = (text->size[0] - left_edge - right_edge) / 2;
+                offset = ((int32_t)width - left_edge - right_edge) / 2;
                 break;
             }
             // apply offset to each glyphinfo.x
@@ -424,42 +546,599 @@ static GB_ERROR _GB_MakeGlyphQuadRuns(struct GB_Context *gb, struct GB_Text *tex
         } else {
             // NOTE: y axis points down, quad origin is upper-left corner of glyph
             // build quad
-            struct GB_Glyph *gb_glyph = q->data[i].gb_glyph;
+            // marks & other glyphs positioned by shaping are offset from the pen, y up.
+            const uint32_t glyph_i = q->data[i].hb_glyph - glyphs;
+            struct GB_Glyph *gb_glyph = GB_FontFindGlyph(gb, _GB_TextGlyphFont(text, glyph_i), glyphs[glyph_i].codepoint);
+            const hb_glyph_position_t *position = positions + glyph_i;
+            assert(gb_glyph);
+            q->data[i].gb_glyph = gb_glyph;
+            assert(text->num_glyph_quads < num_glyphs);
             struct GB_GlyphQuad *quad = text->glyph_quads + text->num_glyph_quads;
-            quad->pen[0] = text->origin[0] + q->data[i].x;
+            quad->pen[0] = text->origin[0] + FIXED_ROUND_TO_INT(q->data[i].x);
             quad->pen[1] = y;
-            quad->origin[0] = text->origin[0] + q->data[i].x + gb_glyph->bearing[0];
-            quad->origin[1] = y - gb_glyph->bearing[1];
+            quad->origin[0] = text->origin[0] + FIXED_ROUND_TO_INT(q->data[i].x + position->x_offset) + gb_glyph->bearing[0];
+            quad->origin[1] = y - FIXED_ROUND_TO_INT(position->y_offset) - gb_glyph->bearing[1];
             quad->size[0] = gb_glyph->size[0];
             quad->size[1] = gb_glyph->size[1];
-            quad->uv_origin[0] = gb_glyph->origin[0] / texture_size;
-            quad->uv_origin[1] = gb_glyph->origin[1] / texture_size;
-            quad->uv_size[0] = gb_glyph->size[0] / texture_size;
-            quad->uv_size[1] = gb_glyph->size[1] / texture_size;
             quad->user_data = text->user_data;
-            quad->gl_tex_obj = gb_glyph->gl_tex_obj ? gb_glyph->gl_tex_obj : gb->fallback_gl_tex_obj;
+            _GB_GlyphQuadInitTexture(gb, quad, gb_glyph);
+            text->glyph_quad_glyphs[text->num_glyph_quads] = gb_glyph;
             text->num_glyph_quads++;
         }
     }
 
-    _GB_QueueDestroy(q);
-
     return GB_ERROR_NONE;
 }
 
-static void ft_shape(hb_font_t *hb_font, hb_buffer_t *hb_buffer, FT_Face ft_face, uint8_t* utf8_string)
+static void ft_shape(struct GB_Context *gb, struct GB_Font *font, hb_buffer_t *hb_buffer, const uint8_t* utf8_string)
 {
-    assert(hb_font && hb_buffer && ft_face);
+    assert(font && hb_buffer && font->ft_face);
     int num_glyphs = hb_buffer_get_length(hb_buffer);
     hb_glyph_info_t *glyphs = hb_buffer_get_glyph_infos(hb_buffer, NULL);
+    hb_glyph_position_t *positions = hb_buffer_get_glyph_positions(hb_buffer, NULL);
 
     // iterate over each glyph
     int i;
     for (i = 0; i < num_glyphs; i++) {
         uint32_t cp;
         utf8_next_cp(utf8_string + glyphs[i].cluster, &cp);
-        glyphs[i].codepoint = FT_Get_Char_Index(ft_face, cp);
+        glyphs[i].codepoint = FT_Get_Char_Index(font->ft_face, cp);
+    }
+
+    // fill in positions like hb_shape would, with the kerning of each pair added to the advance of the first glyph.
+    for (i = 0; i < num_glyphs; i++) {
+        int32_t advance = 0;
+        GB_GlyphGetAdvance(gb, glyphs[i].codepoint, font, &advance);
+        memset(positions + i, 0, sizeof(hb_glyph_position_t));
+        positions[i].x_advance = advance;
+        if (i + 1 < num_glyphs)
+            positions[i].x_advance += GB_FontGetKerning(font, glyphs[i].codepoint, glyphs[i + 1].codepoint);
+    }
+}
+
+// append num_glyphs shaped glyphs to hb_buffer, cluster_offset is added to each cluster.
+static GB_ERROR _GB_TextAppendGlyphs(hb_buffer_t *hb_buffer, const hb_glyph_info_t *info, const hb_glyph_position_t *position,
+                                     uint32_t num_glyphs, uint32_t cluster_offset)
+{
+    const uint32_t start = hb_buffer_get_length(hb_buffer);
+    if (!hb_buffer_set_length(hb_buffer, start + num_glyphs))
+        return GB_ERROR_NOMEM;
+    hb_glyph_info_t *dst_info = hb_buffer_get_glyph_infos(hb_buffer, NULL) + start;
+    memcpy(dst_info, info, sizeof(hb_glyph_info_t) * num_glyphs);
+    memcpy(hb_buffer_get_glyph_positions(hb_buffer, NULL) + start, position, sizeof(hb_glyph_position_t) * num_glyphs);
+    uint32_t i;
+    for (i = 0; cluster_offset && i < num_glyphs; i++)
+        dst_info[i].cluster += cluster_offset;
+    return GB_ERROR_NONE;
+}
+
+// shaping can restart between a run of spaces & a word, unless the word starts with
+// a mark or joiner which belongs with the space before it.
+static int _GB_TextIsSegmentStart(const uint8_t *utf8_string, uint32_t offset)
+{
+    const int space_before = utf8_string[offset - 1] == ' ';
+    if (space_before == (utf8_string[offset] == ' '))
+        return 0;
+    uint32_t cp;
+    utf8_next_cp(utf8_string + offset, &cp);
+    return !space_before || !GB_IsClusterContinuation(cp);
+}
+
+// shape a run a segment at a time, each word & each run of spaces is looked up in the context shape cache.
+// run_buffer holds the run, its script & language apply to every segment.
+static GB_ERROR _GB_TextShapeSegments(struct GB_Context *gb, struct GB_Font *font, const uint8_t *utf8_string,
+                                      uint32_t offset, uint32_t length, hb_buffer_t *hb_buffer, hb_buffer_t *run_buffer)
+{
+    struct GB_ShapeKey key;
+    key.font_index = font->index;
+    key.script = hb_buffer_get_script(run_buffer);
+    key.direction = hb_buffer_get_direction(run_buffer);
+    key.language = hb_buffer_get_language(run_buffer);
+
+    // start of each segment in logical order, followed by the end of the run.
+    uint32_t *segment = (uint32_t*)GB_AllocatorAllocScratch(gb->allocator, sizeof(uint32_t) * (length + 1));
+    if (!segment)
+        return GB_ERROR_NOMEM;
+    uint32_t i, num_segments = 0;
+    segment[num_segments++] = offset;
+    for (i = offset + 1; i < offset + length; i++) {
+        if (_GB_TextIsSegmentStart(utf8_string, i))
+            segment[num_segments++] = i;
+    }
+    segment[num_segments] = offset + length;
+
+    // segments are appended in visual order, like runs.
+    uint32_t k;
+    for (k = 0; k < num_segments; k++) {
+        const uint32_t j = key.direction == HB_DIRECTION_RTL ? num_segments - 1 - k : k;
+        key.bytes = utf8_string + segment[j];
+        key.length = segment[j + 1] - segment[j];
+        const int cacheable = key.length <= GB_SHAPE_CACHE_MAX_SEGMENT_LENGTH;
+        const struct GB_ShapeCacheEntry *entry = cacheable ? GB_ShapeCacheFind(gb->shape_cache, &key) : NULL;
+
+        GB_ERROR ret;
+        if (entry) {
+            ret = _GB_TextAppendGlyphs(hb_buffer, entry->info, entry->position, entry->num_glyphs, segment[j]);
+        } else {
+            hb_buffer_clear_contents(run_buffer);
+            hb_buffer_add_utf8(run_buffer, (const char*)key.bytes, key.length, 0, key.length);
+            hb_buffer_set_direction(run_buffer, key.direction);
+            hb_buffer_set_script(run_buffer, key.script);
+            hb_buffer_set_language(run_buffer, key.language);
+            hb_shape(font->hb_font, run_buffer, NULL, 0);
+
+            const uint32_t num_glyphs = hb_buffer_get_length(run_buffer);
+            const hb_glyph_info_t *info = hb_buffer_get_glyph_infos(run_buffer, NULL);
+            const hb_glyph_position_t *position = hb_buffer_get_glyph_positions(run_buffer, NULL);
+
+            // if the cache is out of memory, the segment is just shaped again next time.
+            if (cacheable)
+                GB_ShapeCacheAdd(gb->shape_cache, &key, info, position, num_glyphs);
+            ret = _GB_TextAppendGlyphs(hb_buffer, info, position, num_glyphs, segment[j]);
+        }
+        if (ret != GB_ERROR_NONE)
+            return ret;
+    }
+    return GB_ERROR_NONE;
+}
+
+// shape length bytes of utf8_string from offset with font in direction dir, appending the glyphs to hb_buffer.
+// clusters stay offsets into the whole string. run_buffer is used for shaping.
+static GB_ERROR _GB_TextShapeRun(struct GB_Context *gb, struct GB_Font *font, const uint8_t *utf8_string,
+                                 uint32_t utf8_string_len, uint32_t offset, uint32_t length, hb_direction_t dir,
+                                 uint32_t option_flags, hb_buffer_t *hb_buffer, hb_buffer_t *run_buffer)
+{
+    hb_buffer_clear_contents(run_buffer);
+    hb_buffer_add_utf8(run_buffer, (const char*)utf8_string, utf8_string_len, offset, length);
+    hb_buffer_set_direction(run_buffer, dir);
+    hb_buffer_guess_segment_properties(run_buffer);
+    if (option_flags & GB_TEXT_OPTION_DISABLE_SHAPING)
+        ft_shape(gb, font, run_buffer, utf8_string);
+    else if (gb->shape_cache)
+        return _GB_TextShapeSegments(gb, font, utf8_string, offset, length, hb_buffer, run_buffer);
+    else
+        hb_shape(font->hb_font, run_buffer, NULL, 0);
+
+    return _GB_TextAppendGlyphs(hb_buffer, hb_buffer_get_glyph_infos(run_buffer, NULL),
+                                hb_buffer_get_glyph_positions(run_buffer, NULL), hb_buffer_get_length(run_buffer), 0);
+}
+
+// empties hb_buffer, leaving it set to the direction of the whole string.
+static hb_direction_t _GB_TextGuessDirection(hb_buffer_t *hb_buffer, const uint8_t *utf8_string, uint32_t utf8_string_len)
+{
+    hb_buffer_add_utf8(hb_buffer, (const char*)utf8_string, utf8_string_len, 0, utf8_string_len);
+    hb_buffer_guess_segment_properties(hb_buffer);
+    hb_direction_t dir = hb_buffer_get_direction(hb_buffer);
+    hb_buffer_clear_contents(hb_buffer);
+    hb_buffer_set_direction(hb_buffer, dir);
+    return dir;
+}
+
+// shape each run of the fallback chain with its own font, into a single buffer.
+// runs are shaped in the direction of the whole string and appended in visual order.
+// glyph_font_out is set to the chain index of each glyph's font, in the scratch arena.
+static GB_ERROR _GB_TextShapeRuns(struct GB_Context *gb, const uint8_t *utf8_string, uint32_t utf8_string_len,
+                                  struct GB_FontFallbackChain *chain, uint32_t option_flags,
+                                  hb_buffer_t *hb_buffer, uint8_t **glyph_font_out)
+{
+    uint32_t num_runs = 0;
+    GB_FontFallbackChainItemize(gb, chain, utf8_string, utf8_string_len, NULL, 0, &num_runs);
+    struct GB_FontRun *runs = (struct GB_FontRun*)GB_AllocatorAllocScratch(gb->allocator, sizeof(struct GB_FontRun) * (num_runs + 1));
+    uint32_t capacity = utf8_string_len + 16;
+    uint8_t *glyph_font = (uint8_t*)GB_AllocatorAllocScratch(gb->allocator, capacity);
+    hb_buffer_t *run_buffer = hb_buffer_create();
+    if (!runs || !glyph_font || !run_buffer) {
+        hb_buffer_destroy(run_buffer);
+        return GB_ERROR_NOMEM;
+    }
+    GB_FontFallbackChainItemize(gb, chain, utf8_string, utf8_string_len, runs, num_runs, &num_runs);
+
+    hb_direction_t dir = _GB_TextGuessDirection(hb_buffer, utf8_string, utf8_string_len);
+
+    uint32_t k, num_glyphs = 0;
+    for (k = 0; k < num_runs; k++) {
+        const struct GB_FontRun *run = runs + (dir == HB_DIRECTION_RTL ? num_runs - 1 - k : k);
+        GB_ERROR ret = _GB_TextShapeRun(gb, chain->font[run->font_index], utf8_string, utf8_string_len,
+                                        run->offset, run->length, dir, option_flags, hb_buffer, run_buffer);
+        if (ret != GB_ERROR_NONE) {
+            hb_buffer_destroy(run_buffer);
+            return ret;
+        }
+
+        uint32_t num_run_glyphs = hb_buffer_get_length(hb_buffer) - num_glyphs;
+        if (num_glyphs + num_run_glyphs > capacity) {
+            // shaping made more glyphs than there are bytes, the old array is reclaimed with the arena.
+            capacity = (num_glyphs + num_run_glyphs) * 2;
+            uint8_t *new_glyph_font = (uint8_t*)GB_AllocatorAllocScratch(gb->allocator, capacity);
+            if (!new_glyph_font) {
+                hb_buffer_destroy(run_buffer);
+                return GB_ERROR_NOMEM;
+            }
+            memcpy(new_glyph_font, glyph_font, num_glyphs);
+            glyph_font = new_glyph_font;
+        }
+        memset(glyph_font + num_glyphs, (int)run->font_index, num_run_glyphs);
+        num_glyphs += num_run_glyphs;
+    }
+    hb_buffer_destroy(run_buffer);
+
+    *glyph_font_out = glyph_font;
+    return GB_ERROR_NONE;
+}
+
+// shape utf8_string into hb_buffer, with font or each run with the first font of chain which covers it.
+// with a chain, glyph_font_out is set to the chain index of each glyph's font, in the scratch arena.
+static GB_ERROR _GB_TextShape(struct GB_Context *gb, const uint8_t *utf8_string, uint32_t utf8_string_len,
+                              struct GB_Font *font, struct GB_FontFallbackChain *chain, uint32_t option_flags,
+                              hb_buffer_t *hb_buffer, uint8_t **glyph_font_out)
+{
+    *glyph_font_out = NULL;
+    if (chain) {
+        // each run is shaped with the first font of the chain which covers it
+        return _GB_TextShapeRuns(gb, utf8_string, utf8_string_len, chain, option_flags, hb_buffer, glyph_font_out);
+    } else if (gb->shape_cache && !(option_flags & GB_TEXT_OPTION_DISABLE_SHAPING)) {
+        // a single run, shaped a word at a time
+        hb_buffer_t *run_buffer = hb_buffer_create();
+        if (!run_buffer)
+            return GB_ERROR_NOMEM;
+        hb_direction_t dir = _GB_TextGuessDirection(hb_buffer, utf8_string, utf8_string_len);
+        GB_ERROR ret = _GB_TextShapeRun(gb, font, utf8_string, utf8_string_len, 0, utf8_string_len,
+                                        dir, option_flags, hb_buffer, run_buffer);
+        hb_buffer_destroy(run_buffer);
+        return ret;
+    } else if (!(option_flags & GB_TEXT_OPTION_DISABLE_SHAPING)) {
+        hb_buffer_add_utf8(hb_buffer, (const char*)utf8_string, utf8_string_len, 0, utf8_string_len);
+
+        // Use harf-buzz to perform glyph shaping
+        hb_shape(font->hb_font, hb_buffer, NULL, 0);
+
+        // debug print detected direction & script
+        //hb_direction_t dir = hb_buffer_get_direction(hb_buffer);
+        hb_script_t script = hb_buffer_get_script(hb_buffer);
+        hb_tag_t tag = hb_script_to_iso15924_tag(script);
+        //printf("AJT: direction = %s\n", hb_direction_to_string(dir));
+        char tag_str[5];
+        tag_str[0] = tag >> 24;
+        tag_str[1] = tag >> 16;
+        tag_str[2] = tag >> 8;
+        tag_str[3] = tag;
+        tag_str[4] = 0;
+        //printf("AJT: script = %s\n", tag_str);
+    } else {
+        hb_buffer_add_utf8(hb_buffer, (const char*)utf8_string, utf8_string_len, 0, utf8_string_len);
+
+        // TODO: need a compile time option to remove dependency on harf-buzz
+        // just use FT_Get_Char_Index to look up glyph index
+        ft_shape(gb, font, hb_buffer, utf8_string);
+    }
+    return GB_ERROR_NONE;
+}
+
+// a glyph use held by a compact text, see GB_Text glyph_keys.
+// laid out like a glyph cache key, the font slot is above any 32 bit glyph index.
+#define GLYPH_KEY(font_slot, index) (((uint64_t)(font_slot) << 32) | (uint32_t)(index))
+#define GLYPH_KEY_FONT_SLOT(key) ((uint32_t)((key) >> 32))
+#define GLYPH_KEY_INDEX(key) ((uint32_t)(key))
+
+// move a laid out text into an allocation which only fits its quads & the glyphs it uses.
+// the shaped glyphs & the string are dropped, except for the string of an interned layout, which is its key.
+// returns text unchanged if out of memory.
+static struct GB_Text *_GB_TextCompact(struct GB_Context *gb, struct GB_Text *text)
+{
+    const uint32_t num_glyphs = hb_buffer_get_length(text->hb_buffer);
+    hb_glyph_info_t *glyphs = hb_buffer_get_glyph_infos(text->hb_buffer, NULL);
+    uint32_t num_glyph_keys = 0;
+    uint32_t i;
+    for (i = 0; i < num_glyphs; i++) {
+        if (text->glyph_class[i] != GLYPH_CLASS_NEWLINE)
+            num_glyph_keys++;
+    }
+
+    const size_t string_len = (text->option_flags & GB_TEXT_OPTION_INTERN) ? text->utf8_string_len + 1 : 0;
+    const size_t quads_offset = sizeof(struct GB_Text);
+    const size_t quad_glyphs_offset = quads_offset + sizeof(struct GB_GlyphQuad) * text->num_glyph_quads;
+    const size_t glyph_keys_offset = quad_glyphs_offset + sizeof(struct GB_Glyph*) * text->num_glyph_quads;
+    const size_t string_offset = glyph_keys_offset + sizeof(uint64_t) * num_glyph_keys;
+    uint8_t *block = (uint8_t*)GB_AllocatorMalloc(gb->allocator, string_offset + string_len);
+    if (!block)
+        return text;
+
+    struct GB_Text *compact = (struct GB_Text*)block;
+    *compact = *text;
+    compact->glyph_quads = (struct GB_GlyphQuad*)(block + quads_offset);
+    memcpy(compact->glyph_quads, text->glyph_quads, sizeof(struct GB_GlyphQuad) * text->num_glyph_quads);
+    compact->glyph_quad_glyphs = (struct GB_Glyph**)(block + quad_glyphs_offset);
+    memcpy(compact->glyph_quad_glyphs, text->glyph_quad_glyphs, sizeof(struct GB_Glyph*) * text->num_glyph_quads);
+
+    // the same glyph uses _GB_TextUpdateCache counted, so _GB_TextDestroy can remove them.
+    compact->glyph_keys = (uint64_t*)(block + glyph_keys_offset);
+    compact->num_glyph_keys = 0;
+    for (i = 0; i < num_glyphs; i++) {
+        if (text->glyph_class[i] != GLYPH_CLASS_NEWLINE) {
+            compact->glyph_keys[compact->num_glyph_keys++] = GLYPH_KEY(text->glyph_font ? text->glyph_font[i] : 0, glyphs[i].codepoint);
+        }
     }
+
+    compact->utf8_string = NULL;
+    if (string_len) {
+        compact->utf8_string = block + string_offset;
+        memcpy(compact->utf8_string, text->utf8_string, string_len);
+    }
+    compact->glyph_class = NULL;
+    compact->glyph_font = NULL;
+    compact->hb_buffer = NULL;
+    hb_buffer_destroy(text->hb_buffer);
+
+    DL_DELETE(gb->text_list, text);
+    DL_PREPEND(gb->text_list, compact);
+    GB_AllocatorFree(gb->allocator, text);
+    return compact;
+}
+
+static GB_ERROR _GB_TextMake(struct GB_Context *gb, const uint8_t *utf8_string,
+                             struct GB_Font *font, struct GB_FontFallbackChain *chain, void *user_data, uint32_t origin[2],
+                             uint32_t size[2], GB_HORIZONTAL_ALIGN horizontal_align,
+                             GB_VERTICAL_ALIGN vertical_align, uint32_t option_flags, struct GB_Text **text_out)
+{
+    // create harfbuzz buffer
+    size_t utf8_string_len = strlen((const char*)utf8_string);
+    hb_buffer_t *hb_buffer = hb_buffer_create();
+    uint8_t *glyph_font = NULL;
+    GB_ERROR ret = _GB_TextShape(gb, utf8_string, utf8_string_len, font, chain, option_flags, hb_buffer, &glyph_font);
+    if (ret != GB_ERROR_NONE) {
+        GB_AllocatorResetScratch(gb->allocator);
+        hb_buffer_destroy(hb_buffer);
+        return ret;
+    }
+
+    // the text, its quads, the class & font of each glyph & its copy of the string share a single allocation.
+    // there is a quad for every glyph at most, so it never needs to grow when the text is laid out again.
+    const uint32_t num_glyphs = hb_buffer_get_length(hb_buffer);
+    const size_t quads_offset = sizeof(struct GB_Text);
+    const size_t quad_glyphs_offset = quads_offset + sizeof(struct GB_GlyphQuad) * num_glyphs;
+    const size_t glyph_class_offset = quad_glyphs_offset + sizeof(struct GB_Glyph*) * num_glyphs;
+    const size_t glyph_font_offset = glyph_class_offset + num_glyphs;
+    const size_t string_offset = glyph_font_offset + (glyph_font ? num_glyphs : 0);
+    uint8_t *block = (uint8_t*)GB_AllocatorMalloc(gb->allocator, string_offset + utf8_string_len + 1);
+    if (!block) {
+        GB_AllocatorResetScratch(gb->allocator);
+        hb_buffer_destroy(hb_buffer);
+        return GB_ERROR_NOMEM;
+    }
+
+    struct GB_Text *text = (struct GB_Text*)block;
+    memset(text, 0, sizeof(struct GB_Text));
+    text->rc = 1;
+
+    // reference font & chain
+    text->font = font;
+    GB_FontRetain(gb, font);
+    if (chain) {
+        text->fallback_chain = chain;
+        GB_FontFallbackChainRetain(gb, chain);
+        text->glyph_font = block + glyph_font_offset;
+        memcpy(text->glyph_font, glyph_font, num_glyphs);
+    }
+
+    // copy utf8 string
+    text->utf8_string = block + string_offset;
+    memcpy(text->utf8_string, utf8_string, utf8_string_len + 1);
+
+    // classified once, every later wrap of the text reads the classes.
+    text->glyph_class = block + glyph_class_offset;
+    _GB_TextClassifyGlyphs(hb_buffer, text->utf8_string, text->glyph_class);
+    text->utf8_string_len = utf8_string_len;
+    text->hb_buffer = hb_buffer;
+
+    text->user_data = user_data;
+    text->origin[0] = origin[0];
+    text->origin[1] = origin[1];
+    text->size[0] = size[0];
+    text->size[1] = size[1];
+    text->horizontal_align = horizontal_align;
+    text->vertical_align = vertical_align;
+    text->option_flags = option_flags;
+    text->glyph_quads = (struct GB_GlyphQuad*)(block + quads_offset);
+    text->glyph_quad_glyphs = (struct GB_Glyph**)(block + quad_glyphs_offset);
+    text->num_glyph_quads = 0;
+
+    // Insert new glyphs into cache
+    // This is where glyph rasterization occurs.
+    ret = _GB_TextUpdateCache(gb, text);
+    if (ret != GB_ERROR_NONE) {
+        // no glyph uses were counted, see _GB_TextUpdateCache
+        GB_AllocatorResetScratch(gb->allocator);
+        hb_buffer_destroy(text->hb_buffer);
+        GB_FontRelease(gb, text->font);
+        if (text->fallback_chain)
+            GB_FontFallbackChainRelease(gb, text->fallback_chain);
+        GB_AllocatorFree(gb->allocator, text);
+        return ret;
+    }
+
+    // keep track of text, so its quads can be updated when glyphs move within the cache.
+    DL_PREPEND(gb->text_list, text);
+
+    // Build array of GlyphQuadRuns, one for each line.
+    // This is where word-wrapping and justification occurs.
+    ret = _GB_MakeGlyphQuadRuns(gb, text);
+    GB_AllocatorResetScratch(gb->allocator);
+    if (ret != GB_ERROR_NONE) {
+        // user_data stays with the caller, like on any other failure.
+        text->user_data = NULL;
+        GB_TextRelease(gb, text);
+        return ret;
+    }
+
+    // pending texts are wrapped again when their glyphs arrive, so they keep their shaped glyphs.
+    if ((option_flags & GB_TEXT_OPTION_COMPACT) && !(option_flags & GB_TEXT_OPTION_ASYNC))
+        text = _GB_TextCompact(gb, text);
+
+    *text_out = text;
+    return GB_ERROR_NONE;
+}
+
+// every input of a layout except the origin.
+static uint64_t _GB_TextInternHash(const uint8_t *utf8_string, size_t utf8_string_len, struct GB_Font *font,
+                                   struct GB_FontFallbackChain *chain, uint32_t size[2], GB_HORIZONTAL_ALIGN horizontal_align,
+                                   GB_VERTICAL_ALIGN vertical_align, uint32_t option_flags)
+{
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    size_t i;
+    for (i = 0; i < utf8_string_len; i++) {
+        hash ^= utf8_string[i];
+        hash *= 0x100000001b3ULL;
+    }
+    const uint64_t params[] = {(uint64_t)(uintptr_t)font, (uint64_t)(uintptr_t)chain, ((uint64_t)size[0] << 32) | size[1],
+                               ((uint64_t)horizontal_align << 32) | vertical_align, option_flags};
+    for (i = 0; i < sizeof(params) / sizeof(params[0]); i++) {
+        hash ^= params[i];
+        hash *= 0x9e3779b97f4a7c15ULL;
+    }
+    return hash ^ (hash >> 29);
+}
+
+static struct GB_Text **_GB_TextInternBucket(struct GB_Context *gb, uint64_t hash)
+{
+    return gb->intern_table + (hash & (gb->intern_capacity - 1));
+}
+
+static void _GB_TextRemoveLayout(struct GB_Context *gb, struct GB_Text *layout)
+{
+    if (!gb->intern_table)
+        return;
+    struct GB_Text **link = _GB_TextInternBucket(gb, layout->intern_hash);
+    while (*link && *link != layout)
+        link = &(*link)->intern_next;
+    if (*link) {
+        *link = layout->intern_next;
+        gb->num_interned--;
+    }
+}
+
+static GB_ERROR _GB_TextAddLayout(struct GB_Context *gb, struct GB_Text *layout)
+{
+    // about one layout per bucket, the table doubles as it fills.
+    if (gb->num_interned >= gb->intern_capacity) {
+        const uint32_t capacity = gb->intern_capacity ? gb->intern_capacity * 2 : 64;
+        struct GB_Text **table = (struct GB_Text**)calloc(capacity, sizeof(struct GB_Text*));
+        if (!table)
+            return GB_ERROR_NOMEM;
+        uint32_t i;
+        for (i = 0; i < gb->intern_capacity; i++) {
+            struct GB_Text *text = gb->intern_table[i];
+            while (text) {
+                struct GB_Text *next = text->intern_next;
+                text->intern_next = table[text->intern_hash & (capacity - 1)];
+                table[text->intern_hash & (capacity - 1)] = text;
+                text = next;
+            }
+        }
+        free(gb->intern_table);
+        gb->intern_table = table;
+        gb->intern_capacity = capacity;
+    }
+
+    struct GB_Text **bucket = _GB_TextInternBucket(gb, layout->intern_hash);
+    layout->intern_next = *bucket;
+    *bucket = layout;
+    gb->num_interned++;
+    return GB_ERROR_NONE;
+}
+
+// find the shared layout of a string, or lay it out at the origin and share it. layout_out is retained.
+static GB_ERROR _GB_TextInternLayout(struct GB_Context *gb, const uint8_t *utf8_string, struct GB_Font *font,
+                                     struct GB_FontFallbackChain *chain, uint32_t size[2], GB_HORIZONTAL_ALIGN horizontal_align,
+                                     GB_VERTICAL_ALIGN vertical_align, uint32_t option_flags, struct GB_Text **layout_out)
+{
+    const size_t utf8_string_len = strlen((const char*)utf8_string);
+    const uint64_t hash = _GB_TextInternHash(utf8_string, utf8_string_len, font, chain, size,
+                                             horizontal_align, vertical_align, option_flags);
+    struct GB_Text *layout = gb->intern_table ? *_GB_TextInternBucket(gb, hash) : NULL;
+    for (; layout; layout = layout->intern_next) {
+        if (layout->intern_hash == hash && layout->font == font && layout->fallback_chain == chain &&
+            layout->size[0] == size[0] && layout->size[1] == size[1] &&
+            layout->horizontal_align == horizontal_align && layout->vertical_align == vertical_align &&
+            layout->option_flags == option_flags && layout->utf8_string_len == utf8_string_len &&
+            memcmp(layout->utf8_string, utf8_string, utf8_string_len) == 0) {
+            layout->rc++;
+            *layout_out = layout;
+            return GB_ERROR_NONE;
+        }
+    }
+
+    uint32_t origin[2] = {0, 0};
+    GB_ERROR ret = _GB_TextMake(gb, utf8_string, font, chain, NULL, origin, size, horizontal_align, vertical_align,
+                                option_flags, &layout);
+    if (ret != GB_ERROR_NONE)
+        return ret;
+    layout->intern_hash = hash;
+    ret = _GB_TextAddLayout(gb, layout);
+    if (ret != GB_ERROR_NONE) {
+        GB_TextRelease(gb, layout);
+        return ret;
+    }
+    *layout_out = layout;
+    return GB_ERROR_NONE;
+}
+
+// point text at layout, keeping its own reference count, origin & user_data.
+static void _GB_TextShareLayout(struct GB_Text *text, struct GB_Text *layout)
+{
+    const int32_t rc = text->rc;
+    void *user_data = text->user_data;
+    const uint32_t origin[2] = {text->origin[0], text->origin[1]};
+    *text = *layout;
+    text->rc = rc;
+    text->user_data = user_data;
+    text->origin[0] = origin[0];
+    text->origin[1] = origin[1];
+    text->layout = layout;
+    text->intern_next = NULL;
+    text->prev = NULL;
+    text->next = NULL;
+}
+
+static GB_ERROR _GB_TextMakeInterned(struct GB_Context *gb, const uint8_t *utf8_string,
+                                     struct GB_Font *font, struct GB_FontFallbackChain *chain, void *user_data, uint32_t origin[2],
+                                     uint32_t size[2], GB_HORIZONTAL_ALIGN horizontal_align,
+                                     GB_VERTICAL_ALIGN vertical_align, uint32_t option_flags, struct GB_Text **text_out)
+{
+    struct GB_Text *layout = NULL;
+    GB_ERROR ret = _GB_TextInternLayout(gb, utf8_string, font, chain, size, horizontal_align, vertical_align,
+                                        option_flags, &layout);
+    if (ret != GB_ERROR_NONE)
+        return ret;
+
+    struct GB_Text *text = (struct GB_Text*)GB_AllocatorMalloc(gb->allocator, sizeof(struct GB_Text));
+    if (!text) {
+        GB_TextRelease(gb, layout);
+        return GB_ERROR_NOMEM;
+    }
+    memset(text, 0, sizeof(struct GB_Text));
+    text->rc = 1;
+    text->user_data = user_data;
+    text->origin[0] = origin[0];
+    text->origin[1] = origin[1];
+    _GB_TextShareLayout(text, layout);
+
+    *text_out = text;
+    return GB_ERROR_NONE;
+}
+
+// an interned text changes size or alignment, it moves to the layout of its new parameters.
+static GB_ERROR _GB_TextReintern(struct GB_Context *gb, struct GB_Text *text, uint32_t size[2],
+                                 GB_HORIZONTAL_ALIGN horizontal_align, GB_VERTICAL_ALIGN vertical_align)
+{
+    struct GB_Text *old_layout = text->layout;
+    struct GB_Text *layout = NULL;
+    GB_ERROR ret = _GB_TextInternLayout(gb, old_layout->utf8_string, old_layout->font, old_layout->fallback_chain, size,
+                                        horizontal_align, vertical_align, old_layout->option_flags, &layout);
+    if (ret != GB_ERROR_NONE)
+        return ret;
+    _GB_TextShareLayout(text, layout);
+    GB_TextRelease(gb, old_layout);
+    return GB_ERROR_NONE;
 }
 
 GB_ERROR GB_TextMake(struct GB_Context *gb, const uint8_t *utf8_string,
@@ -468,77 +1147,224 @@ GB_ERROR GB_TextMake(struct GB_Context *gb, const uint8_t *utf8_string,
                      GB_VERTICAL_ALIGN vertical_align, uint32_t option_flags, struct GB_Text **text_out)
 {
     if (gb && utf8_string && font && font->hb_font && text_out) {
-        struct GB_Text *text = (struct GB_Text*)malloc(sizeof(struct GB_Text));
-        if (text) {
-            memset(text, 0, sizeof(struct GB_Text));
-            text->rc = 1;
-
-            // reference font
-            text->font = font;
-            GB_FontRetain(gb, font);
-
-            // allocate and copy utf8 string
-            size_t utf8_string_len = strlen((const char*)utf8_string);
-            text->utf8_string = (uint8_t*)malloc(sizeof(char) * utf8_string_len + 1);
-            strcpy((char*)text->utf8_string, (const char*)utf8_string);
-            text->utf8_string_len = utf8_string_len;
-
-            // create harfbuzz buffer
-            text->hb_buffer = hb_buffer_create();
-            hb_buffer_add_utf8(text->hb_buffer, (const char*)text->utf8_string,
-                               text->utf8_string_len, 0, text->utf8_string_len);
-
-            text->user_data = user_data;
-            text->origin[0] = origin[0];
-            text->origin[1] = origin[1];
-            text->size[0] = size[0];
-            text->size[1] = size[1];
-            text->horizontal_align = horizontal_align;
-            text->vertical_align = vertical_align;
-            text->option_flags = option_flags;
-            text->glyph_quads = NULL;
-            text->num_glyph_quads = 0;
-
-            if (!(option_flags & GB_TEXT_OPTION_DISABLE_SHAPING))
-            {
-                // Use harf-buzz to perform glyph shaping
-                hb_shape(text->font->hb_font, text->hb_buffer, NULL, 0);
-
-                // debug print detected direction & script
-                //hb_direction_t dir = hb_buffer_get_direction(text->hb_buffer);
-                hb_script_t script = hb_buffer_get_script(text->hb_buffer);
-                hb_tag_t tag = hb_script_to_iso15924_tag(script);
-                //printf("AJT: direction = %s\n", hb_direction_to_string(dir));
-                char tag_str[5];
-                tag_str[0] = tag >> 24;
-                tag_str[1] = tag >> 16;
-                tag_str[2] = tag >> 8;
-                tag_str[3] = tag;
-                tag_str[4] = 0;
-                //printf("AJT: script = %s\n", tag_str);
-            } else {
-                // TODO: need a compile time option to remove dependency on harf-buzz
-                // just use FT_Get_Char_Index to look up glyph index
-                ft_shape(text->font->hb_font, text->hb_buffer, text->font->ft_face, text->utf8_string);
-            }
+        if ((option_flags & GB_TEXT_OPTION_INTERN) && !(option_flags & GB_TEXT_OPTION_ASYNC))
+            return _GB_TextMakeInterned(gb, utf8_string, font, NULL, user_data, origin, size,
+                                        horizontal_align, vertical_align, option_flags, text_out);
+        return _GB_TextMake(gb, utf8_string, font, NULL, user_data, origin, size,
+                            horizontal_align, vertical_align, option_flags & ~GB_TEXT_OPTION_INTERN, text_out);
+    } else {
+        return GB_ERROR_INVAL;
+    }
+}
 
-            // Insert new glyphs into cache
-            // This is where glyph rasterization occurs.
-            GB_ERROR ret = _GB_TextUpdateCache(gb, text);
-            if (ret != GB_ERROR_NONE)
-                return ret;
+GB_ERROR GB_TextMakeWithFallback(struct GB_Context *gb, const uint8_t *utf8_string,
+                                 struct GB_FontFallbackChain *chain, void *user_data, uint32_t origin[2],
+                                 uint32_t size[2], GB_HORIZONTAL_ALIGN horizontal_align,
+                                 GB_VERTICAL_ALIGN vertical_align, uint32_t option_flags, struct GB_Text **text_out)
+{
+    if (gb && utf8_string && chain && chain->num_fonts > 0 && text_out) {
+        if ((option_flags & GB_TEXT_OPTION_INTERN) && !(option_flags & GB_TEXT_OPTION_ASYNC))
+            return _GB_TextMakeInterned(gb, utf8_string, chain->font[0], chain, user_data, origin, size,
+                                        horizontal_align, vertical_align, option_flags, text_out);
+        return _GB_TextMake(gb, utf8_string, chain->font[0], chain, user_data, origin, size,
+                            horizontal_align, vertical_align, option_flags & ~GB_TEXT_OPTION_INTERN, text_out);
+    } else {
+        return GB_ERROR_INVAL;
+    }
+}
+
+// shapes & word-wraps the string like _GB_TextMake, without rasterizing glyphs or building quads.
+static GB_ERROR _GB_TextMeasure(struct GB_Context *gb, const uint8_t *utf8_string,
+                                struct GB_Font *font, struct GB_FontFallbackChain *chain, uint32_t width,
+                                uint32_t option_flags, struct GB_TextMetrics *metrics_out)
+{
+    size_t utf8_string_len = strlen((const char*)utf8_string);
+    hb_buffer_t *hb_buffer = hb_buffer_create();
+    uint8_t *glyph_font = NULL;
+    uint8_t *glyph_class = NULL;
+    GB_ERROR ret = _GB_TextShape(gb, utf8_string, utf8_string_len, font, chain, option_flags, hb_buffer, &glyph_font);
+    uint32_t num_glyphs = hb_buffer_get_length(hb_buffer);
+    if (ret == GB_ERROR_NONE) {
+        glyph_class = (uint8_t*)GB_AllocatorAllocScratch(gb->allocator, num_glyphs + 1);
+        if (glyph_class)
+            _GB_TextClassifyGlyphs(hb_buffer, utf8_string, glyph_class);
+        else
+            ret = GB_ERROR_NOMEM;
+    }
+
+    // width 0 never wraps, the pen stays well clear of overflow in 26.6.
+    struct GB_GlyphInfoQueue queue;
+    if (ret == GB_ERROR_NONE)
+        ret = _GB_WrapGlyphs(gb, hb_buffer, glyph_class, width ? width << 6 : INT32_MAX >> 1, &queue);
+    if (ret != GB_ERROR_NONE) {
+        GB_AllocatorResetScratch(gb->allocator);
+        hb_buffer_destroy(hb_buffer);
+        return ret;
+    }
+
+    // every line ends with a new line, its x is the far edge of the line.
+    uint32_t i;
+    uint32_t num_lines = 0, max_line_width = 0;
+    for (i = 0; i < queue.count; i++) {
+        if (queue.data[i].type == NEWLINE_GLYPH) {
+            const uint32_t line_width = (uint32_t)abs(queue.data[i].x);
+            if (line_width > max_line_width)
+                max_line_width = line_width;
+            num_lines++;
+        }
+    }
+
+    // intrinsic widths: the widest word, words are only broken at spaces & after BREAK_AFTER glyphs,
+    // and the widest line, lines are only broken at new lines.
+    hb_glyph_position_t *positions = hb_buffer_get_glyph_positions(hb_buffer, NULL);
+    uint32_t word_width = 0, line_width = 0, min_width = 0, max_width = 0;
+    for (i = 0; i < num_glyphs; i++) {
+        uint32_t advance = positions[i].x_advance > 0 ? positions[i].x_advance : 0;
+        if (glyph_class[i] == GLYPH_CLASS_NEWLINE) {
+            word_width = 0;
+            line_width = 0;
+        } else if (glyph_class[i] == GLYPH_CLASS_SPACE) {
+            word_width = 0;
+            line_width += advance;
+        } else {
+            word_width += advance;
+            line_width += advance;
+        }
+        if (word_width > min_width)
+            min_width = word_width;
+        if (glyph_class[i] == GLYPH_CLASS_BREAK_AFTER)
+            word_width = 0;
+        if (line_width > max_width)
+            max_width = line_width;
+    }
+
+    metrics_out->size[0] = FIXED_CEIL_TO_INT(max_line_width);
+    metrics_out->size[1] = num_lines * FIXED_TO_INT(font->ft_size->metrics.height);
+    metrics_out->num_lines = num_lines;
+    metrics_out->min_width = FIXED_CEIL_TO_INT(min_width);
+    metrics_out->max_width = FIXED_CEIL_TO_INT(max_width);
+
+    GB_AllocatorResetScratch(gb->allocator);
+    hb_buffer_destroy(hb_buffer);
+    return GB_ERROR_NONE;
+}
+
+GB_ERROR GB_TextMeasure(struct GB_Context *gb, const uint8_t *utf8_string,
+                        struct GB_Font *font, uint32_t width, uint32_t option_flags,
+                        struct GB_TextMetrics *metrics_out)
+{
+    if (gb && utf8_string && font && font->hb_font && metrics_out) {
+        return _GB_TextMeasure(gb, utf8_string, font, NULL, width, option_flags, metrics_out);
+    } else {
+        return GB_ERROR_INVAL;
+    }
+}
+
+GB_ERROR GB_TextMeasureWithFallback(struct GB_Context *gb, const uint8_t *utf8_string,
+                                    struct GB_FontFallbackChain *chain, uint32_t width, uint32_t option_flags,
+                                    struct GB_TextMetrics *metrics_out)
+{
+    if (gb && utf8_string && chain && chain->num_fonts > 0 && metrics_out) {
+        return _GB_TextMeasure(gb, utf8_string, chain->font[0], chain, width, option_flags, metrics_out);
+    } else {
+        return GB_ERROR_INVAL;
+    }
+}
+
+// wrap & emit the quads of text again, from its shaped glyphs.
+// only cached glyphs are read, nothing is shaped or rasterized.
+static GB_ERROR _GB_TextRelayout(struct GB_Context *gb, struct GB_Text *text)
+{
+    GB_ERROR ret = _GB_MakeGlyphQuadRuns(gb, text);
+    GB_AllocatorResetScratch(gb->allocator);
+    return ret;
+}
 
-            // Build array of GlyphQuadRuns, one for each line.
-            // This is where word-wrapping and justification occurs.
-            ret = _GB_MakeGlyphQuadRuns(gb, text);
+GB_ERROR GB_TextSetBounds(struct GB_Context *gb, struct GB_Text *text, uint32_t origin[2], uint32_t size[2])
+{
+    if (!gb || !text || !origin || !size)
+        return GB_ERROR_INVAL;
+
+    // the quads of an interned text are relative to its origin, only its layout may change.
+    if (text->layout) {
+        if (size[0] != text->size[0] || size[1] != text->size[1]) {
+            GB_ERROR ret = _GB_TextReintern(gb, text, size, text->horizontal_align, text->vertical_align);
             if (ret != GB_ERROR_NONE)
                 return ret;
+        }
+        text->origin[0] = origin[0];
+        text->origin[1] = origin[1];
+        return GB_ERROR_NONE;
+    }
 
-            *text_out = text;
-            return GB_ERROR_NONE;
-        } else {
-            return GB_ERROR_NOMEM;
+    // same size wraps the same way, so the quads only move.
+    if (size[0] == text->size[0] && size[1] == text->size[1]) {
+        const uint32_t dx = origin[0] - text->origin[0];
+        const uint32_t dy = origin[1] - text->origin[1];
+        uint32_t i;
+        for (i = 0; i < text->num_glyph_quads; i++) {
+            struct GB_GlyphQuad *quad = text->glyph_quads + i;
+            quad->pen[0] += dx;
+            quad->pen[1] += dy;
+            quad->origin[0] += dx;
+            quad->origin[1] += dy;
         }
+        text->origin[0] = origin[0];
+        text->origin[1] = origin[1];
+        return GB_ERROR_NONE;
+    }
+
+    // a compact text has no shaped glyphs left to wrap
+    if (!text->hb_buffer)
+        return GB_ERROR_INVAL;
+
+    const uint32_t old_origin[2] = {text->origin[0], text->origin[1]};
+    const uint32_t old_size[2] = {text->size[0], text->size[1]};
+    text->origin[0] = origin[0];
+    text->origin[1] = origin[1];
+    text->size[0] = size[0];
+    text->size[1] = size[1];
+    GB_ERROR ret = _GB_TextRelayout(gb, text);
+    if (ret != GB_ERROR_NONE) {
+        // the old quads were left alone
+        text->origin[0] = old_origin[0];
+        text->origin[1] = old_origin[1];
+        text->size[0] = old_size[0];
+        text->size[1] = old_size[1];
+    }
+    return ret;
+}
+
+GB_ERROR GB_TextSetAlign(struct GB_Context *gb, struct GB_Text *text,
+                         GB_HORIZONTAL_ALIGN horizontal_align, GB_VERTICAL_ALIGN vertical_align)
+{
+    if (!gb || !text)
+        return GB_ERROR_INVAL;
+
+    if (horizontal_align == text->horizontal_align && vertical_align == text->vertical_align)
+        return GB_ERROR_NONE;
+    if (text->layout)
+        return _GB_TextReintern(gb, text, text->size, horizontal_align, vertical_align);
+    if (!text->hb_buffer)
+        return GB_ERROR_INVAL;
+
+    const GB_HORIZONTAL_ALIGN old_horizontal_align = text->horizontal_align;
+    const GB_VERTICAL_ALIGN old_vertical_align = text->vertical_align;
+    text->horizontal_align = horizontal_align;
+    text->vertical_align = vertical_align;
+    GB_ERROR ret = _GB_TextRelayout(gb, text);
+    if (ret != GB_ERROR_NONE) {
+        text->horizontal_align = old_horizontal_align;
+        text->vertical_align = old_vertical_align;
+    }
+    return ret;
+}
+
+GB_ERROR GB_TextIsReady(struct GB_Context *gb, struct GB_Text *text, int *ready_out)
+{
+    if (gb && text && ready_out) {
+        *ready_out = !text->pending;
+        return GB_ERROR_NONE;
     } else {
         return GB_ERROR_INVAL;
     }
@@ -560,27 +1386,56 @@ static void _GB_TextDestroy(struct GB_Context *gb, struct GB_Text *text)
     assert(text);
     assert(text->rc == 0);
 
-    GB_FontRelease(gb, text->font);
-
-    free(text->utf8_string);
-
     if (text->user_data)
         free(text->user_data);
 
-    // prepare to iterate over all the glyphs in the hb_buffer
-    int num_glyphs = hb_buffer_get_length(text->hb_buffer);
-    hb_glyph_info_t *glyphs = hb_buffer_get_glyph_infos(text->hb_buffer, NULL);
-
-    // remove each glyph from context
-    int i, font_index = text->font->index;
-    for (i = 0; i < num_glyphs; i++) {
-        GB_ContextHashRemove(gb, glyphs[i].codepoint, font_index);
+    // everything else belongs to the shared layout
+    if (text->layout) {
+        GB_TextRelease(gb, text->layout);
+        GB_AllocatorFree(gb->allocator, text);
+        return;
     }
-    hb_buffer_destroy(text->hb_buffer);
+    if (text->option_flags & GB_TEXT_OPTION_INTERN)
+        _GB_TextRemoveLayout(gb, text);
+
+    if (text->hb_buffer) {
+        // prepare to iterate over all the glyphs in the hb_buffer
+        int num_glyphs = hb_buffer_get_length(text->hb_buffer);
+        hb_glyph_info_t *glyphs = hb_buffer_get_glyph_infos(text->hb_buffer, NULL);
+
+        // remove each use of a glyph, skipping new-lines just like _GB_TextUpdateCache
+        int i;
+        for (i = 0; i < num_glyphs; i++) {
+            if (text->glyph_class[i] != GLYPH_CLASS_NEWLINE)
+                GB_ContextRemoveGlyphUse(gb, _GB_TextGlyphFont(text, i), glyphs[i].codepoint);
+        }
+        hb_buffer_destroy(text->hb_buffer);
+    } else {
+        // a compact text kept the key of each glyph use instead
+        uint32_t i;
+        for (i = 0; i < text->num_glyph_keys; i++) {
+            const uint64_t key = text->glyph_keys[i];
+            struct GB_Font *font = text->fallback_chain ? text->fallback_chain->font[GLYPH_KEY_FONT_SLOT(key)] : text->font;
+            GB_ContextRemoveGlyphUse(gb, font, GLYPH_KEY_INDEX(key));
+        }
+    }
+
+    GB_FontRelease(gb, text->font);
+    if (text->fallback_chain)
+        GB_FontFallbackChainRelease(gb, text->fallback_chain);
+
+    DL_DELETE(gb->text_list, text);
 
-    free(text->glyph_quads);
+    // the string & quads are part of the same allocation
+    GB_AllocatorFree(gb->allocator, text);
+}
 
-    free(text);
+void GB_TextUpdateGlyphQuads(struct GB_Context *gb, struct GB_Text *text)
+{
+    uint32_t i;
+    for (i = 0; i < text->num_glyph_quads; i++) {
+        _GB_GlyphQuadInitTexture(gb, text->glyph_quads + i, text->glyph_quad_glyphs[i]);
+    }
 }
 
 GB_ERROR GB_TextRelease(struct GB_Context *gb, struct GB_Text *text)
@@ -596,3 +1451,21 @@ GB_ERROR GB_TextRelease(struct GB_Context *gb, struct GB_Text *text)
         return GB_ERROR_INVAL;
     }
 }
+
+GB_ERROR GB_TextUpdatePending(struct GB_Context *gb, struct GB_Text *text)
+{
+    assert(text->pending);
+
+    int num_glyphs = hb_buffer_get_length(text->hb_buffer);
+    hb_glyph_info_t *glyphs = hb_buffer_get_glyph_infos(text->hb_buffer, NULL);
+    int i;
+    text->pending = 0;
+    for (i = 0; i < num_glyphs && !text->pending; i++) {
+        if (text->glyph_class[i] != GLYPH_CLASS_NEWLINE && GB_FontFindGlyph(gb, _GB_TextGlyphFont(text, i), glyphs[i].codepoint)->pending)
+            text->pending = 1;
+    }
+
+    // rasterized glyphs have their final size & advance, so the text is wrapped again.
+    // the scratch arena is reset by GB_ContextPoll.
+    return _GB_MakeGlyphQuadRuns(gb, text);
+}
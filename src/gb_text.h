@@ -9,6 +9,8 @@ extern "C" {
 #include <harfbuzz/hb.h>
 #include "gb_error.h"
 
+struct GB_FontFallbackChain;
+
 typedef enum GB_Horizontal_Align {
     GB_HORIZONTAL_ALIGN_LEFT = 0,
     GB_HORIZONTAL_ALIGN_RIGHT,
@@ -34,25 +36,53 @@ struct GB_GlyphQuad {
 };
 
 // text object
-// reference counted
+// reference counted, the text, its quads & its copy of the string share one allocation.
+// A GB_TEXT_OPTION_INTERN text only holds its origin & user_data, every other field is shared with its layout.
 struct GB_Text {
     int32_t rc;
-    struct GB_Font *font;
-    uint8_t *utf8_string;
+    struct GB_Font *font;  // also provides the line height of texts made with a fallback chain
+    struct GB_FontFallbackChain *fallback_chain;  // NULL if every glyph is from font
+    uint8_t *glyph_class;  // word-wrapping class of each glyph in hb_buffer: normal, space or new line
+    uint8_t *glyph_font;  // chain index of the font of each glyph in hb_buffer, NULL without a fallback chain
+    uint8_t *utf8_string;  // NULL once compact, unless the text is an interned layout
     uint32_t utf8_string_len; // in bytes (not including null term)
-    hb_buffer_t *hb_buffer;  // harfbuzz buffer, used for shaping
+    hb_buffer_t *hb_buffer;  // harfbuzz buffer, used for shaping. NULL once compact, see GB_TEXT_OPTION_COMPACT
+    uint64_t *glyph_keys;  // glyphs used by a compact text, chain index << 32 | glyph index
+    uint32_t num_glyph_keys;
     void *user_data;
     uint32_t origin[2];  // bounding rectangle, used for word-wrapping & alignment
     uint32_t size[2];
     GB_HORIZONTAL_ALIGN horizontal_align;
     GB_VERTICAL_ALIGN vertical_align;
     uint32_t option_flags;
+    uint32_t pending;  // 1 while some glyphs are still being rasterized, see GB_TEXT_OPTION_ASYNC
     struct GB_GlyphQuad *glyph_quads;
+    struct GB_Glyph **glyph_quad_glyphs;  // glyph used by each quad, see GB_TextUpdateGlyphQuads
     uint32_t num_glyph_quads;
+    struct GB_Text *layout;  // shared by a GB_TEXT_OPTION_INTERN text, NULL if the text owns its layout
+    uint64_t intern_hash;  // of a shared layout, see GB_TEXT_OPTION_INTERN
+    struct GB_Text *intern_next;  // GB_Context intern_table chain
+    struct GB_Text *prev;  // GB_Context text_list
+    struct GB_Text *next;
 };
 
 typedef enum GB_Text_Option_Flags {
-    GB_TEXT_OPTION_DISABLE_SHAPING = 0x01
+    GB_TEXT_OPTION_DISABLE_SHAPING = 0x01,
+
+    // GB_TextMake does not wait for new glyphs to be rasterized, they are queued on the context worker pool.
+    // Until then their quads are empty and use the fallback texture, with advances good enough for word-wrapping.
+    // GB_ContextPoll patches the text once its glyphs arrive, see GB_TextIsReady & GB_ContextSetTextReadyFunc.
+    GB_TEXT_OPTION_ASYNC = 0x02,
+
+    // texts with the same string, font, size, alignment & options share one immutable layout,
+    // a duplicate only costs a small GB_Text. Quads of an interned text are relative to its origin,
+    // add text->origin when drawing them, and their user_data is NULL. Ignored with GB_TEXT_OPTION_ASYNC.
+    GB_TEXT_OPTION_INTERN = 0x04,
+
+    // once laid out, the text drops its shaped glyphs & its copy of the string, and its quads are trimmed to fit.
+    // it can still be moved by GB_TextSetBounds, a new size or alignment returns GB_ERROR_INVAL.
+    // interned texts can still be resized, their layout keeps the string. Ignored with GB_TEXT_OPTION_ASYNC.
+    GB_TEXT_OPTION_COMPACT = 0x08
 } GB_TEXT_OPTION_FLAGS;
 
 // NOTE: ownership of memory pointed to by user_data is passed to text.
@@ -61,9 +91,56 @@ GB_ERROR GB_TextMake(struct GB_Context *gb, const uint8_t *utf8_string,
                      struct GB_Font *font, void* user_data, uint32_t origin[2],
                      uint32_t size[2], GB_HORIZONTAL_ALIGN horizontal_align,
                      GB_VERTICAL_ALIGN vertical_align, uint32_t option_flags, struct GB_Text **text_out);
+// same as GB_TextMake, each run of the string is shaped & drawn with the first font of chain which covers it.
+// see GB_FontFallbackChainItemize
+GB_ERROR GB_TextMakeWithFallback(struct GB_Context *gb, const uint8_t *utf8_string,
+                                 struct GB_FontFallbackChain *chain, void* user_data, uint32_t origin[2],
+                                 uint32_t size[2], GB_HORIZONTAL_ALIGN horizontal_align,
+                                 GB_VERTICAL_ALIGN vertical_align, uint32_t option_flags, struct GB_Text **text_out);
+
+// size of a string laid out by GB_TextMake, in pixels.
+struct GB_TextMetrics {
+    uint32_t size[2];  // bounding box of the word-wrapped lines
+    uint32_t num_lines;
+    uint32_t min_width;  // narrowest width which does not break a word, the widest word
+    uint32_t max_width;  // width needed to fit every line without wrapping
+};
+
+// shape & word-wrap utf8_string to width like GB_TextMake, without rasterizing glyphs or building quads.
+// neither the glyph cache nor GL are touched. width 0 does not wrap, only new lines break the text.
+// option_flags - only GB_TEXT_OPTION_DISABLE_SHAPING applies.
+GB_ERROR GB_TextMeasure(struct GB_Context *gb, const uint8_t *utf8_string,
+                        struct GB_Font *font, uint32_t width, uint32_t option_flags,
+                        struct GB_TextMetrics *metrics_out);
+// same as GB_TextMeasure, for texts made with GB_TextMakeWithFallback.
+GB_ERROR GB_TextMeasureWithFallback(struct GB_Context *gb, const uint8_t *utf8_string,
+                                    struct GB_FontFallbackChain *chain, uint32_t width, uint32_t option_flags,
+                                    struct GB_TextMetrics *metrics_out);
+
+// move or resize the bounding rectangle of text, its shaped glyphs are wrapped & aligned again.
+// Nothing is shaped or rasterized, a move without a resize only offsets the quads.
+// On failure the text keeps its old bounds & quads.
+GB_ERROR GB_TextSetBounds(struct GB_Context *gb, struct GB_Text *text, uint32_t origin[2], uint32_t size[2]);
+// same as GB_TextSetBounds, for the alignment of text.
+GB_ERROR GB_TextSetAlign(struct GB_Context *gb, struct GB_Text *text,
+                         GB_HORIZONTAL_ALIGN horizontal_align, GB_VERTICAL_ALIGN vertical_align);
+
 GB_ERROR GB_TextRetain(struct GB_Context *gb, struct GB_Text *text);
 GB_ERROR GB_TextRelease(struct GB_Context *gb, struct GB_Text *text);
 
+// ready_out is set to 1 once every glyph of the text has been rasterized, and its quads are final.
+// always 1 unless the text was made with GB_TEXT_OPTION_ASYNC.
+GB_ERROR GB_TextIsReady(struct GB_Context *gb, struct GB_Text *text, int *ready_out);
+
+// private
+
+// refresh the texture & uv coordinates of each quad, after glyphs have moved within the cache.
+void GB_TextUpdateGlyphQuads(struct GB_Context *gb, struct GB_Text *text);
+
+// some pending glyphs have been rasterized, redo the layout of a pending text.
+// text->pending is cleared once none of its glyphs are pending.
+GB_ERROR GB_TextUpdatePending(struct GB_Context *gb, struct GB_Text *text);
+
 #ifdef __cplusplus
 }
 #endif
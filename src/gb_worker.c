@@ -0,0 +1,321 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <unistd.h>
+#include "gb_context.h"
+#include "gb_font.h"
+#include "gb_face.h"
+#include "gb_glyph.h"
+#include "gb_worker.h"
+
+// returns this worker's face for font, opening it the first time it is needed.
+// returns NULL if the face could not be opened.
+static FT_Face _GB_WorkerGetFace(struct GB_Worker *worker, struct GB_Font *font)
+{
+    uint32_t i;
+    for (i = 0; i < worker->num_faces; i++) {
+        if (worker->face[i].font_index == font->index)
+            return worker->face[i].ft_face;
+    }
+
+    if (worker->num_faces == worker->face_capacity) {
+        uint32_t capacity = worker->face_capacity ? worker->face_capacity * 2 : 4;
+        struct GB_WorkerFace *face = (struct GB_WorkerFace*)realloc(worker->face, sizeof(struct GB_WorkerFace) * capacity);
+        if (!face)
+            return NULL;
+        worker->face = face;
+        worker->face_capacity = capacity;
+    }
+
+    FT_Face ft_face = NULL;
+    if (FT_New_Memory_Face(worker->ft_library, font->face->data, (FT_Long)font->face->data_size, 0, &ft_face))
+        return NULL;
+    FT_Set_Char_Size(ft_face, (int)(font->point_size * 64), 0, 72, 72);
+
+    worker->face[worker->num_faces].font_index = font->index;
+    worker->face[worker->num_faces].ft_face = ft_face;
+    worker->num_faces++;
+    return ft_face;
+}
+
+static void _GB_WorkerRunJob(struct GB_Worker *worker, struct GB_RasterJob *job)
+{
+    pthread_mutex_lock(&worker->face_mutex);
+    FT_Face ft_face = _GB_WorkerGetFace(worker, job->font);
+    if (ft_face)
+        job->error = GB_GlyphMakeFromFace(worker->pool->gb, job->index, job->font, ft_face, &job->glyph);
+    else
+        job->error = GB_ERROR_FTERR;
+    pthread_mutex_unlock(&worker->face_mutex);
+}
+
+static void *_GB_WorkerMain(void *arg)
+{
+    struct GB_Worker *worker = (struct GB_Worker*)arg;
+    struct GB_WorkerPool *pool = worker->pool;
+
+    pthread_mutex_lock(&pool->mutex);
+    while (1) {
+        while (!pool->quit && pool->next_job >= pool->num_jobs && !pool->queued_head)
+            pthread_cond_wait(&pool->work_cond, &pool->mutex);
+        if (pool->quit)
+            break;
+
+        if (pool->next_job < pool->num_jobs) {
+            // batches come first, the calling thread is waiting for them.
+            struct GB_RasterJob *job = pool->job + pool->next_job++;
+            pthread_mutex_unlock(&pool->mutex);
+
+            // a job which fails here is retried by the calling thread, see GB_WorkerPoolRasterize
+            _GB_WorkerRunJob(worker, job);
+
+            pthread_mutex_lock(&pool->mutex);
+            if (++pool->num_done == pool->num_jobs)
+                pthread_cond_broadcast(&pool->done_cond);
+        } else {
+            struct GB_RasterJob *job = pool->queued_head;
+            pool->queued_head = job->next;
+            if (!pool->queued_head)
+                pool->queued_tail = NULL;
+            worker->async_job = job;
+            pthread_mutex_unlock(&pool->mutex);
+
+            _GB_WorkerRunJob(worker, job);
+
+            pthread_mutex_lock(&pool->mutex);
+            job->next = pool->finished;
+            pool->finished = job;
+            worker->async_job = NULL;
+            pthread_cond_broadcast(&pool->done_cond);
+        }
+    }
+    pthread_mutex_unlock(&pool->mutex);
+    return NULL;
+}
+
+GB_ERROR GB_WorkerPoolMake(struct GB_Context *gb, int use_threads, struct GB_WorkerPool **pool_out)
+{
+    if (!gb || !pool_out)
+        return GB_ERROR_INVAL;
+
+    // the calling thread works on every batch too, so it counts as one of the cores.
+    uint32_t num_workers = 0;
+    if (use_threads) {
+        long num_cores = sysconf(_SC_NPROCESSORS_ONLN);
+        num_workers = num_cores > 1 ? (uint32_t)(num_cores - 1) : 0;
+        if (num_workers > GB_MAX_WORKERS)
+            num_workers = GB_MAX_WORKERS;
+    }
+
+    struct GB_WorkerPool *pool = (struct GB_WorkerPool*)malloc(sizeof(struct GB_WorkerPool));
+    if (!pool)
+        return GB_ERROR_NOMEM;
+    memset(pool, 0, sizeof(struct GB_WorkerPool));
+    pool->gb = gb;
+    pthread_mutex_init(&pool->mutex, NULL);
+    pthread_cond_init(&pool->work_cond, NULL);
+    pthread_cond_init(&pool->done_cond, NULL);
+
+    // keep whichever workers could be started
+    uint32_t i;
+    for (i = 0; i < num_workers; i++) {
+        struct GB_Worker *worker = pool->worker + i;
+        worker->pool = pool;
+        if (FT_Init_FreeType(&worker->ft_library))
+            break;
+        pthread_mutex_init(&worker->face_mutex, NULL);
+        if (pthread_create(&worker->thread, NULL, _GB_WorkerMain, worker)) {
+            pthread_mutex_destroy(&worker->face_mutex);
+            FT_Done_FreeType(worker->ft_library);
+            break;
+        }
+        pool->num_workers++;
+    }
+
+    *pool_out = pool;
+    return GB_ERROR_NONE;
+}
+
+void GB_WorkerPoolDestroy(struct GB_WorkerPool *pool)
+{
+    assert(pool);
+    pthread_mutex_lock(&pool->mutex);
+    pool->quit = 1;
+    pthread_cond_broadcast(&pool->work_cond);
+    pthread_mutex_unlock(&pool->mutex);
+
+    uint32_t i, j;
+    for (i = 0; i < pool->num_workers; i++) {
+        struct GB_Worker *worker = pool->worker + i;
+        pthread_join(worker->thread, NULL);
+        for (j = 0; j < worker->num_faces; j++)
+            FT_Done_Face(worker->face[j].ft_face);
+        free(worker->face);
+        pthread_mutex_destroy(&worker->face_mutex);
+        FT_Done_FreeType(worker->ft_library);
+    }
+
+    GB_WorkerPoolFreeJobs(pool->queued_head);
+    GB_WorkerPoolFreeJobs(pool->finished);
+
+    pthread_cond_destroy(&pool->done_cond);
+    pthread_cond_destroy(&pool->work_cond);
+    pthread_mutex_destroy(&pool->mutex);
+    free(pool);
+}
+
+GB_ERROR GB_WorkerPoolRasterize(struct GB_Context *gb, struct GB_WorkerPool *pool,
+                                struct GB_RasterJob *jobs, uint32_t num_jobs)
+{
+    uint32_t i;
+    for (i = 0; i < num_jobs; i++) {
+        jobs[i].glyph = NULL;
+        jobs[i].error = GB_ERROR_NONE;
+    }
+
+    if (pool && pool->num_workers > 0 && num_jobs >= GB_WORKER_MIN_BATCH) {
+        pthread_mutex_lock(&pool->mutex);
+        pool->job = jobs;
+        pool->num_jobs = num_jobs;
+        pool->next_job = 0;
+        pool->num_done = 0;
+        pthread_cond_broadcast(&pool->work_cond);
+
+        // work on the batch alongside the workers, using the font's own face.
+        while (pool->next_job < pool->num_jobs) {
+            struct GB_RasterJob *job = pool->job + pool->next_job++;
+            pthread_mutex_unlock(&pool->mutex);
+            job->error = GB_GlyphMake(gb, job->index, job->font, &job->glyph);
+            pthread_mutex_lock(&pool->mutex);
+            pool->num_done++;
+        }
+        while (pool->num_done < pool->num_jobs)
+            pthread_cond_wait(&pool->done_cond, &pool->mutex);
+
+        // workers go back to sleep
+        pool->job = NULL;
+        pool->num_jobs = 0;
+        pool->next_job = 0;
+        pool->num_done = 0;
+        pthread_mutex_unlock(&pool->mutex);
+    }
+
+    // rasterize anything left over on this thread, this also retries jobs a worker could not open a face for.
+    GB_ERROR error = GB_ERROR_NONE;
+    for (i = 0; i < num_jobs; i++) {
+        if (!jobs[i].glyph)
+            jobs[i].error = GB_GlyphMake(gb, jobs[i].index, jobs[i].font, &jobs[i].glyph);
+        if (jobs[i].error && error == GB_ERROR_NONE)
+            error = jobs[i].error;
+    }
+    return error;
+}
+
+void GB_WorkerPoolQueue(struct GB_WorkerPool *pool, struct GB_RasterJob *job)
+{
+    job->glyph = NULL;
+    job->error = GB_ERROR_NONE;
+    job->next = NULL;
+
+    pthread_mutex_lock(&pool->mutex);
+    if (pool->queued_tail)
+        pool->queued_tail->next = job;
+    else
+        pool->queued_head = job;
+    pool->queued_tail = job;
+    pthread_cond_signal(&pool->work_cond);
+    pthread_mutex_unlock(&pool->mutex);
+}
+
+void GB_WorkerPoolRunQueued(struct GB_Context *gb, struct GB_WorkerPool *pool, uint32_t max_jobs)
+{
+    uint32_t i;
+    for (i = 0; i < max_jobs; i++) {
+        pthread_mutex_lock(&pool->mutex);
+        struct GB_RasterJob *job = pool->queued_head;
+        if (job) {
+            pool->queued_head = job->next;
+            if (!pool->queued_head)
+                pool->queued_tail = NULL;
+        }
+        pthread_mutex_unlock(&pool->mutex);
+        if (!job)
+            break;
+
+        job->error = GB_GlyphMake(gb, job->index, job->font, &job->glyph);
+
+        pthread_mutex_lock(&pool->mutex);
+        job->next = pool->finished;
+        pool->finished = job;
+        pthread_mutex_unlock(&pool->mutex);
+    }
+}
+
+struct GB_RasterJob *GB_WorkerPoolTakeFinished(struct GB_WorkerPool *pool)
+{
+    pthread_mutex_lock(&pool->mutex);
+    struct GB_RasterJob *finished = pool->finished;
+    pool->finished = NULL;
+    pthread_mutex_unlock(&pool->mutex);
+    return finished;
+}
+
+void GB_WorkerPoolFreeJobs(struct GB_RasterJob *job)
+{
+    while (job) {
+        struct GB_RasterJob *next = job->next;
+        if (job->glyph)
+            GB_GlyphRelease(job->glyph);
+        free(job);
+        job = next;
+    }
+}
+
+void GB_WorkerPoolForgetFont(struct GB_WorkerPool *pool, struct GB_Font *font)
+{
+    pthread_mutex_lock(&pool->mutex);
+
+    // drop queued jobs for this font
+    struct GB_RasterJob **link = &pool->queued_head;
+    pool->queued_tail = NULL;
+    while (*link) {
+        struct GB_RasterJob *job = *link;
+        if (job->font == font) {
+            *link = job->next;
+            job->next = NULL;
+            GB_WorkerPoolFreeJobs(job);
+        } else {
+            pool->queued_tail = job;
+            link = &job->next;
+        }
+    }
+
+    // wait for workers which are still rasterizing a glyph of this font
+    uint32_t i, j;
+    int busy = 1;
+    while (busy) {
+        busy = 0;
+        for (i = 0; i < pool->num_workers; i++) {
+            if (pool->worker[i].async_job && pool->worker[i].async_job->font == font)
+                busy = 1;
+        }
+        if (busy)
+            pthread_cond_wait(&pool->done_cond, &pool->mutex);
+    }
+    pthread_mutex_unlock(&pool->mutex);
+
+    // workers only touch their faces while holding face_mutex, a batch is never in progress here.
+    for (i = 0; i < pool->num_workers; i++) {
+        struct GB_Worker *worker = pool->worker + i;
+        pthread_mutex_lock(&worker->face_mutex);
+        for (j = 0; j < worker->num_faces; j++) {
+            if (worker->face[j].font_index == font->index) {
+                FT_Done_Face(worker->face[j].ft_face);
+                worker->face[j] = worker->face[--worker->num_faces];
+                break;
+            }
+        }
+        pthread_mutex_unlock(&worker->face_mutex);
+    }
+}
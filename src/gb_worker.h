@@ -0,0 +1,105 @@
+#ifndef GB_WORKER_H
+#define GB_WORKER_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <pthread.h>
+#include <ft2build.h>
+#include FT_FREETYPE_H
+#include "gb_error.h"
+
+struct GB_Context;
+struct GB_Font;
+struct GB_Glyph;
+
+// upper limit on the number of worker threads, regardless of the number of cpu cores.
+#define GB_MAX_WORKERS 8
+
+// batches with fewer glyphs than this are rasterized on the calling thread.
+#define GB_WORKER_MIN_BATCH 16
+
+// async glyphs rasterized by GB_WorkerPoolRunQueued, per call. only used by pools without threads.
+#define GB_WORKER_QUEUED_GLYPHS_PER_RUN 16
+
+// a single glyph to rasterize.
+struct GB_RasterJob {
+    struct GB_Font *font;  // not retained, a queued job is dropped when its font is destroyed.
+    uint32_t index;  // glyph index within font
+    uint32_t font_index;  // GB_Font index, still valid once the font is gone
+    struct GB_Glyph *glyph;  // result, reference is passed to the caller. NULL on error.
+    GB_ERROR error;
+    struct GB_RasterJob *next;  // queued & finished lists, see GB_WorkerPoolQueue
+};
+
+// a FT_Face opened by a worker, for one GB_Font. it reads the mapped file of the font's GB_Face.
+struct GB_WorkerFace {
+    uint32_t font_index;
+    FT_Face ft_face;
+};
+
+struct GB_Worker {
+    struct GB_WorkerPool *pool;
+    pthread_t thread;
+    FT_Library ft_library;  // FreeType objects may only be used by one thread at a time
+    pthread_mutex_t face_mutex;  // held while the worker uses its faces, see GB_WorkerPoolForgetFont
+    struct GB_WorkerFace *face;  // opened on demand
+    uint32_t num_faces;
+    uint32_t face_capacity;
+    struct GB_RasterJob *async_job;  // queued job this worker is rasterizing, guarded by the pool mutex
+};
+
+// rasterizes glyphs for the context, in parallel if it has threads. see GB_CONTEXT_OPTION_PARALLEL_RASTERIZE.
+// Workers sleep until a batch is posted by GB_WorkerPoolRasterize, the calling thread also works on the batch.
+// In between batches, workers rasterize glyphs queued by GB_WorkerPoolQueue for asynchronous texts.
+struct GB_WorkerPool {
+    struct GB_Context *gb;
+    struct GB_Worker worker[GB_MAX_WORKERS];
+    uint32_t num_workers;
+    pthread_mutex_t mutex;  // guards all fields below
+    pthread_cond_t work_cond;  // signaled when a batch is posted, a job is queued, or the pool is shutting down
+    pthread_cond_t done_cond;  // signaled when the last job of a batch, or any async job, is finished
+    struct GB_RasterJob *job;  // current batch
+    uint32_t num_jobs;
+    uint32_t next_job;  // next job to be claimed
+    uint32_t num_done;
+    struct GB_RasterJob *queued_head;  // async jobs waiting for a worker, oldest first
+    struct GB_RasterJob *queued_tail;
+    struct GB_RasterJob *finished;  // async jobs waiting for GB_WorkerPoolTakeFinished
+    int quit;
+};
+
+// if use_threads is set, starts one worker per cpu core besides the calling thread.
+// otherwise, or if there is only one core, the pool has no threads
+// and queued glyphs are rasterized on the calling thread by GB_WorkerPoolRunQueued.
+GB_ERROR GB_WorkerPoolMake(struct GB_Context *gb, int use_threads, struct GB_WorkerPool **pool_out);
+void GB_WorkerPoolDestroy(struct GB_WorkerPool *pool);
+
+// rasterize every job, returns once they are all finished.
+// pool may be NULL, in which case every job is rasterized on the calling thread.
+// job->error is set for each glyph which failed, the first error is also returned.
+GB_ERROR GB_WorkerPoolRasterize(struct GB_Context *gb, struct GB_WorkerPool *pool,
+                                struct GB_RasterJob *jobs, uint32_t num_jobs);
+
+// add a job to the async queue, ownership of job is passed to the pool until it is returned by GB_WorkerPoolTakeFinished.
+void GB_WorkerPoolQueue(struct GB_WorkerPool *pool, struct GB_RasterJob *job);
+
+// rasterize at most max_jobs queued jobs on the calling thread.
+void GB_WorkerPoolRunQueued(struct GB_Context *gb, struct GB_WorkerPool *pool, uint32_t max_jobs);
+
+// returns the list of finished async jobs, linked by job->next. their font ptrs must not be used.
+struct GB_RasterJob *GB_WorkerPoolTakeFinished(struct GB_WorkerPool *pool);
+
+// release the glyphs of a list of jobs, and free them.
+void GB_WorkerPoolFreeJobs(struct GB_RasterJob *job);
+
+// close every face the workers have opened for font, and drop its queued jobs. called when the font is destroyed.
+void GB_WorkerPoolForgetFont(struct GB_WorkerPool *pool, struct GB_Font *font);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // GB_WORKER_H
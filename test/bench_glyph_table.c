@@ -0,0 +1,99 @@
+// microbenchmark, GB_GlyphTable lookups vs. the uthash table the cache used before it.
+// usage: bench_glyph_table
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "uthash.h"
+#include "../src/gb_glyph.h"
+#include "../src/gb_glyph_table.h"
+
+// the old cache hash entry, a glyph key plus a hash handle.
+struct UTGlyph {
+    uint64_t key;
+    struct GB_Glyph *glyph;
+    UT_hash_handle hh;
+};
+
+static double Now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// a text usually asks for glyphs of one or two fonts, keys are spread over a few fonts here.
+static uint64_t MakeKey(uint32_t i)
+{
+    const uint32_t font_index = i % 4;
+    const uint32_t glyph_index = 3 + (i / 4) * 7;
+    return ((uint64_t)font_index << 32) | glyph_index;
+}
+
+static void Bench(uint32_t num_glyphs, uint32_t num_lookups)
+{
+    struct GB_Glyph *glyphs = (struct GB_Glyph*)calloc(num_glyphs, sizeof(struct GB_Glyph));
+    struct UTGlyph *ut_glyphs = (struct UTGlyph*)calloc(num_glyphs, sizeof(struct UTGlyph));
+    uint64_t *lookup_keys = (uint64_t*)malloc(sizeof(uint64_t) * num_lookups);
+    if (!glyphs || !ut_glyphs || !lookup_keys) {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+
+    struct GB_GlyphTable table;
+    GB_GlyphTableInit(&table);
+    struct UTGlyph *ut_table = NULL;
+    uint32_t i;
+    for (i = 0; i < num_glyphs; i++) {
+        glyphs[i].key = MakeKey(i);
+        GB_GlyphTableAdd(&table, glyphs + i);
+        ut_glyphs[i].key = glyphs[i].key;
+        ut_glyphs[i].glyph = glyphs + i;
+        HASH_ADD(hh, ut_table, key, sizeof(uint64_t), ut_glyphs + i);
+    }
+
+    // 9 out of 10 lookups hit, like a text whose glyphs are mostly cached already.
+    srand(num_glyphs);
+    for (i = 0; i < num_lookups; i++) {
+        const uint32_t r = (uint32_t)rand();
+        lookup_keys[i] = (r % 10) ? MakeKey(r % num_glyphs) : MakeKey(num_glyphs + r % num_glyphs);
+    }
+
+    uintptr_t sum = 0;
+    double t0 = Now();
+    for (i = 0; i < num_lookups; i++) {
+        sum += (uintptr_t)GB_GlyphTableFind(&table, lookup_keys[i]);
+    }
+    double t1 = Now();
+    for (i = 0; i < num_lookups; i++) {
+        struct UTGlyph *ut_glyph = NULL;
+        HASH_FIND(hh, ut_table, lookup_keys + i, sizeof(uint64_t), ut_glyph);
+        sum -= ut_glyph ? (uintptr_t)ut_glyph->glyph : 0;
+    }
+    double t2 = Now();
+
+    // both tables must agree on every lookup
+    if (sum != 0) {
+        fprintf(stderr, "lookup mismatch\n");
+        exit(1);
+    }
+
+    printf("%8u glyphs: glyph table %6.2f ns/lookup, uthash %6.2f ns/lookup\n", num_glyphs,
+           (t1 - t0) * 1e9 / num_lookups, (t2 - t1) * 1e9 / num_lookups);
+
+    HASH_CLEAR(hh, ut_table);
+    GB_GlyphTableDestroy(&table);
+    free(lookup_keys);
+    free(ut_glyphs);
+    free(glyphs);
+}
+
+int main(int argc, char *argv[])
+{
+    const uint32_t num_lookups = 1 << 22;
+    uint32_t num_glyphs;
+    for (num_glyphs = 256; num_glyphs <= (1 << 18); num_glyphs *= 8)
+        Bench(num_glyphs, num_lookups);
+    return 0;
+}
@@ -0,0 +1,101 @@
+// microbenchmark, word-wrapping lorem.txt & arabic.txt.
+// GB_TextSetBounds re-wraps already shaped glyphs & rebuilds the quads, GB_TextMeasure shapes & wraps.
+// the context makes a GL texture, so an SDL window provides the GL context.
+// usage: bench_wrap, from test/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "SDL.h"
+#include "../src/gb_context.h"
+#include "../src/gb_font.h"
+#include "../src/gb_text.h"
+
+static double Now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static uint8_t *LoadFile(const char *filename)
+{
+    FILE *fp = fopen(filename, "rb");
+    if (!fp) {
+        fprintf(stderr, "could not open %s\n", filename);
+        exit(1);
+    }
+    fseek(fp, 0, SEEK_END);
+    const long size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    uint8_t *data = (uint8_t*)malloc(size + 1);
+    if (!data || fread(data, 1, size, fp) != (size_t)size) {
+        fprintf(stderr, "could not read %s\n", filename);
+        exit(1);
+    }
+    data[size] = 0;
+    fclose(fp);
+    return data;
+}
+
+static void Check(GB_ERROR err, const char *what)
+{
+    if (err != GB_ERROR_NONE) {
+        fprintf(stderr, "%s failed, %s\n", what, GB_ErrorToString(err));
+        exit(1);
+    }
+}
+
+// widths alternate between narrow & wide, so every call re-wraps the whole text.
+static void Bench(struct GB_Context *gb, const char *filename, const char *font_filename,
+                  uint32_t point_size, uint32_t narrow_width, uint32_t wide_width, uint32_t num_iterations)
+{
+    uint8_t *string = LoadFile(filename);
+    struct GB_Font *font = NULL;
+    Check(GB_FontMake(gb, font_filename, point_size, GB_RENDER_NORMAL, GB_HINT_DEFAULT, &font), "GB_FontMake");
+
+    uint32_t origin[2] = {0, 0};
+    uint32_t size[2] = {wide_width, 4096};
+    struct GB_Text *text = NULL;
+    Check(GB_TextMake(gb, string, font, NULL, origin, size, GB_HORIZONTAL_ALIGN_LEFT,
+                      GB_VERTICAL_ALIGN_TOP, 0, &text), "GB_TextMake");
+
+    uint32_t i;
+    double t0 = Now();
+    for (i = 0; i < num_iterations; i++) {
+        size[0] = (i & 1) ? wide_width : narrow_width;
+        Check(GB_TextSetBounds(gb, text, origin, size), "GB_TextSetBounds");
+    }
+    double t1 = Now();
+    struct GB_TextMetrics metrics;
+    for (i = 0; i < num_iterations; i++) {
+        const uint32_t width = (i & 1) ? wide_width : narrow_width;
+        Check(GB_TextMeasure(gb, string, font, width, 0, &metrics), "GB_TextMeasure");
+    }
+    double t2 = Now();
+
+    printf("%-12s %5u glyphs: relayout %8.2f us, measure %8.2f us\n", filename, text->num_glyph_quads,
+           (t1 - t0) * 1e6 / num_iterations, (t2 - t1) * 1e6 / num_iterations);
+
+    GB_TextRelease(gb, text);
+    GB_FontRelease(gb, font);
+    free(string);
+}
+
+int main(int argc, char *argv[])
+{
+    if (SDL_Init(SDL_INIT_VIDEO) < 0 || !SDL_SetVideoMode(64, 64, 32, SDL_OPENGL)) {
+        fprintf(stderr, "could not make a GL context, %s\n", SDL_GetError());
+        return 1;
+    }
+    atexit(SDL_Quit);
+
+    struct GB_Context *gb = NULL;
+    Check(GB_ContextMake(1024, 1024 * 1024 * 3, GB_TEXTURE_FORMAT_ALPHA, GB_PACKER_SKYLINE, 0, &gb), "GB_ContextMake");
+
+    Bench(gb, "lorem.txt", "dejavu-fonts-ttf-2.33/ttf/DejaVuSans.ttf", 12, 200, 383, 2000);
+    Bench(gb, "arabic.txt", "Zar/XB Zar.ttf", 24, 60, 180, 200000);
+
+    GB_ContextRelease(gb);
+    return 0;
+}
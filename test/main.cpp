@@ -121,7 +121,7 @@ void DebugDrawGlyphCache(GB_Context* gb, const Config& config)
     GB_Cache* cache = gb->cache;
     int y = 0;
     for (uint32_t i = 0; i < cache->num_sheets; i++) {
-        DrawTexturedQuad(cache->sheet[i].gl_tex_obj, Vector2f(0, y),
+        DrawTexturedQuad(cache->sheet[i]->gl_tex_obj, Vector2f(0, y),
                          Vector2f(texture_size, texture_size),
                          Vector2f(0, 0), Vector2f(1, 1),
                          MakeColor(255, 255, 255, 255));
@@ -215,7 +215,7 @@ int main(int argc, char* argv[])
     // create the context
     GB_ERROR err;
     GB_Context* gb;
-    err = GB_ContextMake(512, 3, GB_TEXTURE_FORMAT_ALPHA, &gb);
+    err = GB_ContextMake(512, 512 * 512 * 3, GB_TEXTURE_FORMAT_ALPHA, GB_PACKER_SKYLINE, 0, &gb);
     if (err != GB_ERROR_NONE) {
         fprintf(stderr, "GB_Init Error %d\n", err);
         exit(1);
@@ -331,6 +331,12 @@ int main(int argc, char* argv[])
 
         if (!done)
         {
+            GB_ContextBeginFrame(gb);
+
+            // spread cache compaction across frames, 16k of glyph pixels per frame.
+            int compact_done;
+            GB_ContextCompactStep(gb, 16 * 1024, &compact_done);
+
             glClearColor(clearColor.x, clearColor.y, clearColor.z, clearColor.w);
             glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
@@ -0,0 +1,178 @@
+// checks every image kernel set the cpu supports against the scalar kernels, bit for bit,
+// then times each render mode with each set.
+// usage: test_image [seed]
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "../src/gb_image.h"
+
+#define NUM_ROUNDS 20000
+#define MAX_WIDTH 1100  // longer than a mono chunk, see GB_IMAGE_CHUNK
+#define MAX_ROWS 4
+#define MAX_OFFSET 64  // misaligns src & dst
+#define GUARD 64  // bytes past the last row, a kernel must not write them
+#define FILL 0xa5
+
+typedef void (*RowFunc)(uint8_t *dst, const uint8_t *src, uint32_t width);
+
+// one render mode, i.e. one kernel of each set.
+struct Mode {
+    const char *name;
+    size_t offset;  // of the kernel within struct GB_ImageKernels
+    uint32_t src_bits;  // per pixel
+    uint32_t dst_bytes;  // per pixel
+};
+
+static const struct Mode s_modes[] = {
+    {"alpha_to_rgba", offsetof(struct GB_ImageKernels, alpha_to_rgba), 8, 4},
+    {"mono_to_alpha", offsetof(struct GB_ImageKernels, mono_to_alpha), 1, 1},
+    {"mono_to_rgba", offsetof(struct GB_ImageKernels, mono_to_rgba), 1, 4},
+    {"rgb_to_rgba", offsetof(struct GB_ImageKernels, rgb_to_rgba), 24, 4},
+    {"bgr_to_rgba", offsetof(struct GB_ImageKernels, bgr_to_rgba), 24, 4},
+};
+#define NUM_MODES (sizeof(s_modes) / sizeof(s_modes[0]))
+
+static RowFunc GetKernel(const struct GB_ImageKernels *kernels, const struct Mode *mode)
+{
+    RowFunc func;
+    memcpy(&func, (const uint8_t*)kernels + mode->offset, sizeof(RowFunc));
+    return func;
+}
+
+static uint32_t SrcRowBytes(const struct Mode *mode, uint32_t width)
+{
+    return (width * mode->src_bits + 7) / 8;
+}
+
+static double Now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// converts num_rows rows of random pixels with both kernels, at random offsets & pitches.
+// returns 0 if the outputs, or the guard bytes after them, differ.
+static int CheckImage(RowFunc scalar, RowFunc kernel, const struct Mode *mode, uint8_t *src, uint8_t *expected, uint8_t *actual)
+{
+    // every tail length is covered, widths near 0 are common for glyphs so they are picked more often.
+    const uint32_t width = (rand() % 4) ? rand() % 80 : rand() % MAX_WIDTH;
+    const uint32_t num_rows = 1 + rand() % MAX_ROWS;
+    const uint32_t src_pitch = SrcRowBytes(mode, width) + rand() % 17;
+    const uint32_t dst_pitch = width * mode->dst_bytes + rand() % 17;
+    const uint32_t src_offset = rand() % MAX_OFFSET;
+    const uint32_t dst_offset = rand() % MAX_OFFSET;
+    const size_t src_size = src_offset + (size_t)src_pitch * num_rows;
+    const size_t dst_size = dst_offset + (size_t)dst_pitch * num_rows + GUARD;
+
+    size_t i;
+    for (i = 0; i < src_size; i++) {
+        // mostly empty & full pixels, like a glyph.
+        const int r = rand() % 8;
+        src[i] = r == 0 ? 0x00 : r == 1 ? 0xff : (uint8_t)rand();
+    }
+    memset(expected, FILL, dst_size);
+    memset(actual, FILL, dst_size);
+
+    uint32_t y;
+    for (y = 0; y < num_rows; y++) {
+        scalar(expected + dst_offset + y * dst_pitch, src + src_offset + y * src_pitch, width);
+        kernel(actual + dst_offset + y * dst_pitch, src + src_offset + y * src_pitch, width);
+    }
+
+    if (memcmp(expected, actual, dst_size) != 0) {
+        fprintf(stderr, "  %s mismatch, width = %u, rows = %u, src pitch = %u, dst pitch = %u, offsets = %u, %u\n",
+                mode->name, width, num_rows, src_pitch, dst_pitch, src_offset, dst_offset);
+        return 0;
+    }
+    return 1;
+}
+
+// returns megapixels per second, converting rows of width pixels.
+static double BenchMode(RowFunc kernel, const struct Mode *mode, uint32_t width, uint8_t *src, uint8_t *dst)
+{
+    const uint32_t num_pixels = 1 << 26;
+    const uint32_t num_rows = num_pixels / width;
+    const uint32_t src_pitch = SrcRowBytes(mode, width);
+    const uint32_t dst_pitch = width * mode->dst_bytes;
+
+    // rows wrap around a small buffer, so the benchmark measures the kernel, not memory bandwidth.
+    const uint32_t rows_per_buffer = 64;
+    uint32_t y;
+    double t0 = Now();
+    for (y = 0; y < num_rows; y++) {
+        const uint32_t row = y % rows_per_buffer;
+        kernel(dst + row * dst_pitch, src + row * src_pitch, width);
+    }
+    double t1 = Now();
+    return (double)num_rows * width / (t1 - t0) * 1e-6;
+}
+
+int main(int argc, char *argv[])
+{
+    srand(argc > 1 ? (unsigned)atoi(argv[1]) : 1);
+
+    const struct GB_ImageKernels *kernels[GB_IMAGE_MAX_KERNEL_SETS];
+    const uint32_t num_kernels = GB_ImageKernelsGetAll(kernels);
+    const struct GB_ImageKernels *scalar = GB_ImageKernelsGetScalar();
+    printf("kernel sets:");
+    uint32_t k;
+    for (k = 0; k < num_kernels; k++)
+        printf(" %s", kernels[k]->name);
+    printf(", selected %s\n", GB_ImageKernelsGet()->name);
+
+    const size_t buffer_size = MAX_OFFSET + (size_t)(MAX_WIDTH * 4 + 16) * MAX_ROWS + GUARD;
+    uint8_t *src = (uint8_t*)malloc(buffer_size);
+    uint8_t *expected = (uint8_t*)malloc(buffer_size);
+    uint8_t *actual = (uint8_t*)malloc(buffer_size);
+    if (!src || !expected || !actual) {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+
+    int num_failed = 0;
+    uint32_t m;
+    for (k = 0; k < num_kernels; k++) {
+        for (m = 0; m < NUM_MODES; m++) {
+            RowFunc scalar_func = GetKernel(scalar, s_modes + m);
+            RowFunc func = GetKernel(kernels[k], s_modes + m);
+            int round, ok = 1;
+            for (round = 0; round < NUM_ROUNDS && ok; round++)
+                ok = CheckImage(scalar_func, func, s_modes + m, src, expected, actual);
+            if (!ok) {
+                fprintf(stderr, "FAILED %s %s\n", kernels[k]->name, s_modes[m].name);
+                num_failed++;
+            }
+        }
+    }
+    printf("%s\n", num_failed ? "FAILED" : "all kernels match the scalar kernels");
+
+    // typical glyph rows, and long rows where the vector loops dominate.
+    const uint32_t widths[] = {24, 1024};
+    uint32_t w;
+    for (w = 0; w < sizeof(widths) / sizeof(widths[0]); w++) {
+        printf("\nwidth %u, megapixels per second\n%-16s", widths[w], "");
+        for (k = 0; k < num_kernels; k++)
+            printf("%10s", kernels[k]->name);
+        printf("\n");
+        for (m = 0; m < NUM_MODES; m++) {
+            printf("%-16s", s_modes[m].name);
+            for (k = 0; k < num_kernels; k++) {
+                uint8_t *bench_src = (uint8_t*)calloc(64, widths[w] * 3);
+                uint8_t *bench_dst = (uint8_t*)malloc((size_t)64 * widths[w] * 4);
+                printf("%10.0f", BenchMode(GetKernel(kernels[k], s_modes + m), s_modes + m, widths[w], bench_src, bench_dst));
+                free(bench_src);
+                free(bench_dst);
+            }
+            printf("\n");
+        }
+    }
+
+    free(src);
+    free(expected);
+    free(actual);
+    return num_failed ? 1 : 0;
+}
@@ -0,0 +1,358 @@
+// checks the bookkeeping of interned & compact texts: layouts are shared & ref-counted, and leave the
+// intern table with their last text. compact texts give back the glyph uses they hold.
+// also checks how fallback chains split mixed script strings into runs, where lines break without spaces,
+// and that shaping uses the hinted advances.
+// the context makes a GL texture, so an SDL window provides the GL context.
+// usage: test_text, from test/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "SDL.h"
+#include "../src/gb_context.h"
+#include "../src/gb_face.h"
+#include "../src/gb_fallback.h"
+#include "../src/gb_font.h"
+#include "../src/gb_glyph.h"
+#include "../src/gb_text.h"
+
+static int s_num_checks = 0;
+static int s_num_failed = 0;
+
+#define CHECK(cond) Check((cond), #cond, __LINE__)
+
+static void Check(int ok, const char *cond, int line)
+{
+    s_num_checks++;
+    if (!ok) {
+        fprintf(stderr, "test_text.c:%d: check failed, %s\n", line, cond);
+        s_num_failed++;
+    }
+}
+
+static void CheckError(GB_ERROR err, const char *what)
+{
+    if (err != GB_ERROR_NONE) {
+        fprintf(stderr, "%s failed, %s\n", what, GB_ErrorToString(err));
+        exit(1);
+    }
+}
+
+static uint8_t *LoadFile(const char *filename)
+{
+    FILE *fp = fopen(filename, "rb");
+    if (!fp) {
+        fprintf(stderr, "could not open %s\n", filename);
+        exit(1);
+    }
+    fseek(fp, 0, SEEK_END);
+    const long size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    uint8_t *data = (uint8_t*)malloc(size + 1);
+    if (!data || fread(data, 1, size, fp) != (size_t)size) {
+        fprintf(stderr, "could not read %s\n", filename);
+        exit(1);
+    }
+    data[size] = 0;
+    fclose(fp);
+    return data;
+}
+
+// 1 if the quads of text, offset by offset, are the quads of expected.
+static int SameQuads(struct GB_Text *text, const uint32_t offset[2], struct GB_Text *expected)
+{
+    if (text->num_glyph_quads != expected->num_glyph_quads)
+        return 0;
+    uint32_t i;
+    for (i = 0; i < text->num_glyph_quads; i++) {
+        const struct GB_GlyphQuad *q = text->glyph_quads + i;
+        const struct GB_GlyphQuad *e = expected->glyph_quads + i;
+        if (q->pen[0] + offset[0] != e->pen[0] || q->pen[1] + offset[1] != e->pen[1] ||
+            q->origin[0] + offset[0] != e->origin[0] || q->origin[1] + offset[1] != e->origin[1] ||
+            q->size[0] != e->size[0] || q->size[1] != e->size[1] || q->gl_tex_obj != e->gl_tex_obj ||
+            text->glyph_quad_glyphs[i] != expected->glyph_quad_glyphs[i])
+            return 0;
+    }
+    return 1;
+}
+
+static void TestIntern(struct GB_Context *gb, struct GB_Font *font, const uint8_t *string)
+{
+    const uint8_t *other_string = (const uint8_t*)"Hit points: 100 / 100";
+    const uint32_t num_interned = gb->num_interned;
+    uint32_t origin_a[2] = {5, 9};
+    uint32_t origin_b[2] = {50, 90};
+    uint32_t size[2] = {383, 1024};
+    struct GB_Text *a = NULL, *b = NULL, *c = NULL, *plain = NULL;
+
+    // identical texts share one layout, which holds one reference per text.
+    CheckError(GB_TextMake(gb, string, font, NULL, origin_a, size, GB_HORIZONTAL_ALIGN_LEFT,
+                           GB_VERTICAL_ALIGN_TOP, GB_TEXT_OPTION_INTERN, &a), "GB_TextMake");
+    CheckError(GB_TextMake(gb, string, font, NULL, origin_b, size, GB_HORIZONTAL_ALIGN_LEFT,
+                           GB_VERTICAL_ALIGN_TOP, GB_TEXT_OPTION_INTERN, &b), "GB_TextMake");
+    CHECK(a != b);
+    CHECK(a->layout && a->layout == b->layout);
+    CHECK(a->layout->rc == 2);
+    CHECK(a->glyph_quads == b->glyph_quads);
+    CHECK(gb->num_interned == num_interned + 1);
+
+    // quads are relative to each text's origin.
+    CheckError(GB_TextMake(gb, string, font, NULL, origin_b, size, GB_HORIZONTAL_ALIGN_LEFT,
+                           GB_VERTICAL_ALIGN_TOP, 0, &plain), "GB_TextMake");
+    CHECK(plain->layout == NULL);
+    CHECK(SameQuads(b, origin_b, plain));
+    GB_TextRelease(gb, plain);
+
+    // another string gets its own layout.
+    CheckError(GB_TextMake(gb, other_string, font, NULL, origin_a, size, GB_HORIZONTAL_ALIGN_LEFT,
+                           GB_VERTICAL_ALIGN_TOP, GB_TEXT_OPTION_INTERN, &c), "GB_TextMake");
+    CHECK(c->layout && c->layout != a->layout);
+    CHECK(gb->num_interned == num_interned + 2);
+
+    // resizing a text moves it to a layout of its new bounds, the old layout keeps its other text.
+    struct GB_Text *layout = a->layout;
+    uint32_t new_size[2] = {97, 1024};
+    CheckError(GB_TextSetBounds(gb, a, origin_a, new_size), "GB_TextSetBounds");
+    CHECK(a->layout != layout && b->layout == layout);
+    CHECK(layout->rc == 1 && a->layout->rc == 1);
+    CHECK(gb->num_interned == num_interned + 3);
+    CheckError(GB_TextMake(gb, string, font, NULL, origin_a, new_size, GB_HORIZONTAL_ALIGN_LEFT,
+                           GB_VERTICAL_ALIGN_TOP, 0, &plain), "GB_TextMake");
+    CHECK(SameQuads(a, origin_a, plain));
+    GB_TextRelease(gb, plain);
+
+    // a layout stays interned while a text holds it, & leaves the table with its last text.
+    CHECK(GB_TextRetain(gb, b) == GB_ERROR_NONE && b->rc == 2);
+    GB_TextRelease(gb, b);
+    CHECK(layout->rc == 1);
+    CHECK(gb->num_interned == num_interned + 3);
+    GB_TextRelease(gb, b);
+    CHECK(gb->num_interned == num_interned + 2);
+    GB_TextRelease(gb, a);
+    CHECK(gb->num_interned == num_interned + 1);
+    GB_TextRelease(gb, c);
+    CHECK(gb->num_interned == num_interned);
+}
+
+static struct GB_Font *GlyphFont(struct GB_Text *text, uint32_t i)
+{
+    return text->glyph_font ? text->fallback_chain->font[text->glyph_font[i]] : text->font;
+}
+
+// makes text compact, with chain if not NULL, and checks it against a text which is not.
+static void TestCompact(struct GB_Context *gb, struct GB_Font *font, struct GB_FontFallbackChain *chain,
+                        const uint8_t *string)
+{
+    uint32_t origin[2] = {3, 4};
+    uint32_t size[2] = {200, 1024};
+    struct GB_Text *text = NULL, *compact = NULL;
+    if (chain)
+        CheckError(GB_TextMakeWithFallback(gb, string, chain, NULL, origin, size, GB_HORIZONTAL_ALIGN_CENTER,
+                                           GB_VERTICAL_ALIGN_TOP, 0, &text), "GB_TextMakeWithFallback");
+    else
+        CheckError(GB_TextMake(gb, string, font, NULL, origin, size, GB_HORIZONTAL_ALIGN_CENTER,
+                               GB_VERTICAL_ALIGN_TOP, 0, &text), "GB_TextMake");
+
+    // glyph uses held by text alone.
+    const uint32_t num_glyphs = hb_buffer_get_length(text->hb_buffer);
+    hb_glyph_info_t *glyphs = hb_buffer_get_glyph_infos(text->hb_buffer, NULL);
+    uint32_t *num_users = (uint32_t*)malloc(sizeof(uint32_t) * (num_glyphs + 1));
+    uint32_t i;
+    for (i = 0; i < num_glyphs; i++) {
+        struct GB_Glyph *glyph = GB_FontFindGlyph(gb, GlyphFont(text, i), glyphs[i].codepoint);
+        num_users[i] = glyph ? glyph->num_users : 0;
+    }
+
+    if (chain)
+        CheckError(GB_TextMakeWithFallback(gb, string, chain, NULL, origin, size, GB_HORIZONTAL_ALIGN_CENTER,
+                                           GB_VERTICAL_ALIGN_TOP, GB_TEXT_OPTION_COMPACT, &compact),
+                   "GB_TextMakeWithFallback");
+    else
+        CheckError(GB_TextMake(gb, string, font, NULL, origin, size, GB_HORIZONTAL_ALIGN_CENTER,
+                               GB_VERTICAL_ALIGN_TOP, GB_TEXT_OPTION_COMPACT, &compact), "GB_TextMake");
+    const uint32_t no_offset[2] = {0, 0};
+    CHECK(compact->hb_buffer == NULL && compact->utf8_string == NULL);
+    CHECK(compact->glyph_class == NULL && compact->glyph_font == NULL);
+    CHECK(SameQuads(compact, no_offset, text));
+
+    // a move only offsets the quads, anything which needs the shaped glyphs fails & leaves the text alone.
+    uint32_t new_origin[2] = {30, 40};
+    uint32_t new_size[2] = {100, 100};
+    CHECK(GB_TextSetBounds(gb, text, new_origin, size) == GB_ERROR_NONE);
+    CHECK(GB_TextSetBounds(gb, compact, new_origin, size) == GB_ERROR_NONE);
+    CHECK(SameQuads(compact, no_offset, text));
+    CHECK(GB_TextSetBounds(gb, compact, new_origin, new_size) == GB_ERROR_INVAL);
+    CHECK(GB_TextSetAlign(gb, compact, GB_HORIZONTAL_ALIGN_RIGHT, GB_VERTICAL_ALIGN_TOP) == GB_ERROR_INVAL);
+    CHECK(SameQuads(compact, no_offset, text));
+
+    // releasing the compact text gives back every glyph use it held.
+    GB_TextRelease(gb, compact);
+    int same_users = 1;
+    for (i = 0; i < num_glyphs; i++) {
+        struct GB_Glyph *glyph = GB_FontFindGlyph(gb, GlyphFont(text, i), glyphs[i].codepoint);
+        same_users &= (glyph ? glyph->num_users : 0) == num_users[i];
+    }
+    CHECK(same_users);
+
+    free(num_users);
+    GB_TextRelease(gb, text);
+}
+
+// a compact interned text keeps its string, as the key of its layout, & can still be resized.
+static void TestCompactIntern(struct GB_Context *gb, struct GB_Font *font)
+{
+    const uint8_t *string = (const uint8_t*)"Hit points: 100 / 100";
+    uint32_t origin[2] = {0, 0};
+    uint32_t size[2] = {300, 100};
+    uint32_t new_size[2] = {50, 100};
+    struct GB_Text *a = NULL, *b = NULL, *plain = NULL;
+    CheckError(GB_TextMake(gb, string, font, NULL, origin, size, GB_HORIZONTAL_ALIGN_LEFT, GB_VERTICAL_ALIGN_TOP,
+                           GB_TEXT_OPTION_INTERN | GB_TEXT_OPTION_COMPACT, &a), "GB_TextMake");
+    CheckError(GB_TextMake(gb, string, font, NULL, origin, size, GB_HORIZONTAL_ALIGN_LEFT, GB_VERTICAL_ALIGN_TOP,
+                           GB_TEXT_OPTION_INTERN | GB_TEXT_OPTION_COMPACT, &b), "GB_TextMake");
+    CHECK(a->layout && a->layout == b->layout);
+    CHECK(a->layout->hb_buffer == NULL && a->layout->utf8_string && strcmp((const char*)a->layout->utf8_string, (const char*)string) == 0);
+
+    CHECK(GB_TextSetBounds(gb, a, origin, new_size) == GB_ERROR_NONE);
+    CHECK(a->layout != b->layout);
+    CheckError(GB_TextMake(gb, string, font, NULL, origin, new_size, GB_HORIZONTAL_ALIGN_LEFT,
+                           GB_VERTICAL_ALIGN_TOP, 0, &plain), "GB_TextMake");
+    CHECK(SameQuads(a, origin, plain));
+
+    GB_TextRelease(gb, plain);
+    GB_TextRelease(gb, a);
+    GB_TextRelease(gb, b);
+}
+
+// a script the first font lacks goes to a later font, which often covers latin too. latin must still go back
+// to the first font, while spaces, punctuation & digits stay in the current run.
+// the test fonts have no CJK font, hebrew stands in for it: dejavu sans covers hebrew & latin, droid sans only latin.
+static void TestItemize(struct GB_Context *gb, struct GB_FontFallbackChain *chain)
+{
+    struct GB_Font *latin = chain->font[0];
+    struct GB_Font *hebrew = chain->font[1];
+    CHECK(!GB_FaceCovers(latin->face, 0x05e9) && GB_FaceCovers(hebrew->face, 0x05e9));
+    CHECK(GB_FaceCovers(hebrew->face, 'a'));
+
+    // "שלום abc, 123 עולם"
+    const char *string = "\xd7\xa9\xd7\x9c\xd7\x95\xd7\x9d abc, 123 \xd7\xa2\xd7\x95\xd7\x9c\xd7\x9d";
+    const struct GB_FontRun expected[] = {{0, 9, 1}, {9, 9, 0}, {18, 8, 1}};
+    struct GB_FontRun runs[8];
+    uint32_t num_runs = 0;
+    CheckError(GB_FontFallbackChainItemize(gb, chain, (const uint8_t*)string, strlen(string), runs, 8, &num_runs),
+               "GB_FontFallbackChainItemize");
+    CHECK(num_runs == 3);
+    uint32_t i;
+    for (i = 0; i < num_runs && i < 3; i++) {
+        CHECK(runs[i].offset == expected[i].offset && runs[i].length == expected[i].length &&
+              runs[i].font_index == expected[i].font_index);
+    }
+
+    // codepoints no font covers stay in the current run.
+    const char *cjk = "abc \xe6\xbc\xa2\xe5\xad\x97 abc";  // "abc 漢字 abc"
+    CheckError(GB_FontFallbackChainItemize(gb, chain, (const uint8_t*)cjk, strlen(cjk), runs, 8, &num_runs),
+               "GB_FontFallbackChainItemize");
+    CHECK(num_runs == 1 && runs[0].font_index == 0 && runs[0].length == strlen(cjk));
+}
+
+static struct GB_TextMetrics Measure(struct GB_Context *gb, struct GB_Font *font, const char *string, uint32_t width)
+{
+    struct GB_TextMetrics metrics;
+    CheckError(GB_TextMeasure(gb, (const uint8_t*)string, font, width, 0, &metrics), "GB_TextMeasure");
+    return metrics;
+}
+
+// lines may break after hyphens, slashes & ideographs, not only at spaces.
+static void TestBreakAfter(struct GB_Context *gb, struct GB_Font *font)
+{
+    // one glyph short of fitting "well-known", so it breaks after the hyphen instead of inside "known".
+    const uint32_t width = Measure(gb, font, "well-know", 0).max_width - 1;
+    struct GB_TextMetrics metrics = Measure(gb, font, "well-known", width);
+    CHECK(metrics.num_lines == 2);
+    const uint32_t first_width = Measure(gb, font, "well-", 0).max_width;
+    const uint32_t second_width = Measure(gb, font, "known", 0).max_width;
+    CHECK(metrics.size[0] == (first_width > second_width ? first_width : second_width));
+    CHECK(metrics.min_width == second_width);
+
+    // a path only breaks after its slashes.
+    metrics = Measure(gb, font, "example.com/a/path", Measure(gb, font, "example.com/a/pa", 0).max_width - 1);
+    CHECK(metrics.num_lines == 2);
+    CHECK(metrics.size[0] == Measure(gb, font, "example.com/a/", 0).max_width);
+
+    // every ideograph is a word of its own. "漢字漢字"
+    const char *ideographs = "\xe6\xbc\xa2\xe5\xad\x97\xe6\xbc\xa2\xe5\xad\x97";
+    metrics = Measure(gb, font, ideographs, 0);
+    CHECK(metrics.min_width < metrics.max_width);
+    CHECK(metrics.min_width == Measure(gb, font, "\xe6\xbc\xa2", 0).max_width);
+}
+
+// harfbuzz gets its advances from the font's hinted advance table, the same ones unshaped text uses,
+// so the hint options change the layout of shaped text too.
+static void TestHintedAdvances(struct GB_Context *gb, struct GB_Font *font)
+{
+    struct GB_Font *unhinted = NULL;
+    CheckError(GB_FontMake(gb, "dejavu-fonts-ttf-2.33/ttf/DejaVuSans.ttf", font->point_size, GB_RENDER_NORMAL,
+                           GB_HINT_NONE, &unhinted), "GB_FontMake");
+    const char *string = "Lorem ipsum dolor sit amet";
+    uint32_t num_different = 0;
+    const char *c;
+    for (c = string; *c; c++) {
+        const uint32_t index = FT_Get_Char_Index(font->ft_face, (FT_ULong)*c);
+        int32_t advance = 0, unhinted_advance = 0;
+        CheckError(GB_GlyphGetAdvance(gb, index, font, &advance), "GB_GlyphGetAdvance");
+        CheckError(GB_GlyphGetAdvance(gb, index, unhinted, &unhinted_advance), "GB_GlyphGetAdvance");
+        CHECK(hb_font_get_glyph_h_advance(font->hb_font, index) == advance);
+        CHECK(hb_font_get_glyph_h_advance(unhinted->hb_font, index) == unhinted_advance);
+        if (advance != unhinted_advance)
+            num_different++;
+    }
+    CHECK(num_different > 0);
+    GB_FontRelease(gb, unhinted);
+}
+
+int main(int argc, char *argv[])
+{
+    if (SDL_Init(SDL_INIT_VIDEO) < 0 || !SDL_SetVideoMode(64, 64, 32, SDL_OPENGL)) {
+        fprintf(stderr, "could not make a GL context, %s\n", SDL_GetError());
+        return 1;
+    }
+    atexit(SDL_Quit);
+
+    struct GB_Context *gb = NULL;
+    CheckError(GB_ContextMake(512, 512 * 512 * 3, GB_TEXTURE_FORMAT_ALPHA, GB_PACKER_SKYLINE, 0, &gb), "GB_ContextMake");
+    struct GB_Font *font = NULL;
+    CheckError(GB_FontMake(gb, "dejavu-fonts-ttf-2.33/ttf/DejaVuSans.ttf", 12, GB_RENDER_NORMAL,
+                           GB_HINT_DEFAULT, &font), "GB_FontMake");
+    // droid sans lacks some glyphs of the test strings, so the chain falls back to the other fonts.
+    struct GB_Font *chain_fonts[3] = {NULL, font, NULL};
+    CheckError(GB_FontMake(gb, "Droid-Sans/DroidSans.ttf", 12, GB_RENDER_NORMAL,
+                           GB_HINT_DEFAULT, &chain_fonts[0]), "GB_FontMake");
+    CheckError(GB_FontMake(gb, "dejavu-fonts-ttf-2.33/ttf/DejaVuSerif.ttf", 12, GB_RENDER_NORMAL,
+                           GB_HINT_DEFAULT, &chain_fonts[2]), "GB_FontMake");
+    struct GB_FontFallbackChain *chain = NULL;
+    CheckError(GB_FontFallbackChainMake(gb, chain_fonts, 3, &chain), "GB_FontFallbackChainMake");
+
+    const char *filenames[] = {"lorem.txt", "arabic.txt", "hebrew.txt"};
+    uint32_t i;
+    for (i = 0; i < sizeof(filenames) / sizeof(filenames[0]); i++) {
+        uint8_t *string = LoadFile(filenames[i]);
+        TestIntern(gb, font, string);
+        TestCompact(gb, font, NULL, string);
+        TestCompact(gb, font, chain, string);
+        free(string);
+    }
+    TestCompactIntern(gb, font);
+    TestItemize(gb, chain);
+    TestBreakAfter(gb, font);
+    TestHintedAdvances(gb, font);
+    CHECK(gb->num_interned == 0);
+
+    GB_FontFallbackChainRelease(gb, chain);
+    GB_FontRelease(gb, chain_fonts[0]);
+    GB_FontRelease(gb, chain_fonts[2]);
+    GB_FontRelease(gb, font);
+    GB_ContextRelease(gb);
+
+    printf("%d checks, %d failed\n", s_num_checks, s_num_failed);
+    return s_num_failed ? 1 : 0;
+}